@@ -34,6 +34,7 @@
  *   D1 (GPIO2)  = DS18B20 DATA (+ 4.7kΩ pull-up)
  *   D2 (GPIO3)  = DHT11 DATA
  *   D3 (GPIO4)  = Button (to GND + 10kΩ pull-up to 3.3V)
+ *                 + DS3231 INT/SQW (open-drain, shares the button line)
  *   D4 (GPIO5)  = I2C SDA (LCD + RTC)
  *   D5 (GPIO6)  = I2C SCL (LCD + RTC)
  *   D6 (GPIO43) = IR LED (via 100Ω)
@@ -46,10 +47,18 @@
  */
 
 #include "esp_camera.h"
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+#include "esp_dsp.h"
 #include "esp_sleep.h"
+#include "esp_rom_crc.h"
+#include "esp_pm.h"
+#include "esp_partition.h"
 #include "driver/i2s_pdm.h"
 #include "FS.h"
 #include "SD_MMC.h"
+#include "ff.h"
+#include "diskio_sdmmc.h"
 #include "USB.h"
 #include "USBMSC.h"
 #include <BLEDevice.h>
@@ -62,6 +71,8 @@
 #include <DHT.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
+#include <Preferences.h>
+#include <functional>
 
 // ============================================================================
 // PIN CONFIGURATION
@@ -116,6 +127,175 @@
 #define USB_CHECK_DELAY         10000      // 10 second delay before checking for USB MSC mode
 #define USB_MSC_ENABLED         true       // Enable USB Mass Storage auto-detection
 
+// Solar Schedule Configuration
+// Active windows follow sunset/sunrise at the trap site instead of the fixed
+// ACTIVE_START_HOUR/ACTIVE_END_HOUR (which stay in use when this is false).
+// The RTC is set from the build host's clock, so SITE_UTC_OFFSET_MIN is the
+// host's UTC offset at flash time (no DST switching on the device).
+#define ENABLE_SOLAR_SCHEDULE   false
+#define SITE_LATITUDE           51.48      // Degrees, north positive
+#define SITE_LONGITUDE          -0.01      // Degrees, east positive
+#define SITE_UTC_OFFSET_MIN     0          // Local (RTC) time minus UTC
+
+// Each window opens at an anchor + offset (minutes) and closes at another.
+// SUN_CLOCK offsets are minutes after midnight. A window that closes at or
+// before it opens runs over midnight.
+enum SunAnchor { SUN_CLOCK, SUN_SET, SUN_RISE };
+struct ActiveWindow { SunAnchor startAnchor; int startOffset; SunAnchor endAnchor; int endOffset; };
+const ActiveWindow ACTIVE_WINDOWS[] = {
+    { SUN_SET, -30, SUN_RISE, 30 },        // Dusk to dawn, with 30 min either side
+    // { SUN_SET, 0, SUN_SET, 240 },       // e.g. first four hours of darkness ...
+    // { SUN_RISE, -120, SUN_RISE, 0 },    // ... plus the two hours before dawn
+};
+const int ACTIVE_WINDOW_COUNT = sizeof(ACTIVE_WINDOWS) / sizeof(ACTIVE_WINDOWS[0]);
+
+// RTC Alarm Wake Configuration
+// The DS3231 INT/SQW output is open-drain and active LOW, so it is wired to the
+// button line (D3). The trap then sleeps once until the start of active hours
+// instead of waking every WAKE_CHECK_INTERVAL to re-check the clock.
+#define ENABLE_RTC_ALARM_WAKE   true       // false = legacy timer-chunk wake
+#define RTC_ALARM_PIN           BUTTON_PIN // DS3231 INT/SQW (shared with button)
+#define RTC_ALARM_BACKSTOP_MIN  10         // Timer wake this long after the alarm, in case INT is not wired
+#define AWAKE_CURRENT_MA        100        // Approx. current while awake (for wake energy estimate)
+
+// Fast Wake Configuration
+// Timer / GPIO wakes skip the serial wait, banners, USB window and DHT settle
+// delay, and bring camera + BLE up lazily once the IR beam is being watched.
+#define FAST_WAKE_ENABLED       true
+#define FAST_WAKE_TARGET_MS     500        // Budget from reset to IR armed on a fast wake
+#define FAST_WAKE_BLE_DELAY_MS  1000       // Start BLE this long after a fast wake
+#define DHT_SETTLE_MS           2000       // DHT11 needs ~2s after power-up before first read
+#define BOOT_PROFILE_MAX_STAGES 16
+
+// ULP Beam Monitor Configuration
+// Keeps counting beam breaks in deep sleep during active hours: the ULP
+// coprocessor pulses the IR LED, samples the receiver and wakes the main CPU
+// only when a break needs recording (or a batch of breaks has built up).
+// The ULP can only drive RTC GPIOs (GPIO0-21), so the IR LED and receiver
+// must be moved off D6/D7 before enabling this.
+#define ENABLE_ULP_BEAM_MONITOR  false
+#define ULP_SAMPLE_PERIOD_US     5000     // Beam sampled every 5 ms
+#define ULP_SETTLE_CYCLES        800      // IR LED on -> receiver sample (~100 us @ 8 MHz)
+#define ULP_WAKE_THRESHOLD       1        // Breaks before waking the CPU (1 = every detection)
+#define ULP_RECORD_ON_WAKE       true     // Record a clip for the break that woke the CPU
+#define ULP_IDLE_BEFORE_SLEEP_MS 15000    // Idle time in active hours before handing over to the ULP
+
+#if ENABLE_ULP_BEAM_MONITOR && (IR_LED_PIN > 21 || IR_RECEIVER_PIN > 21)
+#error "ULP beam monitor needs the IR LED and receiver on RTC GPIOs (GPIO0-21)"
+#endif
+
+#if ENABLE_ULP_BEAM_MONITOR
+#include "esp32s3/ulp.h"
+#include "driver/rtc_io.h"
+#include "soc/rtc_io_reg.h"
+#endif
+
+// Moth Classifier Configuration
+// An int8 TFLite Micro model scores the first frames of each clip, and clips
+// that don't look like a moth (beetles, rain, grass) are discarded. Needs a
+// TFLite Micro Arduino library built with ESP-NN (S3 vector kernels) and the
+// model as moth_model.h next to the sketch: xxd -i moth_model.tflite.
+// Benchmark a model on the host first with tools/classifier_bench.py.
+#define ENABLE_MOTH_CLASSIFIER  false
+#define CLASSIFIER_INPUT_SIZE   96        // Model input: 96x96x1 int8 grayscale
+#define CLASSIFIER_SKIP_FRAMES  1         // Frames left for exposure to settle
+#define CLASSIFIER_FRAMES       3         // Frames scored per clip (averaged)
+#define CLASSIFIER_KEEP_SCORE   0.30      // Keep clips with a moth score at or above this
+#define CLASSIFIER_DISCARD      true      // false = label rows only, keep every clip
+#define CLASSIFIER_ARENA_SIZE   (160 * 1024)  // Tensor arena (PSRAM)
+
+// Motion Detector Configuration
+// Visual confirmation of IR triggers: each recorded frame is decoded at 1/8
+// scale and differenced against the previous one. Clips with no motion can
+// be dropped, and still frames after the insect has gone are trimmed off.
+#define ENABLE_MOTION_DETECTOR      true
+#define MOTION_PIXEL_THRESHOLD      24     // Gray-level change that counts as motion (< 127)
+#define MOTION_CONFIRM_PERMILLE     4      // Frame has motion if this many pixels per 1000 changed
+#define MOTION_GLOBAL_PERMILLE      600    // More than this changed = exposure change, ignored
+#define MOTION_TAIL_FRAMES          15     // Frames kept after the last motion (1 s at 15 fps)
+#define MOTION_MIN_FRAMES           30     // Never trim a clip shorter than this
+#define MOTION_DISCARD_UNCONFIRMED  false  // true = delete clips with no motion at all
+
+// Static Frame Elision Configuration
+// A frame with no motion and about the same JPEG size as the last frame
+// written is stored as a zero-length "00dc" chunk - the AVI drop-frame marker,
+// so players hold the previous image and the clip keeps its timing.
+// Uses the motion detector's scores.
+#define ENABLE_FRAME_ELISION        true
+#define ELIDE_MAX_PERMILLE          1      // Changed pixels per 1000 at or below this = still
+#define ELIDE_SIZE_PCT              3      // JPEG size within this % of the last frame written
+#define ELIDE_MAX_RUN               15     // Write a real frame at least this often (1 s at 15 fps)
+
+#if ENABLE_MOTH_CLASSIFIER
+#include "tensorflow/lite/micro/micro_interpreter.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "moth_model.h"                   // moth_model_tflite[], moth_model_tflite_len
+#endif
+
+// CPU Frequency Scaling Configuration
+// DYNAMIC: CPU idles at CPU_FREQ_IDLE_MHZ and takes a max-frequency lock only
+// for recording, AVI finalization, BLE transfers and USB drive mode.
+// FIXED: CPU stays at CPU_FREQ_MAX_MHZ (original behaviour).
+#define CPU_POLICY_DEFAULT      CPU_POLICY_DYNAMIC
+#define CPU_FREQ_MAX_MHZ        240
+#define CPU_FREQ_IDLE_MHZ       80       // Lowest clock that keeps BLE and APB at 80 MHz
+
+// Camera Power Policy Configuration
+// What the OV2640 does between detections during active hours:
+//   CAM_POWER_STREAM  - stays initialized and streaming (fastest, highest current)
+//   CAM_POWER_STANDBY - SCCB soft standby (COM2), driver stays loaded
+//   CAM_POWER_OFF     - full esp_camera_deinit(), re-init on the next detection
+#define CAM_POWER_DEFAULT       CAM_POWER_STANDBY
+#define CAM_WAKE_TIMEOUT_MS     2000     // Give up waiting for a valid frame after this
+
+// Battery Monitoring Configuration
+// Battery voltage through a 2:1 divider (2 x 100kΩ) to a free ADC pin.
+// The default wiring has no spare pad: leave BATTERY_ADC_PIN at -1 and the
+// trap stays in FULL mode (BATSIM:<mV> can still drive the policy on the bench).
+#define BATTERY_ADC_PIN           -1
+#define BATTERY_DIVIDER_RATIO     2.0
+#define BATTERY_CHECK_INTERVAL_MS 60000
+// Degradation steps (battery mV) - each step applies below its threshold
+#define BATTERY_REDUCED_MV        3700     // Lower video resolution (QQVGA)
+#define BATTERY_AUDIO_ONLY_MV     3550     // No video
+#define BATTERY_COUNT_ONLY_MV     3450     // No recording, LCD off, BLE advertising only
+#define BATTERY_HYSTERESIS_MV     50       // Must recover this far above a threshold to step back up
+#define ULP_COUNT_ONLY_BATCH      20       // ULP wake threshold in count-only mode
+
+// Recording Storm Protection Configuration
+// A flickering beam (misalignment, spider web, rain) would otherwise record
+// back-to-back all night. Clips are rate limited by a token bucket and a
+// stuck or oscillating beam suspends recording until it behaves again.
+// Detections are always counted; suppressions are logged to health.csv.
+#define ENABLE_STORM_PROTECTION   true
+#define STORM_BURST               10       // Clips that can be recorded back-to-back
+#define STORM_REFILL_MS           180000   // One more clip allowed every 3 minutes
+#define BEAM_STUCK_MS             120000   // Blocked this long = stuck
+#define BEAM_RECOVER_MS           30000    // Clear this long to leave stuck
+#define BEAM_RATE_WINDOW_MS       60000    // Break rate measured over this window
+#define BEAM_OSC_BREAKS_MIN       30       // Breaks per minute = oscillating
+#define BEAM_RECOVER_BREAKS_MIN   6        // Back at or below this = healthy
+
+// Energy Accounting Configuration
+// Current drawn by each subsystem while in that state (mA, 3.7V battery side).
+// ESTIMATES from datasheets and the README power table, not measurements -
+// replace them with bench readings for this hardware before trusting the
+// ENERGY: figures or battery_model.py projections.
+// States stack: a recording costs CPU_ACTIVE + CAMERA + SD_WRITE + IR_LED + MIC,
+// ~300mA, the README's Recording figure.
+#define CURRENT_CPU_ACTIVE_MA   45.0     // CPU running at full clock, radios and peripherals off
+#define CURRENT_CPU_LOW_MA      22.0     // CPU running at CPU_FREQ_IDLE_MHZ
+#define CURRENT_DEEP_SLEEP_MA   0.014
+#define CURRENT_CAMERA_MA       190.0    // OV2640 streaming, incl. its LDOs and the PSRAM/DMA capture path
+#define CURRENT_CAMERA_STBY_MA  6.0      // OV2640 in SCCB standby, driver loaded
+#define CURRENT_MIC_MA          1.5
+#define CURRENT_IR_LED_MA       15.0
+#define CURRENT_BLE_ADV_MA      8.0
+#define CURRENT_BLE_CONN_MA     12.0
+#define CURRENT_SD_WRITE_MA     40.0
+#define CURRENT_LCD_BACKLIGHT_MA 20.0
+
 // Environmental Logging Configuration
 #define ENV_LOG_INTERVAL_MS     60000    // Log environment every 60 seconds (1 minute)
                                          // Change to 3600000 for hourly logging
@@ -130,8 +310,107 @@
 #define AUDIO_SAMPLE_RATE    16000    // 16kHz
 #define AUDIO_BITS           16
 
+// Compressed Audio Configuration
+// IMA-ADPCM (WAV format 0x11) stores 4 bits per sample - a quarter of the SD
+// space and BLE transfer time of 16-bit PCM. Wingbeat analysis and the event
+// features still see the full PCM. Not every player handles 0x11 (browsers
+// don't); ffmpeg, Audacity and Python soundfile do.
+#define ENABLE_ADPCM_AUDIO       false
+#define ADPCM_BLOCK_ALIGN        512      // Bytes per block (standard for 16 kHz mono)
+#define ADPCM_SAMPLES_PER_BLOCK  ((ADPCM_BLOCK_ALIGN - 4) * 2 + 1)
+
+// Background Finalization Configuration
+// Trimming, classification, AVI build and logging run on a finalizer task
+// once capture ends, so the beam is watched again straight away.
+#define FINALIZE_QUEUE_LEN       3        // Captured events waiting; recordEvent waits when full
+#define FINALIZE_DRAIN_MS        30000    // Longest wait for pending clips before sleeping
+
+// SD I/O Scheduler Configuration
+// One task owns the card; everything else queues short I/O requests by
+// class (recording > logs > bulk) and waits. DIAG SDIO: has the latencies.
+#define SDIO_QUEUE_LEN           8        // Waiting requests per class
+#define SDIO_TASK_PRIORITY       2        // Above the capture/finalize tasks
+#define SDIO_HIST_BUCKETS        8
+#define SDIO_HIST_EDGES_MS       1, 2, 5, 10, 20, 50, 100  // Bucket upper edges (last bucket open)
+
+// Background Deletion Configuration
+// RESET moves /events and /logs into the trash and answers at once; the
+// maintenance task deletes it.
+#define TRASH_DIR                "/trash"
+#define TRASH_BAD_DIR            "/trash.bad"  // Entries that would not delete, moved out of the way
+#define TRASH_BATCH              8        // Files deleted per SD request
+#define TRASH_FORMAT_AU          32768    // Cluster size for RESET:FORMAT
+
+// Maintenance Configuration
+// Low-priority jobs - deferred deletes, recovery of cut-off clips,
+// thumbnails and checksums, log rotation - run while the trap is idle and
+// for a bounded time before the daytime sleep, within a daily charge.
+#define MAINT_IDLE_MS            10000    // Quiet time at night before jobs run
+#define MAINT_SLEEP_HOLD_MS      300000   // Longest sleep delay per wake for pending jobs
+#define MAINT_BUDGET_MAH         10.0     // Daily charge for maintenance steps
+#define MAINT_LOG_ROTATE_KB      512      // Logs past this move to /logs/archive
+#define MAINT_THUMB_QUALITY      60       // Quarter-scale gray thumbnail JPEG quality
+#define MAINT_NVS_NAMESPACE      "maint"  // Clip pass checkpoint
+
+// Nightly Summary Configuration
+// One /logs/nightly.csv row per active window; tonight's count and last
+// night's total go in the BLE scan response.
+#define ENABLE_NIGHT_ADVERT      true
+#define ADVERT_COMPANY_ID        0xFFFF   // Manufacturer data ID (0xFFFF = unassigned/testing)
+
+// Flash Log Configuration
+// Detections and env readings that can't reach the SD card go to a ring of
+// 32-byte records in the "traplog" partition (partitions.csv). They are
+// copied to the CSVs once a card is back.
+#define ENABLE_FLASH_LOG         true
+#define FLOG_PARTITION           "traplog"
+#define FLOG_SD_RETRY_MS         60000    // Remount attempts while the card is missing
+#define FLOG_REPLAY_BATCH        32       // Records copied to SD per maintenance step
+#define FLOG_BENCH_RECORDS       16       // Appends timed by FLOG:BENCH
+#define FLOG_ERASE_CYCLES        100000   // Rated NOR flash sector endurance
+
+// Wingbeat Analysis Configuration
+// Event audio is decimated and FFT'd (esp-dsp) while it is captured. The
+// dominant wingbeat frequency, harmonics and SNR go into detections.csv and
+// a per-window band summary (_spec.csv) is saved next to the WAV.
+#define ENABLE_WINGBEAT_ANALYSIS true
+#define WINGBEAT_DECIMATION      8        // 16 kHz -> 2 kHz
+#define WINGBEAT_RATE            (AUDIO_SAMPLE_RATE / WINGBEAT_DECIMATION)
+#define WINGBEAT_FFT_SIZE        1024     // ~2 Hz bins, one window per ~0.5 s
+#define WINGBEAT_MIN_HZ          15.0f    // Search band for the fundamental
+#define WINGBEAT_MAX_HZ          600.0f
+#define WINGBEAT_SUMMARY_BANDS   16       // Log-spaced bands per summary row
+
+// Acoustic Trigger Configuration
+// Between recordings the mic listens at a low rate and a band-pass energy
+// detector looks for flight tones. In corroborate mode hits are only matched
+// against IR breaks (logged in detections.csv "trigger"); in trigger mode a
+// hit also starts a recording. Listening stops whenever the CPU sleeps.
+#define ACOUSTIC_MODE_CORROBORATE 0
+#define ACOUSTIC_MODE_TRIGGER     1
+#define ENABLE_ACOUSTIC_TRIGGER  false
+#define ACOUSTIC_MODE            ACOUSTIC_MODE_CORROBORATE
+#define ACOUSTIC_RATE            8000     // Listener sample rate
+#define ACOUSTIC_BLOCK_SAMPLES   256      // One DMA block = 32 ms
+#define ACOUSTIC_BAND_HZ         200.0f   // Band-pass centre
+#define ACOUSTIC_BAND_Q          0.7f
+#define ACOUSTIC_TRIGGER_DB      9.0f     // Band level above the noise floor
+#define ACOUSTIC_HOLD_BLOCKS     4        // Consecutive loud blocks for a hit (~130 ms)
+#define ACOUSTIC_FLOOR_ALPHA     0.01f    // Noise floor tracking rate per quiet block
+#define ACOUSTIC_REFRACTORY_MS   2000
+#define ACOUSTIC_AGREE_MS        3000     // IR and acoustic hits this close are one event
+
 #define CHUNK_SIZE      64
 #define CHUNK_DELAY_MS  30
+#define CHUNK_SIZE_MAX  240      // Hex-encoded chunk must fit one notification at the largest MTU
+#define BLE_MTU         517      // Offered to the central; the chunk is capped by what it accepts
+#define JPEG_QUALITY    12       // 0-63, lower = better
+
+// Runtime Configuration
+// The values above are defaults. The live copy is kept in NVS and changed
+// with CFG: commands over BLE or serial - no reflash needed.
+#define RUNTIME_CONFIG_VERSION  1        // Bump when RuntimeConfig changes layout
+#define CONFIG_NVS_NAMESPACE    "smarttrap"
 
 // ============================================================================
 // OBJECTS
@@ -198,9 +477,455 @@ String currentAudioPath = "";
 // Power saving state
 bool isActiveHours = true;
 unsigned long lastSleepCheck = 0;
+esp_sleep_wakeup_cause_t wakeupCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+bool wokeByRtcAlarm = false;
+bool bootSawActiveHours = false;   // Any active-hours time seen since this boot
+
+// Fast wake / lazy init state
+bool fastWake = false;
+bool cameraInitPending = false;    // Camera started on first use
+bool bleInitPending = false;       // BLE started shortly after boot
+unsigned long dhtProbeAt = 0;      // millis() at which the DHT can be probed (0 = done)
+
+// Boot profiler
+struct BootStage {
+    const char* name;
+    unsigned long ms;               // millis() at end of stage
+};
+BootStage bootStages[BOOT_PROFILE_MAX_STAGES];
+int bootStageCount = 0;
+unsigned long bootArmedMs = 0;     // millis() when IR monitoring was armed
+
+// ULP beam monitor state
+RTC_DATA_ATTR bool ulpArmed = false;   // ULP was counting while we slept
+unsigned long lastActivityMs = 0;      // Last detection / button / BLE activity
+uint32_t ulpLastBatch = 0;             // Breaks counted by the ULP during the last sleep
+
+// Wake statistics (survive deep sleep, reset on power loss)
+// A "spurious" wake is a wake from sleep that goes straight back to sleep
+// without ever reaching active hours.
+RTC_DATA_ATTR uint32_t wakeStatsDay = 0;           // YYYYMMDD of "today" counters
+RTC_DATA_ATTR uint16_t wakesToday = 0;
+RTC_DATA_ATTR uint16_t spuriousWakesToday = 0;
+RTC_DATA_ATTR uint32_t spuriousAwakeMsToday = 0;
+RTC_DATA_ATTR uint16_t spuriousWakesYesterday = 0;
+RTC_DATA_ATTR uint32_t spuriousAwakeMsYesterday = 0;
 
 // Environmental logging state
 unsigned long lastEnvLog = 0;
+uint32_t lastEnvLogEpoch = 0;      // RTC unixtime of last env log (0 = never)
+
+// Storage usage (cached - SD_MMC.usedBytes() walks the FAT)
+uint64_t sdTotalBytes = 0;
+uint64_t sdUsedBytes = 0;
+
+// SD I/O scheduler - per-class request queues served by one task
+enum SdClass { SD_CLASS_RECORD, SD_CLASS_LOG, SD_CLASS_BULK, SD_CLASS_COUNT };
+
+struct SdRequest {
+    std::function<void()>* fn;   // Runs on the SD task
+    SemaphoreHandle_t done;      // Given when fn returns
+    int64_t queuedUs;
+    int64_t* runUs;              // Set to the time fn took
+};
+
+QueueHandle_t sdQueues[SD_CLASS_COUNT];
+SemaphoreHandle_t sdWork = NULL;       // One count per queued request
+TaskHandle_t sdTaskHandle = NULL;
+uint32_t sdHist[SD_CLASS_COUNT][SDIO_HIST_BUCKETS];
+int64_t sdMaxUs[SD_CLASS_COUNT];
+
+// ============================================================================
+// ENERGY ACCOUNTING STATE
+// ============================================================================
+
+// Time-in-state counters. States overlap (camera on while CPU active), so
+// each state's current is the extra draw on top of the others.
+enum EnergyState {
+    E_CPU_ACTIVE, E_CPU_LOW, E_DEEP_SLEEP, E_CAMERA, E_CAMERA_STBY, E_MIC, E_IR_LED,
+    E_BLE_ADV, E_BLE_CONN, E_SD_WRITE, E_LCD_BACKLIGHT, E_STATE_COUNT
+};
+
+const char* ENERGY_STATE_NAMES[E_STATE_COUNT] = {
+    "cpu", "cpuLow", "deep", "cam", "camStby", "mic", "ir", "bleAdv", "bleConn", "sd", "lcd"
+};
+
+// energy.csv column order. The first ENERGY_CSV_FIRST states have _s and
+// _mah blocks in the original layout; states added since go after the
+// trailing columns, so rows still line up under an older file's header.
+// A file whose header differs anyway (a state was removed) is archived by
+// logEnergy() before the next row goes in.
+const EnergyState ENERGY_CSV_ORDER[E_STATE_COUNT] = {
+    E_CPU_ACTIVE, E_DEEP_SLEEP, E_CAMERA, E_MIC, E_IR_LED, E_BLE_ADV, E_BLE_CONN,
+    E_SD_WRITE, E_LCD_BACKLIGHT, E_CPU_LOW, E_CAMERA_STBY
+};
+const int ENERGY_CSV_FIRST = 9;
+
+const float ENERGY_CURRENT_MA[E_STATE_COUNT] = {
+    CURRENT_CPU_ACTIVE_MA, CURRENT_CPU_LOW_MA, CURRENT_DEEP_SLEEP_MA,
+    CURRENT_CAMERA_MA, CURRENT_CAMERA_STBY_MA, CURRENT_MIC_MA, CURRENT_IR_LED_MA, CURRENT_BLE_ADV_MA,
+    CURRENT_BLE_CONN_MA, CURRENT_SD_WRITE_MA, CURRENT_LCD_BACKLIGHT_MA
+};
+
+uint64_t energyUs[E_STATE_COUNT];     // Time in each state this period (microseconds)
+uint32_t energyPeriodStart = 0;       // RTC unixtime the period started (0 = unknown)
+unsigned long energyLastSample = 0;   // millis() of last energySample()
+portMUX_TYPE energyMux = portMUX_INITIALIZER_UNLOCKED;  // SD writes come from both cores
+bool irLedOn = false;
+volatile bool micActive = false;
+
+// CPU frequency policy
+enum CpuPolicy { CPU_POLICY_FIXED, CPU_POLICY_DYNAMIC };
+CpuPolicy cpuPolicy = CPU_POLICY_DEFAULT;
+int cpuBoostCount = 0;                // Nested max-frequency requests
+#if CONFIG_PM_ENABLE
+esp_pm_lock_handle_t cpuMaxLock = NULL;
+#endif
+// Battery and degradation policy
+enum PowerMode { POWER_FULL, POWER_REDUCED, POWER_AUDIO_ONLY, POWER_COUNT_ONLY };
+PowerMode powerMode = POWER_FULL;
+uint32_t batteryMv = 0;               // Last reading (0 = unknown)
+volatile uint32_t batterySimMv = 0;   // Simulated battery voltage (0 = use ADC)
+volatile bool batterySimPending = false;  // BATSIM: from BLE, applied in loop()
+unsigned long lastBatteryCheck = 0;
+
+// Storm protection state
+enum BeamHealth { BEAM_OK, BEAM_STUCK, BEAM_OSCILLATING };
+BeamHealth beamHealth = BEAM_OK;
+float stormTokens = STORM_BURST;         // Clips available now
+unsigned long stormRefillMs = 0;
+bool stormLimited = false;               // Bucket ran dry, next clip logs the resume
+uint32_t stormSuppressed = 0;            // Detections counted without a clip since boot
+uint32_t stormRunStart = 0;              // stormSuppressed when the current suppression began
+unsigned long beamBlockedSinceMs = 0;
+unsigned long beamClearSinceMs = 0;
+unsigned long beamWindowStartMs = 0;
+uint32_t beamWindowBreaks = 0;
+uint32_t beamBreaksPerMin = 0;           // Last completed window
+
+// Per-event metadata: logged with each detections.csv row, LASTEVENT over BLE.
+// Capture fields are filled in by the recording tasks as data passes through.
+struct EventFeatures {
+    uint32_t detection = 0;
+    String label = "";           // Classifier verdict ("" = not run)
+    float classScore = -1;       // -1 = not scored
+    int motionPeak = -1;         // Peak motion permille, -1 = not measured
+    float wingbeatHz = -1;       // Dominant wingbeat frequency, -1 = not measured
+    float wingbeatSnrDb = 0;
+    float harm2Db = 0;           // 2nd / 3rd harmonic relative to the fundamental
+    float harm3Db = 0;
+    String trigger = "";         // Channels that saw it: ir, audio, ir+audio
+    
+    // Video capture (frames = -1: no video)
+    int frames = -1;
+    float fps = 0;               // Achieved, not configured
+    float jpegMean = 0;          // Frame size, bytes
+    float jpegStd = 0;
+    
+    // Audio capture (hasAudio = false: no audio)
+    bool hasAudio = false;
+    float rmsDbfs = 0;
+    float peakDbfs = 0;
+    
+    long beamMs = -1;            // How long the beam stayed broken, -1 = no IR break
+};
+EventFeatures eventFeatures;
+EventFeatures lastEvent;                 // Last logged detection (LASTEVENT)
+
+// IR beam edges, timed in onBeamEdge(). A break lasts until its first clear;
+// the previous one is kept in case it cleared and broke again meanwhile.
+struct BeamBreak { unsigned long breakMs; unsigned long clearMs; };  // clearMs 0 = still broken
+volatile BeamBreak beamNow = { 0, 0 };
+volatile BeamBreak beamPrev = { 0, 0 };
+portMUX_TYPE beamMux = portMUX_INITIALIZER_UNLOCKED;
+
+// A captured event waiting for the finalizer: the video's temp file and
+// frame tables, plus everything needed to log it once the AVI is built
+struct FinalizeJob {
+    String videoTemp = "";               // "" = no video captured
+    String videoPath;
+    String audioPath;
+    uint32_t* frameSizes = NULL;
+    uint32_t* frameOffsets = NULL;
+    uint32_t* frameTimes = NULL;
+    uint16_t* motionScores = NULL;       // NULL = motion not measured
+    int frameCount = 0;
+    int width = 0;
+    int height = 0;
+    int fps = 0;
+    uint32_t totalDataSize = 0;
+    uint32_t maxFrameSize = 0;
+    uint16_t motionPeak = 0;
+    EventFeatures features;
+    SensorData conditions;               // Sensor readings at the trigger
+};
+QueueHandle_t finalizeQueue = NULL;
+SemaphoreHandle_t logMutex = NULL;       // detections.csv and lastEvent - loop and finalizer both write
+SemaphoreHandle_t finalizeMutex = NULL;  // One finalizeVideo() at a time - finalizer or clip recovery
+uint32_t finalizeQueued = 0;             // Jobs handed over by recordEvent
+volatile uint32_t finalizeDone = 0;      // Jobs finished by the finalizer
+uint32_t finalizeReleased = 0;           // Completions loop() has acted on
+volatile bool captureActive = false;     // Capture tasks running - finalizer keeps off the card
+unsigned long finalizeLastMs = 0;
+unsigned long finalizeMaxMs = 0;
+
+// Background deletion
+enum TrashState { TRASH_IDLE, TRASH_RECLAIMING, TRASH_FORMATTING, TRASH_ERROR };
+enum TrashStepResult { TRASH_STEP_MORE, TRASH_STEP_DONE, TRASH_STEP_ERROR };
+volatile TrashState trashState = TRASH_IDLE;     // Written by the maintenance task only
+volatile bool trashFormatPending = false;  // RESET:FORMAT waiting for the maintenance task
+volatile bool trashMovePending = false;    // RESET waiting for the maintenance task
+uint32_t trashFiles = 0;                 // Deleted since the last RESET
+uint64_t trashBytes = 0;                 // Freed since the last RESET
+uint64_t trashTotalBytes = 0;            // Binned by RESET (0 = unknown, resumed after a reboot)
+uint32_t trashErrors = 0;
+unsigned long trashStartMs = 0;
+
+// Maintenance jobs, in priority order
+enum MaintJobId { MAINT_REPLAY, MAINT_TRASH, MAINT_RECOVER, MAINT_CLIPS, MAINT_LOGS, MAINT_JOB_COUNT };
+struct MaintJob {
+    const char* name;
+    bool (*step)();                      // One bounded unit of work; false = nothing left
+    volatile bool pending;
+    volatile uint32_t requests;          // maintQueue() calls - one made during a step keeps the job pending
+    uint32_t steps;
+};
+extern MaintJob maintJobs[MAINT_JOB_COUNT];
+volatile bool maintPaused = false;       // Set on the way into deep sleep
+volatile bool maintBusy = false;         // A step is running
+unsigned long maintSleepHoldMs = 0;      // When pending jobs first held off the daytime sleep
+float maintMahToday = 0;                 // Charged to the daily budget (reset at midnight)
+TaskHandle_t maintTaskHandle = NULL;
+int64_t maintIoUs = 0;                   // SD request time of maintenance steps, queue waits left out
+String maintClipCursor = "";             // Last clip done by the thumbnail/checksum pass
+uint32_t maintThumbs = 0;
+uint32_t maintChecksums = 0;
+uint32_t maintRecovered = 0;
+uint32_t maintRotated = 0;
+uint32_t maintCompacted = 0;
+
+// Nightly summary - carried across deep sleep in rtcState, lost on a power cut
+struct NightRange { float min; float max; float sum; uint16_t samples; };
+struct NightStats {
+    uint32_t night;                      // YYYYMMDD the window opened, 0 = not open
+    uint16_t detections;
+    uint16_t perHour[24];
+    int32_t firstSec;                    // Seconds of day, -1 = none
+    int32_t lastSec;
+    uint16_t envSamples;
+    NightRange air, hum, soil;
+    uint16_t recFailures;
+    uint32_t droppedFrames;
+    float energyMah;                     // Used inside the window, up to the last energy.csv period
+    float energyMarkMah;                 // energyTotalMah() at the window open or last period start
+};
+NightStats night;
+NightStats lastNight;
+uint16_t advertisedDetections = 0xFFFF;
+
+// Flash log - one record per slot, slot = seq % flogSlots. Erased flash is
+// all ones, and bits can be cleared without an erase, so replayed starts
+// at 0xFF and is zeroed in place once the record is on the card.
+#define FLOG_SECTOR_SIZE 4096
+#define FLOG_PER_SECTOR  (FLOG_SECTOR_SIZE / sizeof(FlogRecord))
+enum FlogType { FLOG_DETECTION = 1, FLOG_ENV = 2, FLOG_BENCH = 3 };
+enum FlogFlags { FLOG_IR = 1, FLOG_AUDIO = 2, FLOG_MOTH = 4, FLOG_OTHER = 8 };
+struct FlogRecord {
+    uint32_t seq;                        // Write order, 0xFFFFFFFF = erased
+    uint32_t time;                       // Unix time, 0 = no RTC
+    uint32_t crc;                        // CRC-32 of the record, replayed as 0xFF
+    uint8_t type;
+    uint8_t replayed;
+    uint8_t flags;                       // FlogFlags
+    uint8_t classScore;                  // Percent, 0xFF = not scored
+    uint32_t detection;
+    int16_t airTemp;                     // Tenths, INT16_MIN = not read
+    int16_t humidity;
+    int16_t soilTemp;
+    uint16_t soilMoisture;
+    uint16_t motion;                     // 0xFFFF = not measured
+    uint16_t beamMs;
+};
+static_assert(sizeof(FlogRecord) == 32, "FlogRecord must divide the flash sector");
+const esp_partition_t* flogPart = NULL;
+esp_partition_mmap_handle_t flogMap;
+const FlogRecord* flogRecords = NULL;    // The partition, read through the cache
+uint32_t flogSlots = 0;
+uint32_t flogNextSeq = 0;
+uint32_t flogReplaySeq = 0;              // Everything before this is on SD or gone (rtcState)
+SemaphoreHandle_t flogMutex = NULL;
+uint32_t flogWritten = 0;
+uint32_t flogReplayed = 0;
+uint32_t flogLost = 0;                   // Overwritten before a card came back
+uint32_t flogErases = 0;
+int64_t flogLastUs = 0;
+int64_t flogMaxUs = 0;
+volatile bool flogBenchPending = false;  // FLOG:BENCH from BLE, run in loop()
+
+// Acoustic trigger
+SemaphoreHandle_t micMutex = NULL;
+volatile bool acousticListening = false;
+volatile bool acousticTriggered = false;
+volatile bool acousticPending = false;     // Hit not yet matched to an IR break
+volatile unsigned long acousticLastHitMs = 0;
+float acousticCoef[5];
+float acousticState[2] = { 0, 0 };
+float acousticFloorDb = 0;
+float acousticLevelDb = 0;
+uint32_t acousticHits = 0;
+uint32_t agreeBoth = 0, agreeIrOnly = 0, acousticOnly = 0;
+uint64_t acousticListenUs = 0;             // Mic on for the listener
+uint64_t acousticCpuUs = 0;                // Listener processing time
+
+// Wingbeat analysis (written by audioRecordTask)
+float* wbFft = NULL;                 // Interleaved complex FFT buffer
+float* wbWindow = NULL;
+float* wbInput = NULL;               // Decimated samples for the next window
+float* wbPower = NULL;               // Summed power spectrum of the clip
+int wbFill = 0;
+int wbWindows = 0;
+int32_t wbDecimSum = 0;
+int wbDecimCount = 0;
+bool wbRunning = false;
+File wbSummary;
+int64_t wbUs = 0;                    // CPU time spent on analysis this clip
+volatile float wbHz = -1;
+float wbSnrDb = 0, wbHarm2Db = 0, wbHarm3Db = 0;
+
+// Motion detector
+struct MotionDecode { const uint8_t* jpg; uint8_t* gray; int width; int height; };
+uint8_t* motionPrev = NULL;
+uint8_t* motionCur = NULL;
+int motionPixels = 0;
+bool motionHavePrev = false;
+uint16_t motionPeak = 0;             // Peak score of the current clip
+uint16_t motionBlobPermille = 0;     // Changed-pixel bounding box at the peak
+uint32_t motionFrames = 0;
+uint64_t motionDecodeUs = 0;
+uint64_t motionKernelUs = 0;
+uint32_t motionTrimmed = 0;          // Frames trimmed off clip tails
+uint16_t motionLastRaw = 1000;       // Last frame's changed pixels per 1000, before the exposure filter
+uint32_t periodElidedFrames = 0;     // Still frames stored as drop-frame chunks this period
+uint64_t periodElidedBytes = 0;      // JPEG bytes that saved
+uint32_t motionUnconfirmed = 0;
+volatile bool motionBenchPending = false;  // MOTION:BENCH from BLE, run in loop()
+
+// Moth classifier
+float classifierScore = -1;           // Mean moth score of the current clip (-1 = not scored)
+uint32_t classifierLastUs = 0;        // Inference time per frame, last clip
+uint32_t classifierKept = 0;
+uint32_t classifierDiscarded = 0;
+
+// Runtime configuration - hot paths read these fields directly
+struct RuntimeConfig {
+    uint16_t version;
+    uint16_t size;
+    uint32_t recordingMs;
+    uint32_t videoFps;
+    uint32_t envLogIntervalMs;
+    uint32_t irDebounceMs;
+    uint32_t chunkSize;
+    uint32_t chunkDelayMs;
+    uint32_t activeStartHour;
+    uint32_t activeEndHour;
+    uint32_t jpegQuality;
+};
+
+const RuntimeConfig CONFIG_DEFAULTS = {
+    RUNTIME_CONFIG_VERSION, sizeof(RuntimeConfig),
+    RECORDING_DURATION, VIDEO_FPS, ENV_LOG_INTERVAL_MS, IR_DEBOUNCE_MS,
+    CHUNK_SIZE, CHUNK_DELAY_MS, ACTIVE_START_HOUR, ACTIVE_END_HOUR, JPEG_QUALITY
+};
+RuntimeConfig cfg = CONFIG_DEFAULTS;
+
+struct ConfigField { const char* key; uint32_t* value; uint32_t minVal; uint32_t maxVal; };
+const ConfigField CONFIG_FIELDS[] = {
+    { "rec_ms",      &cfg.recordingMs,      1000,  60000 },
+    { "fps",         &cfg.videoFps,         1,     30 },
+    { "env_ms",      &cfg.envLogIntervalMs, 10000, 86400000 },
+    { "ir_debounce", &cfg.irDebounceMs,     10,    5000 },
+    { "chunk",       &cfg.chunkSize,        16,    CHUNK_SIZE_MAX },
+    { "chunk_delay", &cfg.chunkDelayMs,     0,     1000 },
+    { "start_hour",  &cfg.activeStartHour,  0,     23 },
+    { "end_hour",    &cfg.activeEndHour,    0,     23 },
+    { "jpeg_q",      &cfg.jpegQuality,      4,     63 },
+};
+const int CONFIG_FIELD_COUNT = sizeof(CONFIG_FIELDS) / sizeof(CONFIG_FIELDS[0]);
+
+// Camera power policy
+enum CamPowerPolicy { CAM_POWER_STREAM, CAM_POWER_STANDBY, CAM_POWER_OFF };
+CamPowerPolicy camPowerPolicy = CAM_POWER_DEFAULT;
+bool cameraStandby = false;           // Sensor is in SCCB standby
+volatile int camPowerRequest = -1;    // CAMPWR: from BLE, applied in loop() (-1 = none)
+uint32_t camLastWakeMs = 0;           // Last wake-to-first-valid-frame latency
+uint32_t camWakeTotalMs = 0;
+uint32_t camWakeCount = 0;
+
+float lastEventMah = 0;               // Energy used by the last recordEvent()
+float periodEventMah = 0;             // Energy used by all events this period
+uint32_t periodEvents = 0;
+
+// ============================================================================
+// RTC MEMORY STATE (survives deep sleep)
+// ============================================================================
+
+// Bump RTC_STATE_VERSION whenever PersistedState changes layout
+#define RTC_STATE_MAGIC     0x53545250   // "STRP"
+#define RTC_STATE_VERSION   10
+
+struct PersistedState {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    
+    // Counters
+    uint32_t detectionCount;
+    
+    // Schedule state
+    uint8_t  isActiveHours;
+    uint32_t lastEnvLogEpoch;
+    
+    // Last environmental sample
+    float    airTemp;
+    float    humidity;
+    float    soilTemp;
+    int32_t  soilMoisture;
+    char     timestamp[20];
+    
+    // Cached hardware detection
+    uint8_t  lcdAddress;
+    uint8_t  lcdOK;
+    uint8_t  dhtOK;
+    uint8_t  ds18b20OK;
+    uint8_t  bleEnabled;
+    
+    // Storage usage
+    uint64_t sdTotalBytes;
+    uint64_t sdUsedBytes;
+    
+    // Energy accounting
+    uint64_t energyUs[E_STATE_COUNT];
+    uint32_t energyPeriodStart;
+    uint32_t sleepStartEpoch;      // RTC unixtime deep sleep began
+    float    periodEventMah;
+    uint32_t periodEvents;
+    uint8_t  cpuPolicy;
+    uint8_t  camPowerPolicy;
+    uint8_t  powerMode;            // Battery mode - keeps its hysteresis across sleep
+    float    stormTokens;          // Bucket level - a sleep doesn't hand out a fresh burst
+    float    maintMahToday;
+    
+    // Nightly summary
+    NightStats night;
+    NightStats lastNight;
+    
+    uint32_t flogReplaySeq;        // Flash log replay position
+    
+    uint32_t crc;                  // CRC32 of everything above
+};
+
+RTC_DATA_ATTR PersistedState rtcState;
+bool stateRestored = false;        // rtcState was valid at boot
 
 // USB Mass Storage
 USBMSC msc;
@@ -213,6 +938,8 @@ void lcdPrint(String line1, String line2 = "");
 // USB MASS STORAGE CALLBACKS
 // ============================================================================
 
+// In USB drive mode the host owns the card and the sketch does no file I/O,
+// so these go straight to SD_MMC rather than through sdRun()
 static int32_t onMscRead(uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
     // Read from SD card
     uint32_t sectorSize = SD_MMC.sectorSize();
@@ -352,7 +1079,8 @@ void checkAndEnterUSBMode() {
         bleEnabled = false;
     }
     
-    // Start USB MSC
+    // Start USB MSC - stays at full clock until unplugged
+    cpuBoost();
     if (startUSBMassStorage()) {
         Serial.println("[USB MSC] Ready - SD card mounted as USB drive");
         
@@ -475,6 +1203,30 @@ struct WAV_HEADER {
     uint32_t dataSize;
 };
 
+// IMA-ADPCM variant: extended fmt chunk plus the fact chunk non-PCM needs
+#pragma pack(push, 1)
+struct WAV_HEADER_ADPCM {
+    char riff[4] = {'R','I','F','F'};
+    uint32_t chunkSize;
+    char wave[4] = {'W','A','V','E'};
+    char fmt[4] = {'f','m','t',' '};
+    uint32_t subchunk1Size = 20;
+    uint16_t audioFormat = 0x11;  // IMA ADPCM
+    uint16_t numChannels = 1;
+    uint32_t sampleRate;
+    uint32_t byteRate;
+    uint16_t blockAlign = ADPCM_BLOCK_ALIGN;
+    uint16_t bitsPerSample = 4;
+    uint16_t extraSize = 2;
+    uint16_t samplesPerBlock = ADPCM_SAMPLES_PER_BLOCK;
+    char fact[4] = {'f','a','c','t'};
+    uint32_t factSize = 4;
+    uint32_t factSamples;
+    char data[4] = {'d','a','t','a'};
+    uint32_t dataSize;
+};
+#pragma pack(pop)
+
 // ============================================================================
 // FORWARD DECLARATIONS
 // ============================================================================
@@ -486,14 +1238,27 @@ void initSDCard();
 void restoreDetectionCount();
 void setupBLE();
 void readSensors();
-void recordEvent();
-void logDetection(String videoPath, String audioPath);
+void recordEvent(bool fromAudio = false);
+void logDetection(String videoPath, String audioPath, const EventFeatures& f, const SensorData& at);
 void processTransfer();
+size_t transferChunkBytes();
 void sendBLE(String msg);
 void updateLCD();
 String getTimestamp();
 String getDatePath();
 void createDirectory(String path);
+void sdRun(SdClass cls, std::function<void()> fn);
+bool sdExists(SdClass cls, String path);
+bool sdRemove(SdClass cls, String path);
+void nightAddDetection(const String& timestamp);
+void attachBeamEdges();
+unsigned long beamClearFor(unsigned long breakMs);
+void flogDetection(const EventFeatures& f, const SensorData& at);
+void flogEnvironment(const SensorData& s);
+void sdLost();
+void restorePowerMode();
+bool maintReplayStep();
+void updateAdvertising();
 
 // ============================================================================
 // BLE CALLBACKS
@@ -502,6 +1267,7 @@ void createDirectory(String path);
 class ServerCallbacks : public BLEServerCallbacks {
     void onConnect(BLEServer* pServer) {
         deviceConnected = true;
+        lastActivityMs = millis();
         isAuthenticated = false;  // Reset auth on new connection
         Serial.println("[BLE] Connected - awaiting authentication");
         lcdPrint("BLE Connected", "Not authenticated");
@@ -513,7 +1279,7 @@ class ServerCallbacks : public BLEServerCallbacks {
         Serial.println("[BLE] Disconnected");
         
         if (transfer.state != IDLE) {
-            if (transfer.file) transfer.file.close();
+            if (transfer.file) sdRun(SD_CLASS_BULK, [&]() { transfer.file.close(); });
             transfer.state = IDLE;
         }
         
@@ -532,7 +1298,7 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         // Cancel transfer (always allowed)
         if (cmd == "CANCEL") {
             if (transfer.state != IDLE) {
-                if (transfer.file) transfer.file.close();
+                if (transfer.file) sdRun(SD_CLASS_BULK, [&]() { transfer.file.close(); });
                 transfer.state = IDLE;
                 sendBLE("CANCELLED");
             }
@@ -551,14 +1317,21 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         if (cmd == "SENSORS") { cmdSensors(); return; }
         if (cmd == "DIAG") { cmdDiagnostics(); return; }
         if (cmd == "DETECTIONS") { sendBLE("DETECTIONS:" + String(detectionCount)); return; }
+        if (cmd == "LASTEVENT") { cmdLastEvent(); return; }
+        if (cmd == "NIGHT") {
+            if (night.night != 0) sendBLE("NIGHT:" + nightString(night));
+            sendBLE("LASTNIGHT:" + (lastNight.night != 0 ?
+                nightString(lastNight) + ",mah=" + String(lastNight.energyMah, 2) : String("none")));
+            return;
+        }
         if (cmd == "RECORD") { irTriggered = true; return; }
         if (cmd == "AUTHSTATUS") { 
             sendBLE(isAuthenticated ? "AUTH:YES" : "AUTH:NO"); 
             return; 
         }
         if (cmd == "HELP") { 
-            sendBLE("PUBLIC:STATUS,SENSORS,DIAG,DETECTIONS,RECORD,AUTH:pwd,AUTHSTATUS");
-            sendBLE("PROTECTED:LIST,CD,GET,DELETE,RESET,LOGOUT"); 
+            sendBLE("PUBLIC:STATUS,SENSORS,DIAG,DETECTIONS,LASTEVENT,NIGHT,RECORD,AUTH:pwd,AUTHSTATUS");
+            sendBLE("PROTECTED:LIST,CD,GET,DELETE,RESET,RESET:FORMAT|STATUS,LOGOUT,CPU:FIXED|DYNAMIC,CAMPWR:STREAM|STANDBY|OFF,BATSIM:mv,CFG:LIST|GET|SET|SAVE|DEFAULTS,MOTION:BENCH,AUDIO:BENCH,FLOG:BENCH"); 
             return; 
         }
         
@@ -601,6 +1374,31 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         
         // Reset command - clears all data
         if (cmd == "RESET") { cmdReset(); return; }
+        if (cmd == "RESET:FORMAT") { cmdFormat(); return; }
+        if (cmd == "RESET:STATUS") { sendBLE("TRASH:" + trashString()); return; }
+        
+        // CPU frequency policy
+        if (cmd == "CPU:FIXED") { setCpuPolicy(CPU_POLICY_FIXED); sendBLE("CPU:OK,policy=fixed"); return; }
+        if (cmd == "CPU:DYNAMIC") { setCpuPolicy(CPU_POLICY_DYNAMIC); sendBLE("CPU:OK,policy=dynamic"); return; }
+        
+        // Camera power policy between detections
+        if (cmd.startsWith("CAMPWR:")) { cmdCamPower(cmd.substring(7)); return; }
+        
+        // Scalar vs SWAR motion kernel check and timing
+        if (cmd == "MOTION:BENCH") { motionBenchPending = true; return; }  // serviceMotionBench() replies
+        if (cmd == "AUDIO:BENCH") { adpcmBenchPending = true; return; }  // serviceAdpcmBench() replies
+        if (cmd == "FLOG:BENCH") { flogBenchPending = true; return; }  // serviceFlogBench() replies
+        
+        // Runtime configuration
+        if (cmd.startsWith("CFG:")) { sendBLE(cmdConfig(cmd.substring(4))); return; }
+        
+        // Simulated battery voltage for bench tests (BATSIM:0 = back to ADC)
+        // Only stored here - checkBattery() applies it from loop() and replies
+        if (cmd.startsWith("BATSIM:")) {
+            batterySimMv = cmd.substring(7).toInt();
+            batterySimPending = true;
+            return;
+        }
         
         sendBLE("UNKNOWN:" + cmd);
     }
@@ -622,7 +1420,7 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         }
         
         // Schedule info
-        s += ",sched=" + String(ACTIVE_START_HOUR) + ":00-" + String(ACTIVE_END_HOUR) + ":00";
+        s += ",sched=" + scheduleString() + String(ENABLE_SOLAR_SCHEDULE ? "(sun)" : "");
         s += ",active=" + String(isActiveHours ? "YES" : "NO");
         
         // Uptime
@@ -634,13 +1432,33 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         sendBLE(s);
     }
     
+    // Metadata of the most recent detection - triage without downloading media
+    void cmdLastEvent() {
+        xSemaphoreTake(logMutex, portMAX_DELAY);
+        EventFeatures f = lastEvent;
+        xSemaphoreGive(logMutex);
+        if (f.detection == 0) { sendBLE("EVENT:none"); return; }
+        
+        String s = "EVENT:num=" + String(f.detection) + ",trigger=" + f.trigger;
+        if (f.frames >= 0) {
+            s += ",frames=" + String(f.frames) + ",fps=" + String(f.fps, 1);
+            s += ",jpgMean=" + String(f.jpegMean, 0) + ",jpgStd=" + String(f.jpegStd, 0);
+        }
+        if (f.hasAudio) s += ",rmsDbfs=" + String(f.rmsDbfs, 1) + ",peakDbfs=" + String(f.peakDbfs, 1);
+        if (f.beamMs >= 0) s += ",beamMs=" + String(f.beamMs);
+        if (f.motionPeak >= 0) s += ",motion=" + String(f.motionPeak);
+        if (f.wingbeatHz >= 0) s += ",wingHz=" + String(f.wingbeatHz, 1) + ",wingSnrDb=" + String(f.wingbeatSnrDb, 1);
+        if (f.classScore >= 0) s += ",class=" + f.label + ",score=" + String(f.classScore, 2);
+        sendBLE(s);
+    }
+    
     void cmdDiagnostics() {
         // Component status
         String s = "DIAG:lcd=" + String(lcdOK ? "OK" : "FAIL");
         s += ",rtc=" + String(rtcOK ? "OK" : "FAIL");
         s += ",dht=" + String(dhtOK ? "OK" : "FAIL");
         s += ",ds18=" + String(ds18b20OK ? "OK" : "FAIL");
-        s += ",cam=" + String(cameraOK ? "OK" : "FAIL");
+        s += ",cam=" + String(cameraOK ? "OK" : (cameraInitPending ? "IDLE" : "FAIL"));
         s += ",mic=" + String(micOK ? "OK" : "FAIL");
         s += ",sd=" + String(sdOK ? "OK" : "FAIL");
         s += ",ble=OK";  // If we're receiving this, BLE works
@@ -654,9 +1472,9 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         sendBLE(mem);
         
         // SD card info
-        if (sdOK) {
-            uint64_t totalBytes = SD_MMC.totalBytes();
-            uint64_t usedBytes = SD_MMC.usedBytes();
+        if (sdOK && sdTotalBytes > 0) {
+            uint64_t totalBytes = sdTotalBytes;
+            uint64_t usedBytes = sdUsedBytes;
             uint64_t freeBytes = totalBytes - usedBytes;
             String sd = "SDINFO:total=" + String((uint32_t)(totalBytes / 1048576)) + "MB";
             sd += ",used=" + String((uint32_t)(usedBytes / 1048576)) + "MB";
@@ -665,8 +1483,119 @@ class RxCallbacks : public BLECharacteristicCallbacks {
             sendBLE(sd);
         }
         
-        // Battery placeholder (for future hardware)
-        sendBLE("BATTERY:pct=--,charging=--,voltage=--");
+        // Energy use this period
+        sendBLE("ENERGY:" + energyString());
+        String cpu = "CPU:policy=" + String(cpuPolicyName());
+        cpu += ",mhz=" + String(getCpuFrequencyMhz());
+        cpu += ",lastEventMAh=" + String(lastEventMah, 3);
+        cpu += ",avgEventMAh=" + String(periodEvents ? periodEventMah / periodEvents : 0, 3);
+        cpu += ",events=" + String(periodEvents);
+        sendBLE(cpu);
+        
+        String fin = "FINALIZE:pending=" + String(finalizeQueued - finalizeDone);
+        fin += ",lastMs=" + String(finalizeLastMs) + ",maxMs=" + String(finalizeMaxMs);
+        sendBLE(fin);
+        
+        if (sdOK) sendBLE("SDIO:" + sdioString());
+        sendBLE("TRASH:" + trashString());
+        sendBLE("MAINT:" + maintString());
+        sendBLE("FLOG:" + flogString());
+        sendBLE("NIGHT:open=" + String(night.night != 0 ? "yes" : "no") + ",det=" + String(night.detections) +
+            ",recFail=" + String(night.recFailures) + ",dropped=" + String(night.droppedFrames));
+        
+        String cam = "CAMPWR:policy=" + String(camPowerPolicyName());
+        cam += ",state=" + String(!cameraOK ? "off" : (cameraStandby ? "standby" : "streaming"));
+        cam += ",lastWakeMs=" + String(camLastWakeMs);
+        cam += ",avgWakeMs=" + String(camWakeCount ? camWakeTotalMs / camWakeCount : 0);
+        cam += ",wakes=" + String(camWakeCount);
+        cam += ",stbyMA=" + String(CURRENT_CAMERA_STBY_MA, 1);
+        sendBLE(cam);
+        
+        if (ENABLE_ACOUSTIC_TRIGGER) {
+            String ac = "ACOUSTIC:mode=" + String(ACOUSTIC_MODE == ACOUSTIC_MODE_TRIGGER ? "trigger" : "corroborate");
+            ac += ",listening=" + String(acousticListening ? "YES" : "NO");
+            ac += ",levelDb=" + String(acousticLevelDb, 1) + ",floorDb=" + String(acousticFloorDb, 1);
+            ac += ",hits=" + String(acousticHits);
+            ac += ",both=" + String(agreeBoth) + ",irOnly=" + String(agreeIrOnly) + ",audioOnly=" + String(acousticOnly);
+            ac += ",cpu=" + String(acousticListenUs ? 100.0 * acousticCpuUs / acousticListenUs : 0, 2) + "%";
+            ac += ",overheadMAh=" + String(acousticOverheadMah(), 3);
+            sendBLE(ac);
+        }
+        
+        if (ENABLE_WINGBEAT_ANALYSIS) {
+            String wb = "WINGBEAT:lastHz=" + String(wbHz, 1);
+            wb += ",snrDb=" + String(wbSnrDb, 1);
+            wb += ",h2Db=" + String(wbHarm2Db, 1);
+            wb += ",h3Db=" + String(wbHarm3Db, 1);
+            wb += ",cpuMs=" + String((uint32_t)(wbUs / 1000));
+            sendBLE(wb);
+        }
+        
+        if (ENABLE_MOTION_DETECTOR) {
+            String mot = "MOTION:lastPeak=" + String(motionPeak);
+            mot += ",blob=" + String(motionBlobPermille);
+            mot += ",decodeUs=" + String(motionFrames ? (uint32_t)(motionDecodeUs / motionFrames) : 0);
+            mot += ",kernelUs=" + String(motionFrames ? (uint32_t)(motionKernelUs / motionFrames) : 0);
+            mot += ",trimmed=" + String(motionTrimmed);
+            mot += ",unconfirmed=" + String(motionUnconfirmed);
+            mot += ",elided=" + String(periodElidedFrames);
+            mot += ",elidedKB=" + String((uint32_t)(periodElidedBytes / 1024));
+            sendBLE(mot);
+        }
+        
+        if (ENABLE_MOTH_CLASSIFIER) {
+            String cls = "CLASSIFIER:lastScore=" + String(classifierScore, 2);
+            cls += ",ms=" + String(classifierLastUs / 1000);
+            cls += ",kept=" + String(classifierKept);
+            cls += ",discarded=" + String(classifierDiscarded);
+            cls += ",keepAt=" + String(CLASSIFIER_KEEP_SCORE, 2);
+            sendBLE(cls);
+        }
+        
+        // Boot profile
+        sendBLE("BOOT:" + bootProfileString());
+        
+        if (ENABLE_ULP_BEAM_MONITOR) {
+            sendBLE("ULP:lastBatch=" + String(ulpLastBatch) + ",threshold=" + String(ULP_WAKE_THRESHOLD) +
+                ",period=" + String(ULP_SAMPLE_PERIOD_US) + "us");
+        }
+        
+        // Wake statistics (energy spent on wakes that went straight back to sleep)
+        String wk = "WAKES:today=" + String(wakesToday);
+        wk += ",spurious=" + String(spuriousWakesToday);
+        wk += ",awake=" + String(spuriousAwakeMsToday / 1000) + "s";
+        wk += ",mAh=" + String(wakeEnergyMah(spuriousAwakeMsToday), 2);
+        wk += ",prevSpurious=" + String(spuriousWakesYesterday);
+        wk += ",prevMAh=" + String(wakeEnergyMah(spuriousAwakeMsYesterday), 2);
+        wk += ",alarm=" + String(ENABLE_RTC_ALARM_WAKE ? "ON" : "OFF");
+        sendBLE(wk);
+        
+        // Battery and degradation mode
+        String bat = "BATTERY:pct=" + String(batteryMv ? String(batteryPercent(batteryMv)) : "--");
+        bat += ",charging=--";
+        bat += ",voltage=" + String(batteryMv ? String(batteryMv / 1000.0, 2) + "V" : "--");
+        bat += ",mode=" + String(powerModeName(powerMode));
+        bat += ",src=" + String(batterySimMv ? "sim" : (BATTERY_ADC_PIN >= 0 ? "adc" : "none"));
+        sendBLE(bat);
+        
+        if (ENABLE_STORM_PROTECTION) {
+            stormRefill();
+            String st = "STORM:tokens=" + String(stormTokens, 1) + "/" + String(STORM_BURST);
+            st += ",refillS=" + String(STORM_REFILL_MS / 1000);
+            st += ",limited=" + String(stormLimited ? "YES" : "NO");
+            st += ",beam=" + String(beamHealthName(beamHealth));
+            st += ",breaksPerMin=" + String(beamBreaksPerMin);
+            st += ",suppressed=" + String(stormSuppressed);
+            sendBLE(st);
+        }
+    }
+    
+    // The camera is driven from loop() - init/deinit here would race a recording
+    void cmdCamPower(String mode) {
+        if (mode == "STREAM") camPowerRequest = CAM_POWER_STREAM;
+        else if (mode == "STANDBY") camPowerRequest = CAM_POWER_STANDBY;
+        else if (mode == "OFF") camPowerRequest = CAM_POWER_OFF;
+        else sendBLE("ERROR:Use CAMPWR:STREAM|STANDBY|OFF");
     }
     
     void cmdSensors() {
@@ -688,25 +1617,32 @@ class RxCallbacks : public BLECharacteristicCallbacks {
     void cmdListDir(String path) {
         if (!sdOK) { sendBLE("ERROR:SD not available"); return; }
         
-        File dir = SD_MMC.open(path);
-        if (!dir || !dir.isDirectory()) { sendBLE("ERROR:Invalid path"); return; }
+        File dir;
+        bool isDir = false;
+        sdRun(SD_CLASS_BULK, [&]() { dir = SD_MMC.open(path); isDir = dir && dir.isDirectory(); });
+        if (!isDir) { sendBLE("ERROR:Invalid path"); return; }
         
         sendBLE("PATH:" + path);
         
-        File entry;
+        // One request per entry - the notify pacing happens off the SD task
         int count = 0;
-        while ((entry = dir.openNextFile()) && count < 50) {
-            String name = entry.name();
-            int lastSlash = name.lastIndexOf('/');
-            if (lastSlash >= 0) name = name.substring(lastSlash + 1);
-            
-            if (entry.isDirectory()) sendBLE("DIR:" + name);
-            else sendBLE("FILE:" + name + ":" + String(entry.size()));
-            entry.close();
+        while (count < 50) {
+            String line;
+            sdRun(SD_CLASS_BULK, [&]() {
+                File entry = dir.openNextFile();
+                if (!entry) return;
+                String name = entry.name();
+                int lastSlash = name.lastIndexOf('/');
+                if (lastSlash >= 0) name = name.substring(lastSlash + 1);
+                line = entry.isDirectory() ? "DIR:" + name : "FILE:" + name + ":" + String(entry.size());
+                entry.close();
+            });
+            if (line.length() == 0) break;
+            sendBLE(line);
             count++;
             delay(20);
         }
-        dir.close();
+        sdRun(SD_CLASS_BULK, [&]() { dir.close(); });
         sendBLE("LIST_END");
     }
     
@@ -728,7 +1664,8 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         String fullPath = filename.startsWith("/") ? filename : 
             (currentPath.endsWith("/") ? currentPath : currentPath + "/") + filename;
         
-        File file = SD_MMC.open(fullPath, FILE_READ);
+        File file;
+        sdRun(SD_CLASS_BULK, [&]() { file = SD_MMC.open(fullPath, FILE_READ); });
         if (!file) { sendBLE("ERROR:File not found"); return; }
         
         transfer.file = file;
@@ -747,101 +1684,39 @@ class RxCallbacks : public BLECharacteristicCallbacks {
         String fullPath = filename.startsWith("/") ? filename :
             (currentPath.endsWith("/") ? currentPath : currentPath + "/") + filename;
         
-        if (SD_MMC.remove(fullPath)) sendBLE("DELETED:" + fullPath);
+        size_t size = 0;
+        bool removed = false;
+        sdRun(SD_CLASS_BULK, [&]() {
+            File f = SD_MMC.open(fullPath, FILE_READ);
+            if (f) { size = f.size(); f.close(); }
+            removed = SD_MMC.remove(fullPath);
+        });
+        
+        if (removed) {
+            sdUsedBytes = (sdUsedBytes > size) ? sdUsedBytes - size : 0;
+            sendBLE("DELETED:" + fullPath);
+        }
         else sendBLE("ERROR:Delete failed");
     }
     
+    // Replies now - the maintenance task moves the data once pending clips
+    // have landed, and sends RESET:OK when it has
     void cmdReset() {
-        Serial.println("[RESET] ════════════════════════════════════════");
-        Serial.println("[RESET] Starting full data reset...");
+        Serial.println("[RESET] Reset requested");
         lcdPrint("RESETTING...", "Clearing data");
-        
-        int filesDeleted = 0;
-        
-        // Delete all files in /events recursively
-        if (SD_MMC.exists("/events")) {
-            Serial.println("[RESET] Clearing /events folder...");
-            filesDeleted += deleteRecursive("/events");
-            SD_MMC.rmdir("/events");  // Remove the events folder itself
-        } else {
-            Serial.println("[RESET] /events folder not found");
-        }
-        
-        // Delete all files in /logs
-        if (SD_MMC.exists("/logs")) {
-            Serial.println("[RESET] Clearing /logs folder...");
-            filesDeleted += deleteRecursive("/logs");
-            SD_MMC.rmdir("/logs");  // Remove the logs folder itself
-        } else {
-            Serial.println("[RESET] /logs folder not found");
-        }
-        
-        // Recreate directories
-        createDirectory("/events");
-        createDirectory("/logs");
-        Serial.println("[RESET] Recreated /events and /logs folders");
-        
-        // Reset detection counter
-        detectionCount = 0;
-        
-        Serial.printf("[RESET] Complete! Deleted %d files\n", filesDeleted);
-        Serial.println("[RESET] Detection counter reset to 0");
-        Serial.println("[RESET] ════════════════════════════════════════");
-        
-        lcdPrint("Reset Complete", String(filesDeleted) + " files deleted");
-        
-        sendBLE("RESET:OK,deleted=" + String(filesDeleted));
-        
-        delay(2000);
+        trashMovePending = true;
+        maintQueue(MAINT_TRASH);
+        sendBLE("RESET:MOVING");
     }
     
-    int deleteRecursive(String path) {
-        int count = 0;
-        File dir = SD_MMC.open(path);
-        if (!dir || !dir.isDirectory()) {
-            Serial.printf("[RESET] Cannot open directory: %s\n", path.c_str());
-            return 0;
-        }
-        
-        Serial.printf("[RESET] Scanning: %s\n", path.c_str());
-        
-        File entry;
-        while ((entry = dir.openNextFile())) {
-            String entryName = entry.name();
-            
-            // Construct full path - entry.name() may or may not include parent path
-            String fullPath;
-            if (entryName.startsWith("/")) {
-                fullPath = entryName;  // Already full path
-            } else {
-                // Build full path from parent + name
-                fullPath = path;
-                if (!fullPath.endsWith("/")) fullPath += "/";
-                fullPath += entryName;
-            }
-            
-            bool isDir = entry.isDirectory();
-            entry.close();  // Close before delete/recurse
-            
-            if (isDir) {
-                // Recurse into subdirectory first
-                count += deleteRecursive(fullPath);
-                // Then remove the empty directory
-                if (SD_MMC.rmdir(fullPath)) {
-                    Serial.printf("[RESET] Removed dir: %s\n", fullPath.c_str());
-                }
-            } else {
-                // Delete file
-                if (SD_MMC.remove(fullPath)) {
-                    count++;
-                    Serial.printf("[RESET] Deleted: %s\n", fullPath.c_str());
-                } else {
-                    Serial.printf("[RESET] Failed to delete: %s\n", fullPath.c_str());
-                }
-            }
-        }
-        dir.close();
-        return count;
+    // Whole-card wipe - replies now, the maintenance task formats once
+    // nothing is writing
+    void cmdFormat() {
+        Serial.println("[RESET] Format requested");
+        lcdPrint("FORMATTING...", "Clearing card");
+        trashFormatPending = true;
+        maintQueue(MAINT_TRASH);
+        sendBLE("RESET:FORMATTING");
     }
 };
 
@@ -851,7 +1726,37 @@ class RxCallbacks : public BLECharacteristicCallbacks {
 
 void setup() {
     Serial.begin(115200);
+    bootMark("serial");
+    
+    // Timer / GPIO wakes take the fast path - nobody is watching the serial port
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+    
+    // Counters, last sample and hardware cache from before deep sleep
+    restoreRtcState(cause);
+    bootMark("rtc_state");
+    
+    // Tuning knobs saved with CFG:SAVE
+    loadConfig();
+    
+    // Clips are finished off in the background
+    startFinalizer();
+    initFlashLog();
+    
+    // Take the IR pins back from the ULP before anything drives them
+    stopUlpBeamMonitor();
+    
+    applyCpuPolicy();
+    fastWake = FAST_WAKE_ENABLED &&
+        (cause == ESP_SLEEP_WAKEUP_TIMER || cause == ESP_SLEEP_WAKEUP_EXT1 ||
+         cause == ESP_SLEEP_WAKEUP_ULP);
+    
+    if (fastWake) {
+        if (setupFastWake()) return;
+        fastWake = false;  // Button wake - continue with the full boot
+    }
+    
     delay(2000);
+    bootMark("serial_wait");
     
     Serial.println();
     Serial.println("╔══════════════════════════════════════════╗");
@@ -874,18 +1779,26 @@ void setup() {
     // This gives 10 seconds for Arduino IDE to connect for programming
     // If no serial activity, SD card becomes a USB drive for easy data offload
     checkAndEnterUSBMode();
+    bootMark("usb_window");
+    
+    // Not before the USB window - the host owns the card in USB drive mode
+    startMaintenance();
     
     pinMode(IR_LED_PIN, OUTPUT);
     pinMode(IR_RECEIVER_PIN, INPUT_PULLUP);
+    attachBeamEdges();
     
     // Only turn on IR LED if within active hours
     if (isWithinActiveHours()) {
-        digitalWrite(IR_LED_PIN, HIGH);
+        setIRLed(true);
         isActiveHours = true;
+        bootSawActiveHours = true;
     } else {
-        digitalWrite(IR_LED_PIN, LOW);
+        setIRLed(false);
         isActiveHours = false;
     }
+    bootArmedMs = millis();
+    bootMark("ir_armed");
     
     Serial.println();
     Serial.println("┌──────────────────────────────────────────┐");
@@ -902,7 +1815,7 @@ void setup() {
     Serial.println("│           POWER SETTINGS                 │");
     Serial.println("├──────────────────────────────────────────┤");
     if (ENABLE_SCHEDULED_SLEEP) {
-        Serial.printf("│  Schedule:    %02d:00 - %02d:00             │\n", ACTIVE_START_HOUR, ACTIVE_END_HOUR);
+        Serial.printf("│  Schedule:    %-27s│\n", scheduleString().c_str());
         Serial.printf("│  Status:      %s                     │\n", isActiveHours ? "ACTIVE" : "SLEEPING");
     } else {
         Serial.println("│  Schedule:    DISABLED (Always On)       │");
@@ -916,106 +1829,432 @@ void setup() {
     }
     
     readSensors();
+    mergeUlpDetections();
     
     if (isActiveHours) {
         lcdPrint("SmartTrap v1.0", "Monitoring...");
         Serial.println(">>> System ready. Monitoring for moths... <<<");
     } else {
-        String wakeTime = String(ACTIVE_START_HOUR) + ":00";
-        lcdPrint("Inactive Mode", "Wake @ " + wakeTime);
+        lcdPrint("Inactive Mode", "Wake @ " + nextWakeString());
         Serial.println(">>> Outside active hours. Will sleep soon... <<<");
     }
     Serial.println();
     
     delay(2000);
+    restorePowerMode();
+    bootMark("ready");
+    printBootProfile();
 }
 
-void initComponents() {
+// Minimal boot after a timer / GPIO wake: RTC, IR beam, SD and mic only.
+// DHT, camera and BLE are finished later from loop() by serviceDeferredInit().
+// Returns false for a button wake so setup() can run the full (USB-capable) boot.
+bool setupFastWake() {
+    wakeUp();
+    transfer.state = IDLE;
+    
     Wire.begin(I2C_SDA, I2C_SCL);
+    initRTC();
+    bootMark("rtc");
     
-    // LCD
-    Serial.print("[LCD] Initializing... ");
-    for (byte addr = 0x27; addr <= 0x3F; addr += 0x18) {
-        Wire.beginTransmission(addr);
-        if (Wire.endTransmission() == 0) {
-            lcdAddress = addr;
-            lcd = LiquidCrystal_I2C(addr, 16, 2);
-            lcd.init();
-            lcd.backlight();
-            lcdOK = true;
-            Serial.printf("OK (0x%02X)\n", addr);
-            break;
-        }
+    // EXT1 is shared by the button and the RTC alarm
+    if (wakeupCause == ESP_SLEEP_WAKEUP_EXT1 && rtcOK && !wokeByRtcAlarm) {
+        Serial.println("[BOOT] Button wake - full boot");
+        return false;
     }
-    if (!lcdOK) Serial.println("FAIL");
     
-    lcdPrint("SmartTrap v1.0", "Starting...");
+    pinMode(BUTTON_PIN, INPUT_PULLUP);
+    pinMode(IR_LED_PIN, OUTPUT);
+    pinMode(IR_RECEIVER_PIN, INPUT_PULLUP);
+    attachBeamEdges();
+    isActiveHours = isWithinActiveHours();
+    setIRLed(isActiveHours);
+    if (isActiveHours) bootSawActiveHours = true;
+    bootMark("ir_pins");
     
-    // RTC
-    Serial.print("[RTC] Initializing... ");
-    if (rtc.begin()) {
-        if (rtc.lostPower()) rtc.adjust(DateTime(F(__DATE__), F(__TIME__)));
-        rtcOK = true;
-        Serial.println("OK");
-    } else Serial.println("FAIL");
+    initSDCard();
+    restoreDetectionCount();
+    bootMark("sd");
+    
+    initMicrophone();
+    bootMark("mic");
+    
+    bootArmedMs = millis();
+    bootMark("ir_armed");
+    
+    // Non-critical peripherals - after the beam is being watched
+    initLCD();
+    bootMark("lcd");
     
-    // DHT11
-    Serial.print("[DHT11] Initializing... ");
     dht.begin();
-    delay(2000);
-    if (!isnan(dht.readTemperature())) { dhtOK = true; Serial.println("OK"); }
-    else Serial.println("FAIL");
+    if (stateRestored) dhtOK = rtcState.dhtOK;
+    else dhtProbeAt = millis() + DHT_SETTLE_MS;
+    initDS18B20();
+    bootMark("sensors");
     
-    // DS18B20
-    Serial.print("[DS18B20] Initializing... ");
-    ds18b20.begin();
-    ds18b20.setWaitForConversion(true);
-    if (ds18b20.getDeviceCount() > 0) { ds18b20OK = true; Serial.println("OK"); }
-    else Serial.println("FAIL");
+    cameraInitPending = true;
+    bleInitPending = !stateRestored || rtcState.bleEnabled;  // Stay off if user turned BLE off
+    bleEnabled = false;
     
-    initSDCard();
-    restoreDetectionCount();  // Restore count from CSV
-    initCamera();
-    initMicrophone();
-    setupBLE();
-}
-
-void initSDCard() {
-    Serial.print("[SD] Initializing... ");
-    SD_MMC.end();
-    delay(100);
-    SD_MMC.setPins(SD_MMC_CLK, SD_MMC_CMD, SD_MMC_D0);
-    if (SD_MMC.begin("/sdcard", true) && SD_MMC.cardType() != CARD_NONE) {
-        sdOK = true;
-        Serial.printf("OK (%llu MB)\n", SD_MMC.totalBytes() / (1024 * 1024));
-    } else Serial.println("FAIL");
+    if (sdOK) {
+        createDirectory("/events");
+        createDirectory("/logs");
+    }
+    readSensors();
+    mergeUlpDetections();
+    restorePowerMode();
+    bootMark("ready");
+    
+    printBootProfile();
+    if (bootArmedMs > FAST_WAKE_TARGET_MS) {
+        Serial.printf("[BOOT] WARNING: IR armed after %lums (target %dms)\n", bootArmedMs, FAST_WAKE_TARGET_MS);
+    }
+    startMaintenance();
+    return true;
 }
 
-void restoreDetectionCount() {
-    if (!sdOK) return;
-    
-    File file = SD_MMC.open("/logs/detections.csv", FILE_READ);
-    if (!file) {
-        Serial.println("[SD] No previous detections.csv - starting from 0");
-        detectionCount = 0;
+// Finish peripherals skipped by setupFastWake(), one step per call so the
+// IR beam keeps being polled between steps
+void serviceDeferredInit() {
+    if (isRecording) return;
+    
+    if (dhtProbeAt != 0 && millis() >= dhtProbeAt) {
+        dhtProbeAt = 0;
+        probeDHT();
         return;
     }
     
-    // Count lines (excluding header)
-    unsigned long lineCount = 0;
-    bool firstLine = true;
-    
-    while (file.available()) {
-        String line = file.readStringUntil('\n');
-        if (firstLine) {
-            firstLine = false;  // Skip header
-            continue;
-        }
-        if (line.length() > 0) {
-            lineCount++;
-        }
+    if (bleInitPending && millis() >= FAST_WAKE_BLE_DELAY_MS) {
+        bleInitPending = false;
+        setupBLE();
+        bleEnabled = true;
+        return;
+    }
+}
+
+// Bring the camera up on first use after a fast wake
+bool ensureCamera() {
+    if (cameraOK) return true;
+    if (!cameraInitPending) return false;
+    
+    cameraInitPending = false;
+    unsigned long start = millis();
+    initCamera();
+    Serial.printf("[CAM] Lazy init took %lums\n", millis() - start);
+    return cameraOK;
+}
+
+// ============================================================================
+// CAMERA POWER POLICY
+// ============================================================================
+
+const char* camPowerPolicyName() {
+    switch (camPowerPolicy) {
+        case CAM_POWER_STREAM: return "stream";
+        case CAM_POWER_STANDBY: return "standby";
+        default: return "off";
+    }
+}
+
+// OV2640 COM2 (sensor bank 0x09) bit 4 = standby. esp32-camera's set_reg
+// selects the sensor bank when bit 8 of the register number is set.
+void cameraSetStandby(bool standby) {
+    if (!cameraOK) return;
+    sensor_t* s = esp_camera_sensor_get();
+    if (!s || !s->set_reg) return;
+    s->set_reg(s, 0x109, 0x10, standby ? 0x10 : 0x00);
+    cameraStandby = standby;
+}
+
+// Put the camera into the policy's between-detections state
+void cameraIdle() {
+    if (!cameraOK) return;
+    
+    switch (camPowerPolicy) {
+        case CAM_POWER_STREAM:
+            break;
+        case CAM_POWER_STANDBY:
+            cameraSetStandby(true);
+            break;
+        case CAM_POWER_OFF:
+            esp_camera_deinit();
+            cameraOK = false;
+            cameraStandby = false;
+            cameraInitPending = true;  // ensureCamera() brings it back
+            break;
+    }
+}
+
+// Apply a CAMPWR: request between recordings
+void serviceCamPower() {
+    if (camPowerRequest < 0 || isRecording) return;
+    camPowerPolicy = (CamPowerPolicy)camPowerRequest;
+    camPowerRequest = -1;
+    
+    // Reset latency stats - they are per policy
+    camWakeTotalMs = 0;
+    camWakeCount = 0;
+    camLastWakeMs = 0;
+    
+    // Bring the camera to the new idle state now
+    if (!cameraOK && camPowerPolicy != CAM_POWER_OFF) ensureCamera();
+    if (cameraStandby) cameraSetStandby(false);
+    cameraIdle();
+    
+    Serial.printf("[CAM] Power policy: %s\n", camPowerPolicyName());
+    sendBLE("CAMPWR:OK,policy=" + String(camPowerPolicyName()));
+}
+
+// Bring the camera out of its idle state and wait for the first frame
+// captured after the wake. Records the latency for DIAG.
+bool cameraWake() {
+    if (powerMode >= POWER_AUDIO_ONLY) return false;  // Video shed on low battery
+    
+    unsigned long start = millis();
+    int64_t wakeUs = esp_timer_get_time();
+    
+    if (!cameraOK && !ensureCamera()) return false;
+    if (cameraStandby) cameraSetStandby(false);
+    
+    // Frame buffers may still hold frames from before standby - skip them
+    bool gotFrame = false;
+    while (millis() - start < CAM_WAKE_TIMEOUT_MS) {
+        camera_fb_t* fb = esp_camera_fb_get();
+        if (!fb) continue;
+        int64_t frameUs = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+        bool valid = fb->len > 2 && fb->buf[0] == 0xFF && fb->buf[1] == 0xD8 && frameUs >= wakeUs;
+        esp_camera_fb_return(fb);
+        if (valid) { gotFrame = true; break; }
+    }
+    
+    camLastWakeMs = millis() - start;
+    if (gotFrame) {
+        camWakeTotalMs += camLastWakeMs;
+        camWakeCount++;
+        Serial.printf("[CAM] Wake (%s) -> first valid frame: %lums\n", camPowerPolicyName(), (unsigned long)camLastWakeMs);
+    } else {
+        Serial.println("[CAM] No valid frame after wake");
+    }
+    return gotFrame;
+}
+
+// ============================================================================
+// BOOT PROFILER
+// ============================================================================
+
+void bootMark(const char* name) {
+    if (bootStageCount >= BOOT_PROFILE_MAX_STAGES) return;
+    bootStages[bootStageCount].name = name;
+    bootStages[bootStageCount].ms = millis();
+    bootStageCount++;
+}
+
+String bootProfileString() {
+    String s = "mode=" + String(fastWake ? "fast" : "full");
+    s += ",armed=" + String(bootArmedMs) + "ms";
+    s += ",total=" + String(bootStageCount > 0 ? bootStages[bootStageCount - 1].ms : 0) + "ms";
+    unsigned long prev = 0;
+    for (int i = 0; i < bootStageCount; i++) {
+        s += "," + String(bootStages[i].name) + "=" + String(bootStages[i].ms - prev);
+        prev = bootStages[i].ms;
+    }
+    return s;
+}
+
+void printBootProfile() {
+    Serial.printf("[BOOT] %s boot profile (ms per stage):\n", fastWake ? "Fast" : "Full");
+    unsigned long prev = 0;
+    for (int i = 0; i < bootStageCount; i++) {
+        Serial.printf("[BOOT]   %-12s %6lu  (@%lu)\n", bootStages[i].name, bootStages[i].ms - prev, bootStages[i].ms);
+        prev = bootStages[i].ms;
+    }
+    Serial.printf("[BOOT] IR armed at %lums\n", bootArmedMs);
+}
+
+void initComponents() {
+    Wire.begin(I2C_SDA, I2C_SCL);
+    
+    initLCD();
+    lcdPrint("SmartTrap v1.0", "Starting...");
+    bootMark("lcd");
+    
+    initRTC();
+    bootMark("rtc");
+    
+    // DHT11 - presence cached across deep sleep, skip the settle + probe
+    dht.begin();
+    if (stateRestored) {
+        dhtOK = rtcState.dhtOK;
+        Serial.printf("[DHT11] Cached: %s\n", dhtOK ? "OK" : "FAIL");
+    } else {
+        delay(DHT_SETTLE_MS);
+        probeDHT();
+    }
+    bootMark("dht");
+    
+    initDS18B20();
+    bootMark("ds18b20");
+    
+    initSDCard();
+    restoreDetectionCount();  // Restore count from CSV
+    bootMark("sd");
+    initCamera();
+    cameraIdle();
+    bootMark("camera");
+    initMicrophone();
+    bootMark("mic");
+    if (stateRestored && !rtcState.bleEnabled) {
+        bleEnabled = false;
+        Serial.println("[BLE] Left OFF (disabled before sleep)");
+    } else {
+        setupBLE();
+    }
+    bootMark("ble");
+}
+
+void initLCD() {
+    Serial.print("[LCD] Initializing... ");
+    
+    // Known absent before sleep - don't probe the bus again
+    if (stateRestored && !rtcState.lcdOK) {
+        Serial.println("FAIL (cached)");
+        return;
+    }
+    
+    // Try the cached address first, then scan
+    if (stateRestored && startLCD(rtcState.lcdAddress)) return;
+    for (byte addr = 0x27; addr <= 0x3F; addr += 0x18) {
+        if (startLCD(addr)) return;
+    }
+    Serial.println("FAIL");
+}
+
+bool startLCD(byte addr) {
+    Wire.beginTransmission(addr);
+    if (Wire.endTransmission() != 0) return false;
+    
+    lcdAddress = addr;
+    lcd = LiquidCrystal_I2C(addr, 16, 2);
+    lcd.init();
+    lcd.backlight();
+    lcdOK = true;
+    Serial.printf("OK (0x%02X)\n", addr);
+    return true;
+}
+
+void initRTC() {
+    if (rtcOK) return;  // Already up (fast wake fell back to full boot)
+    
+    Serial.print("[RTC] Initializing... ");
+    if (rtc.begin()) {
+        if (rtc.lostPower()) rtc.adjust(DateTime(F(__DATE__), F(__TIME__)));
+        rtcOK = true;
+        Serial.println("OK");
+        
+        // INT/SQW shares the button line - release it before anything reads the button,
+        // and keep alarm 1 off while awake so passing its time can't pull GPIO4 LOW.
+        // armWakeAlarm() turns it back on just before the sleep it is meant to end.
+        wokeByRtcAlarm = rtc.alarmFired(1);
+        rtc.clearAlarm(1);
+        rtc.clearAlarm(2);
+        rtc.disableAlarm(1);
+        if (wokeByRtcAlarm) Serial.println("[POWER] Woke up from RTC alarm");
+        updateWakeStats();
+        restoreEnvLogPhase();
+        creditDeepSleep();
+        if (energyPeriodStart == 0) energyPeriodStart = rtc.now().unixtime();
+    } else Serial.println("FAIL");
+}
+
+// Call at least DHT_SETTLE_MS after dht.begin()
+void probeDHT() {
+    Serial.print("[DHT11] Initializing... ");
+    if (!isnan(dht.readTemperature())) { dhtOK = true; Serial.println("OK"); }
+    else Serial.println("FAIL");
+}
+
+void initDS18B20() {
+    Serial.print("[DS18B20] Initializing... ");
+    ds18b20.begin();
+    ds18b20.setWaitForConversion(true);
+    if (ds18b20.getDeviceCount() > 0) { ds18b20OK = true; Serial.println("OK"); }
+    else Serial.println("FAIL");
+}
+
+void initSDCard() {
+    Serial.print("[SD] Initializing... ");
+    SD_MMC.end();
+    delay(100);
+    SD_MMC.setPins(SD_MMC_CLK, SD_MMC_CMD, SD_MMC_D0);
+    if (SD_MMC.begin("/sdcard", true) && SD_MMC.cardType() != CARD_NONE) {
+        sdOK = true;
+        Serial.printf("OK (%llu MB)\n", SD_MMC.totalBytes() / (1024 * 1024));
+        
+        // Usage walk is slow on big cards - reuse the pre-sleep value
+        if (stateRestored && rtcState.sdTotalBytes == SD_MMC.totalBytes()) {
+            sdTotalBytes = rtcState.sdTotalBytes;
+            sdUsedBytes = rtcState.sdUsedBytes;
+        } else {
+            refreshStorageUsage();
+        }
+        startSdTask();
+    } else Serial.println("FAIL");
+}
+
+void refreshStorageUsage() {
+    if (!sdOK) return;
+    sdRun(SD_CLASS_BULK, [&]() {
+        sdTotalBytes = SD_MMC.totalBytes();
+        sdUsedBytes = SD_MMC.usedBytes();
+    });
+}
+
+// Keep the cached usage roughly right between full refreshes
+void addStorageUsage(String path) {
+    if (!sdOK) return;
+    sdRun(SD_CLASS_LOG, [&]() {
+        File f = SD_MMC.open(path, FILE_READ);
+        if (!f) return;
+        sdUsedBytes += f.size();
+        f.close();
+    });
+}
+
+void restoreDetectionCount() {
+    if (!sdOK) return;
+    
+    // Count carried across deep sleep - no need to rescan the CSV
+    if (stateRestored) {
+        Serial.printf("[SD] Detection count from RTC memory: %lu\n", detectionCount);
+        return;
+    }
+    
+    bool found = false;
+    unsigned long lineCount = 0;
+    sdRun(SD_CLASS_LOG, [&]() {
+        File file = SD_MMC.open("/logs/detections.csv", FILE_READ);
+        if (!file) return;
+        found = true;
+        
+        // Count lines (excluding header)
+        bool firstLine = true;
+        while (file.available()) {
+            String line = file.readStringUntil('\n');
+            if (firstLine) {
+                firstLine = false;  // Skip header
+                continue;
+            }
+            if (line.length() > 0) {
+                lineCount++;
+            }
+        }
+        file.close();
+    });
+    if (!found) {
+        Serial.println("[SD] No previous detections.csv - starting from 0");
+        detectionCount = 0;
+        return;
     }
-    file.close();
     
     detectionCount = lineCount;
     Serial.printf("[SD] Restored detection count: %lu\n", detectionCount);
@@ -1048,9 +2287,11 @@ void initCamera() {
     config.pixel_format = PIXFORMAT_JPEG;
     config.grab_mode = CAMERA_GRAB_LATEST;
     config.fb_location = CAMERA_FB_IN_PSRAM;
-    config.jpeg_quality = 12;
+    config.jpeg_quality = cfg.jpegQuality;
     config.fb_count = 2;
     
+    if (powerMode >= POWER_REDUCED) config.frame_size = FRAMESIZE_QQVGA;  // 160x120 on low battery
+    
     if (!psramFound()) {
         config.frame_size = FRAMESIZE_QQVGA;
         config.fb_location = CAMERA_FB_IN_DRAM;
@@ -1100,6 +2341,7 @@ void setupBLE() {
     Serial.print("[BLE] Initializing... ");
     
     BLEDevice::init(DEVICE_NAME);
+    BLEDevice::setMTU(BLE_MTU);
     pServer = BLEDevice::createServer();
     pServer->setCallbacks(new ServerCallbacks());
     
@@ -1119,6 +2361,7 @@ void setupBLE() {
     
     pService->start();
     BLEDevice::getAdvertising()->addServiceUUID(SERVICE_UUID);
+    updateAdvertising();
     BLEDevice::getAdvertising()->start();
     
     Serial.printf("OK (%s)\n", DEVICE_NAME);
@@ -1183,8 +2426,16 @@ String getDatePath() {
     return "/events/unknown";
 }
 
+// Unix time of a SensorData timestamp (YYYY-MM-DD HH:MM:SS), 0 = no RTC
+uint32_t sensorTimeUnix(const String& ts) {
+    if (ts.length() != 19) return 0;
+    DateTime t(ts.substring(0, 4).toInt(), ts.substring(5, 7).toInt(), ts.substring(8, 10).toInt(),
+               ts.substring(11, 13).toInt(), ts.substring(14, 16).toInt(), ts.substring(17, 19).toInt());
+    return t.unixtime();
+}
+
 void createDirectory(String path) {
-    if (!SD_MMC.exists(path)) SD_MMC.mkdir(path);
+    sdRun(SD_CLASS_RECORD, [&]() { if (!SD_MMC.exists(path)) SD_MMC.mkdir(path); });
 }
 
 // ============================================================================
@@ -1195,6 +2446,8 @@ struct RecordParams {
     String videoPath;
     String audioPath;
     int durationMs;
+    int fps;
+    FinalizeJob* job;     // Filled in by the video task
 };
 
 void videoRecordTask(void* param) {
@@ -1213,6 +2466,7 @@ void videoRecordTask(void* param) {
     camera_fb_t* fb = esp_camera_fb_get();
     if (!fb) {
         Serial.println("[VIDEO] Failed to capture initial frame");
+        night.recFailures++;
         videoTaskDone = true;
         vTaskDelete(NULL);
         return;
@@ -1223,61 +2477,100 @@ void videoRecordTask(void* param) {
     esp_camera_fb_return(fb);
     
     // Calculate expected values
-    int totalFrames = (params->durationMs / 1000) * VIDEO_FPS;
-    int frameIntervalMs = 1000 / VIDEO_FPS;
+    int totalFrames = (params->durationMs / 1000) * params->fps;
+    int frameIntervalMs = 1000 / params->fps;
     
     // Open temp file for frames (we'll build AVI header after)
     String tempPath = params->videoPath + ".tmp";
-    File tempFile = SD_MMC.open(tempPath, FILE_WRITE);
+    File tempFile;
+    sdRun(SD_CLASS_RECORD, [&]() { tempFile = SD_MMC.open(tempPath, FILE_WRITE); });
     if (!tempFile) {
         Serial.println("[VIDEO] Failed to create temp file");
+        night.recFailures++;
         videoTaskDone = true;
         vTaskDelete(NULL);
         return;
     }
     
-    // Store frame sizes for index
+    // Store frame sizes for index, capture times for the ftms chunk
     uint32_t* frameSizes = (uint32_t*)malloc(totalFrames * sizeof(uint32_t));
     uint32_t* frameOffsets = (uint32_t*)malloc(totalFrames * sizeof(uint32_t));
-    if (!frameSizes || !frameOffsets) {
+    uint32_t* frameTimes = (uint32_t*)malloc(totalFrames * sizeof(uint32_t));
+    if (!frameSizes || !frameOffsets || !frameTimes) {
         Serial.println("[VIDEO] Memory allocation failed");
-        tempFile.close();
+        night.recFailures++;
+        free(frameSizes);
+        free(frameOffsets);
+        free(frameTimes);
+        sdRun(SD_CLASS_RECORD, [&]() { tempFile.close(); });
         videoTaskDone = true;
         vTaskDelete(NULL);
         return;
     }
     
+    // Motion score per frame (optional - recording goes on without it)
+    uint16_t* motionScores = ENABLE_MOTION_DETECTOR ? (uint16_t*)malloc(totalFrames * sizeof(uint16_t)) : NULL;
+    motionReset();
+    
     // Record frames
     unsigned long startTime = millis();
     int frameCount = 0;
+    uint64_t sizeSum = 0, sizeSq = 0;
     uint32_t totalDataSize = 0;
     uint32_t maxFrameSize = 0;
+    uint32_t lastWrittenSize = 0;
+    int elideRun = 0;
+    int64_t firstFrameUs = 0;
     
     while (frameCount < totalFrames && (millis() - startTime) < (params->durationMs + 1000)) {
         unsigned long frameStart = millis();
         
         fb = esp_camera_fb_get();
         if (fb) {
-            // Pad to even size (AVI requirement)
+            // Driver capture time, relative to the first frame
+            int64_t frameUs = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+            if (frameCount == 0) firstFrameUs = frameUs;
+            frameTimes[frameCount] = (uint32_t)((frameUs - firstFrameUs) / 1000);
+            
             uint32_t frameSize = fb->len;
-            uint32_t paddedSize = (frameSize + 1) & ~1;
+            if (motionScores) motionScores[frameCount] = motionScoreFrame(fb->buf, fb->len, fb->width, fb->height);
+            
+            // Still frames go in as zero-length drop-frame chunks
+            bool elide = motionScores && frameIsStill(frameSize, lastWrittenSize, elideRun);
+            uint32_t chunkSize = elide ? 0 : frameSize;
+            
+            // Pad to even size (AVI requirement)
+            uint32_t paddedSize = (chunkSize + 1) & ~1;
             
             frameOffsets[frameCount] = totalDataSize;
-            frameSizes[frameCount] = frameSize;
+            frameSizes[frameCount] = chunkSize;
             
             // Write chunk header: "00dc" + size
-            tempFile.write((uint8_t*)"00dc", 4);
-            tempFile.write((uint8_t*)&frameSize, 4);
-            tempFile.write(fb->buf, fb->len);
-            
-            // Pad if needed
-            if (paddedSize > frameSize) {
-                uint8_t pad = 0;
-                tempFile.write(&pad, 1);
-            }
+            sdRun(SD_CLASS_RECORD, [&]() {
+                unsigned long sdStart = micros();
+                tempFile.write((uint8_t*)"00dc", 4);
+                tempFile.write((uint8_t*)&chunkSize, 4);
+                if (!elide) tempFile.write(fb->buf, fb->len);
+                
+                // Pad if needed
+                if (paddedSize > chunkSize) {
+                    uint8_t pad = 0;
+                    tempFile.write(&pad, 1);
+                }
+                energyAddSdWrite(sdStart);
+            });
             
             totalDataSize += 8 + paddedSize;
             if (frameSize > maxFrameSize) maxFrameSize = frameSize;
+            sizeSum += frameSize;
+            sizeSq += (uint64_t)frameSize * frameSize;
+            
+            if (elide) {
+                elideRun++;
+            } else {
+                elideRun = 0;
+                lastWrittenSize = frameSize;
+            }
             
             esp_camera_fb_return(fb);
             frameCount++;
@@ -1290,760 +2583,4299 @@ void videoRecordTask(void* param) {
         }
     }
     
-    tempFile.close();
+    sdRun(SD_CLASS_RECORD, [&]() { tempFile.close(); });
     
     Serial.printf("[VIDEO] Captured %d frames\n", frameCount);
-    
-    // Now build proper AVI file
-    File aviFile = SD_MMC.open(params->videoPath, FILE_WRITE);
-    if (!aviFile) {
-        Serial.println("[VIDEO] Failed to create AVI file");
-        SD_MMC.remove(tempPath);
-        free(frameSizes);
-        free(frameOffsets);
-        videoTaskDone = true;
-        vTaskDelete(NULL);
-        return;
-    }
-    
-    // Calculate sizes
-    uint32_t moviSize = 4 + totalDataSize;  // 'movi' + data
-    uint32_t idxSize = 8 + frameCount * 16;  // 'idx1' header + entries
-    uint32_t hdrlSize = 4 + 64 + 8 + 64 + 8 + 48;  // hdrl list content
-    uint32_t riffSize = 4 + 8 + hdrlSize + 8 + moviSize + idxSize;
-    
-    // RIFF header
-    AVI_RIFF_HEADER riff;
-    riff.fileSize = riffSize;
-    aviFile.write((uint8_t*)&riff, sizeof(riff));
-    
-    // hdrl LIST
-    uint8_t listHdr[12] = {'L','I','S','T', 0,0,0,0, 'h','d','r','l'};
-    uint32_t hdrlListSize = hdrlSize;
-    memcpy(&listHdr[4], &hdrlListSize, 4);
-    aviFile.write(listHdr, 12);
-    
-    // avih
-    AVI_AVIH avih;
-    avih.microSecPerFrame = 1000000 / VIDEO_FPS;
-    avih.maxBytesPerSec = maxFrameSize * VIDEO_FPS;
-    avih.totalFrames = frameCount;
-    avih.suggestedBufferSize = maxFrameSize;
-    avih.width = width;
-    avih.height = height;
-    aviFile.write((uint8_t*)&avih, sizeof(avih));
-    
-    // strl LIST
-    uint8_t strlHdr[12] = {'L','I','S','T', 116,0,0,0, 's','t','r','l'};
-    aviFile.write(strlHdr, 12);
-    
-    // strh
-    AVI_STRH strh;
-    strh.rate = VIDEO_FPS;
-    strh.length = frameCount;
-    strh.suggestedBufferSize = maxFrameSize;
-    strh.right = width;
-    strh.bottom = height;
-    aviFile.write((uint8_t*)&strh, sizeof(strh));
-    
-    // strf
-    AVI_STRF_VIDS strf;
-    strf.biWidth = width;
-    strf.biHeight = height;
-    strf.biSizeImage = width * height * 3;
-    aviFile.write((uint8_t*)&strf, sizeof(strf));
-    
-    // movi LIST
-    uint8_t moviHdr[12] = {'L','I','S','T', 0,0,0,0, 'm','o','v','i'};
-    memcpy(&moviHdr[4], &moviSize, 4);
-    aviFile.write(moviHdr, 12);
-    
-    // Copy frame data from temp file
-    File tempRead = SD_MMC.open(tempPath, FILE_READ);
-    if (tempRead) {
-        uint8_t buf[512];
-        while (tempRead.available()) {
-            size_t r = tempRead.read(buf, sizeof(buf));
-            aviFile.write(buf, r);
-        }
-        tempRead.close();
-    }
-    
-    // idx1 index
-    uint8_t idx1Hdr[8] = {'i','d','x','1', 0,0,0,0};
-    uint32_t idx1DataSize = frameCount * 16;
-    memcpy(&idx1Hdr[4], &idx1DataSize, 4);
-    aviFile.write(idx1Hdr, 8);
-    
-    uint32_t offset = 4;  // Start after 'movi'
-    for (int i = 0; i < frameCount; i++) {
-        uint8_t idxEntry[16];
-        memcpy(idxEntry, "00dc", 4);
-        uint32_t flags = 0x10;  // AVIIF_KEYFRAME
-        memcpy(&idxEntry[4], &flags, 4);
-        memcpy(&idxEntry[8], &offset, 4);
-        memcpy(&idxEntry[12], &frameSizes[i], 4);
-        aviFile.write(idxEntry, 16);
-        offset += 8 + ((frameSizes[i] + 1) & ~1);
+    if (frameCount < totalFrames) night.droppedFrames += totalFrames - frameCount;
+    
+    // Capture stats for the event record (before any trimming)
+    unsigned long captureMs = millis() - startTime;
+    if (frameCount > 0) {
+        double mean = (double)sizeSum / frameCount;
+        eventFeatures.frames = frameCount;
+        eventFeatures.fps = captureMs ? frameCount * 1000.0f / captureMs : 0;
+        eventFeatures.jpegMean = mean;
+        eventFeatures.jpegStd = sqrt(max(0.0, (double)sizeSq / frameCount - mean * mean));
     }
     
-    aviFile.close();
-    SD_MMC.remove(tempPath);
-    free(frameSizes);
-    free(frameOffsets);
-    
-    Serial.printf("[VIDEO] AVI saved: %s (%d frames)\n", params->videoPath.c_str(), frameCount);
+    // Hand the frames to the finalizer - the AVI is built after capture
+    FinalizeJob* job = params->job;
+    job->videoTemp = tempPath;
+    job->frameSizes = frameSizes;
+    job->frameOffsets = frameOffsets;
+    job->frameTimes = frameTimes;
+    job->motionScores = motionScores;
+    job->frameCount = frameCount;
+    job->width = width;
+    job->height = height;
+    job->totalDataSize = totalDataSize;
+    job->maxFrameSize = maxFrameSize;
+    job->motionPeak = motionPeak;
     
     videoTaskDone = true;
     vTaskDelete(NULL);
 }
 
 // ============================================================================
-// AUDIO RECORDING TASK (Core 1)
+// BACKGROUND FINALIZATION
 // ============================================================================
 
-void audioRecordTask(void* param) {
-    RecordParams* params = (RecordParams*)param;
-    
-    Serial.println("[AUDIO] Task started on Core " + String(xPortGetCoreID()));
-    
-    if (!micOK || mic_handle == NULL) {
-        Serial.println("[AUDIO] Microphone not available");
-        audioTaskDone = true;
-        vTaskDelete(NULL);
-        return;
+// Trim, classify and build the AVI from a captured temp file. Runs on the
+// finalizer task, so the beam is watched again while this works.
+bool finalizeVideo(FinalizeJob* job) {
+    String tempPath = job->videoTemp;
+    uint32_t* frameSizes = job->frameSizes;
+    uint32_t* frameOffsets = job->frameOffsets;
+    uint32_t* frameTimes = job->frameTimes;
+    uint16_t* motionScores = job->motionScores;
+    int frameCount = job->frameCount;
+    int width = job->width;
+    int height = job->height;
+    uint32_t totalDataSize = job->totalDataSize;
+    uint32_t maxFrameSize = job->maxFrameSize;
+    
+    // Trim the still tail once the insect has left the frame
+    if (motionScores) {
+        int keep = motionTrimFrames(motionScores, frameCount);
+        if (keep < frameCount) {
+            Serial.printf("[MOTION] Trimmed %d still frames (peak %u)\n", frameCount - keep, job->motionPeak);
+            motionTrimmed += frameCount - keep;
+            totalDataSize = frameOffsets[keep];
+            frameCount = keep;
+        }
     }
     
-    File audioFile = SD_MMC.open(params->audioPath, FILE_WRITE);
-    if (!audioFile) {
-        Serial.println("[AUDIO] Failed to create file");
-        audioTaskDone = true;
-        vTaskDelete(NULL);
-        return;
+    // Bytes saved by elision in what's left of the clip. An elided frame was
+    // within ELIDE_SIZE_PCT of the frame before it, so that size stands in.
+    uint32_t elided = 0, lastSize = 0;
+    for (int i = 0; i < frameCount; i++) {
+        if (frameSizes[i] > 0) { lastSize = frameSizes[i]; continue; }
+        elided++;
+        periodElidedBytes += lastSize;
+    }
+    if (elided > 0) {
+        periodElidedFrames += elided;
+        Serial.printf("[VIDEO] Elided %lu still frames\n", (unsigned long)elided);
     }
     
-    // Calculate sizes
-    int totalSamples = AUDIO_SAMPLE_RATE * (params->durationMs / 1000);
-    uint32_t dataSize = totalSamples * sizeof(int16_t);
-    
-    // Write WAV header
-    WAV_HEADER wav;
-    wav.chunkSize = 36 + dataSize;
-    wav.sampleRate = AUDIO_SAMPLE_RATE;
-    wav.bitsPerSample = AUDIO_BITS;
-    wav.numChannels = 1;
-    wav.byteRate = AUDIO_SAMPLE_RATE * 1 * (AUDIO_BITS / 8);
-    wav.blockAlign = 1 * (AUDIO_BITS / 8);
-    wav.dataSize = dataSize;
-    
-    audioFile.write((uint8_t*)&wav, sizeof(wav));
-    
-    // Enable microphone
-    i2s_channel_enable(mic_handle);
+    // Moth or not, from the first frames
+    if (ENABLE_MOTH_CLASSIFIER) {
+        File frames;
+        sdRun(SD_CLASS_BULK, [&]() { frames = SD_MMC.open(tempPath, FILE_READ); });
+        if (frames) {
+            classifyClip(frames, frameOffsets, frameSizes, frameCount, width, height);
+            sdRun(SD_CLASS_BULK, [&]() { frames.close(); });
+        }
+    }
     
-    // Record in chunks
-    const int chunkSamples = 1600;  // 100ms at 16kHz
-    int16_t* buffer = (int16_t*)malloc(chunkSamples * sizeof(int16_t));
+    // Stream rate from the frames actually captured - SD stalls drop frames,
+    // and a nominal rate would play the clip back too fast
+    uint32_t usPerFrame = 1000000 / job->fps;
+    if (frameCount > 1 && frameTimes[frameCount - 1] > 0) {
+        usPerFrame = (uint32_t)((uint64_t)frameTimes[frameCount - 1] * 1000 / (frameCount - 1));
+    }
     
-    if (!buffer) {
-        Serial.println("[AUDIO] Buffer allocation failed");
-        i2s_channel_disable(mic_handle);
-        audioFile.close();
-        audioTaskDone = true;
-        vTaskDelete(NULL);
-        return;
+    // Now build proper AVI file. Only the writes themselves are charged to
+    // SD energy - waits behind a capture or in the sdio queue are not.
+    File aviFile;
+    sdRun(SD_CLASS_BULK, [&]() { aviFile = SD_MMC.open(job->videoPath, FILE_WRITE); });
+    if (!aviFile) {
+        Serial.println("[VIDEO] Failed to create AVI file");
+        night.recFailures++;
+        sdRemove(SD_CLASS_BULK, tempPath);
+        return false;
     }
     
-    int samplesRecorded = 0;
-    unsigned long startTime = millis();
+    // Calculate sizes
+    uint32_t moviSize = 4 + totalDataSize;  // 'movi' + data
+    uint32_t idxSize = 8 + frameCount * 16;  // 'idx1' header + entries
+    uint32_t hdrlSize = 4 + 64 + 8 + 64 + 8 + 48;  // hdrl list content
+    uint32_t ftmsSize = 8 + frameCount * 4;  // 'ftms' header + per-frame ms
+    uint32_t riffSize = 4 + 8 + hdrlSize + 8 + moviSize + idxSize + ftmsSize;
     
-    while (samplesRecorded < totalSamples && (millis() - startTime) < (params->durationMs + 1000)) {
-        size_t bytesRead = 0;
-        int samplesToRead = min(chunkSamples, totalSamples - samplesRecorded);
+    // Headers go out as one request
+    sdRun(SD_CLASS_BULK, [&]() {
+        unsigned long sdStart = micros();
         
-        esp_err_t err = i2s_channel_read(mic_handle, buffer, 
-            samplesToRead * sizeof(int16_t), &bytesRead, 500);
+        // RIFF header
+        AVI_RIFF_HEADER riff;
+        riff.fileSize = riffSize;
+        aviFile.write((uint8_t*)&riff, sizeof(riff));
         
-        if (err == ESP_OK && bytesRead > 0) {
-            audioFile.write((uint8_t*)buffer, bytesRead);
-            samplesRecorded += bytesRead / sizeof(int16_t);
-        }
+        // hdrl LIST
+        uint8_t listHdr[12] = {'L','I','S','T', 0,0,0,0, 'h','d','r','l'};
+        uint32_t hdrlListSize = hdrlSize;
+        memcpy(&listHdr[4], &hdrlListSize, 4);
+        aviFile.write(listHdr, 12);
         
-        vTaskDelay(1);  // Yield to other tasks
+        // avih
+        AVI_AVIH avih;
+        avih.microSecPerFrame = usPerFrame;
+        avih.maxBytesPerSec = (uint32_t)((uint64_t)maxFrameSize * 1000000 / usPerFrame);
+        avih.totalFrames = frameCount;
+        avih.suggestedBufferSize = maxFrameSize;
+        avih.width = width;
+        avih.height = height;
+        aviFile.write((uint8_t*)&avih, sizeof(avih));
+        
+        // strl LIST
+        uint8_t strlHdr[12] = {'L','I','S','T', 116,0,0,0, 's','t','r','l'};
+        aviFile.write(strlHdr, 12);
+        
+        // strh
+        AVI_STRH strh;
+        strh.scale = usPerFrame;  // rate / scale = measured fps
+        strh.rate = 1000000;
+        strh.length = frameCount;
+        strh.suggestedBufferSize = maxFrameSize;
+        strh.right = width;
+        strh.bottom = height;
+        aviFile.write((uint8_t*)&strh, sizeof(strh));
+        
+        // strf
+        AVI_STRF_VIDS strf;
+        strf.biWidth = width;
+        strf.biHeight = height;
+        strf.biSizeImage = width * height * 3;
+        aviFile.write((uint8_t*)&strf, sizeof(strf));
+        
+        // movi LIST
+        uint8_t moviHdr[12] = {'L','I','S','T', 0,0,0,0, 'm','o','v','i'};
+        memcpy(&moviHdr[4], &moviSize, 4);
+        aviFile.write(moviHdr, 12);
+        energyAddSdWrite(sdStart);
+    });
+        
+    // Copy frame data from temp file - one request per buffer, so log
+    // appends and transfer chunks get in between
+    File tempRead;
+    sdRun(SD_CLASS_BULK, [&]() { tempRead = SD_MMC.open(tempPath, FILE_READ); });
+    if (tempRead) {
+        uint8_t* buf = (uint8_t*)malloc(4096);
+        uint32_t remaining = buf ? totalDataSize : 0;  // May stop short of the file if trimmed
+        size_t r = 1;
+        while (remaining > 0 && r > 0) {
+            finalizeYield();
+            sdRun(SD_CLASS_BULK, [&]() {
+                unsigned long sdStart = micros();
+                r = tempRead.read(buf, min((uint32_t)4096, remaining));
+                aviFile.write(buf, r);
+                energyAddSdWrite(sdStart);
+            });
+            remaining -= r;
+        }
+        free(buf);
+        sdRun(SD_CLASS_BULK, [&]() { tempRead.close(); });
     }
     
-    free(buffer);
-    i2s_channel_disable(mic_handle);
-    audioFile.close();
-    
-    Serial.printf("[AUDIO] WAV saved: %s (%d samples, %.1fs)\n", 
-        params->audioPath.c_str(), samplesRecorded, 
-        (float)samplesRecorded / AUDIO_SAMPLE_RATE);
+    sdRun(SD_CLASS_BULK, [&]() {
+        unsigned long sdStart = micros();
+        
+        // idx1 index
+        uint8_t idx1Hdr[8] = {'i','d','x','1', 0,0,0,0};
+        uint32_t idx1DataSize = frameCount * 16;
+        memcpy(&idx1Hdr[4], &idx1DataSize, 4);
+        aviFile.write(idx1Hdr, 8);
+        
+        for (int i = 0; i < frameCount; i++) {
+            uint8_t idxEntry[16];
+            memcpy(idxEntry, "00dc", 4);
+            uint32_t flags = frameSizes[i] ? 0x10 : 0;  // AVIIF_KEYFRAME, none for a drop frame
+            uint32_t offset = 4 + frameOffsets[i];      // From the 'movi' fourcc
+            memcpy(&idxEntry[4], &flags, 4);
+            memcpy(&idxEntry[8], &offset, 4);
+            memcpy(&idxEntry[12], &frameSizes[i], 4);
+            aviFile.write(idxEntry, 16);
+        }
+        
+        // ftms: capture time of each idx1 entry in ms from the first frame
+        // (uint32 LE). Players skip unknown chunks; tools/avi_timestamps.py reads it.
+        uint8_t ftmsHdr[8] = {'f','t','m','s', 0,0,0,0};
+        uint32_t ftmsDataSize = frameCount * 4;
+        memcpy(&ftmsHdr[4], &ftmsDataSize, 4);
+        aviFile.write(ftmsHdr, 8);
+        aviFile.write((uint8_t*)frameTimes, ftmsDataSize);
+        
+        aviFile.close();
+        SD_MMC.remove(tempPath);
+        energyAddSdWrite(sdStart);
+    });
     
-    audioTaskDone = true;
-    vTaskDelete(NULL);
+    Serial.printf("[VIDEO] AVI saved: %s (%d frames, %.2f fps)\n", job->videoPath.c_str(), frameCount, 1000000.0f / usPerFrame);
+    return true;
 }
 
-// ============================================================================
-// RECORDING
-// ============================================================================
+// Keep the card free for an active capture - frame writes come first
+void finalizeYield() {
+    while (captureActive) vTaskDelay(pdMS_TO_TICKS(20));
+}
 
-void recordEvent() {
-    if (!sdOK) {
-        Serial.println("[REC] SD card not available");
-        return;
+// Build the clip, apply the classifier / motion verdicts and log the row
+void finalizeEvent(FinalizeJob* job) {
+    unsigned long start = millis();
+    EventFeatures& f = job->features;
+    
+    if (job->videoTemp.length() > 0) {
+        finalizeYield();
+        classifierScore = -1;
+        if (!finalizeVideo(job)) job->videoPath = "";
+        f.classScore = classifierScore;
+        f.motionPeak = job->motionScores ? (int)job->motionPeak : -1;
+    } else {
+        job->videoPath = "";  // Audio-only, or the capture failed
+    }
+    free(job->frameSizes);
+    free(job->frameOffsets);
+    free(job->frameTimes);
+    free(job->motionScores);
+    
+    bool discard = false;
+    
+    // Classifier verdict - drop clips that aren't moths
+    if (f.classScore >= 0) {
+        bool moth = f.classScore >= CLASSIFIER_KEEP_SCORE;
+        f.label = moth ? "moth" : "other";
+        if (!moth && CLASSIFIER_DISCARD) {
+            discard = true;
+            classifierDiscarded++;
+            Serial.printf("[CLASS] Discarded (score %.2f)\n", f.classScore);
+        } else {
+            classifierKept++;
+        }
+    }
+    
+    // No visible motion anywhere in the clip - IR glitch or something too small to see
+    if (f.motionPeak >= 0 && f.motionPeak < MOTION_CONFIRM_PERMILLE) {
+        motionUnconfirmed++;
+        Serial.printf("[MOTION] Not confirmed (peak %d)\n", f.motionPeak);
+        if (MOTION_DISCARD_UNCONFIRMED) discard = true;
+    }
+    
+    if (discard) {
+        sdRun(SD_CLASS_BULK, [&]() {
+            SD_MMC.remove(job->videoPath);
+            SD_MMC.remove(job->audioPath);
+            SD_MMC.remove(spectrumPath(job->audioPath));
+        });
+        job->videoPath = "";
+        job->audioPath = "";
+    }
+    
+    if (job->videoPath.length() > 0) addStorageUsage(job->videoPath);
+    if (job->audioPath.length() > 0) addStorageUsage(job->audioPath);
+    
+    logDetection(job->videoPath, job->audioPath, f, job->conditions);
+    if (job->videoPath.length() > 0 || job->audioPath.length() > 0) maintQueue(MAINT_CLIPS);
+    
+    finalizeLastMs = millis() - start;
+    if (finalizeLastMs > finalizeMaxMs) finalizeMaxMs = finalizeLastMs;
+    Serial.printf("[FINAL] Detection #%lu finalized in %lu ms\n", (unsigned long)f.detection, finalizeLastMs);
+}
+
+// One event at a time, in trigger order - finalizations never overlap
+void finalizeTask(void* param) {
+    FinalizeJob* job;
+    for (;;) {
+        if (xQueueReceive(finalizeQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+        xSemaphoreTake(finalizeMutex, portMAX_DELAY);
+        finalizeEvent(job);
+        xSemaphoreGive(finalizeMutex);
+        delete job;
+        finalizeDone++;
+    }
+}
+
+void startFinalizer() {
+    logMutex = xSemaphoreCreateMutex();
+    finalizeMutex = xSemaphoreCreateMutex();
+    finalizeQueue = xQueueCreate(FINALIZE_QUEUE_LEN, sizeof(FinalizeJob*));
+    xTaskCreatePinnedToCore(finalizeTask, "finalize", 16384, NULL, 1, NULL, 0);
+}
+
+bool finalizeBusy() {
+    return finalizeDone != finalizeQueued;
+}
+
+// Wait for queued events to be written (before sleep or a reset)
+bool finalizeDrain(unsigned long timeoutMs) {
+    unsigned long start = millis();
+    while (finalizeBusy() && millis() - start < timeoutMs) delay(50);
+    return !finalizeBusy();
+}
+
+// Completion side of a handed-over event, back on the loop task
+void serviceFinalize() {
+    while (finalizeReleased != finalizeDone) {
+        finalizeReleased++;
+        cpuRelease();  // Boost taken in recordEvent
+        lastActivityMs = millis();
+        if (!isRecording) lcdPrint("Detection #" + String(lastEvent.detection), "Saved!");
+    }
+}
+
+// ============================================================================
+// BACKGROUND DELETION
+// ============================================================================
+
+// An entry that will not delete goes to TRASH_BAD_DIR, so the rest of the
+// trash behind it still goes. Called from inside an SD request.
+bool trashSetAside(const String& path) {
+    if (!SD_MMC.exists(TRASH_BAD_DIR)) SD_MMC.mkdir(TRASH_BAD_DIR);
+    String name = path.substring(path.lastIndexOf('/') + 1);
+    String dest = String(TRASH_BAD_DIR) + "/" + String(esp_random() & 0xFFFFFF, HEX) + "-" + name;
+    bool ok = SD_MMC.rename(path, dest);
+    Serial.printf("[TRASH] %s %s\n", ok ? "Set aside" : "Could not set aside", path.c_str());
+    return ok;
+}
+
+// One SD request: delete up to TRASH_BATCH files from the first directory
+// under the trash, or remove that directory once it is empty
+TrashStepResult trashStep() {
+    TrashStepResult result = TRASH_STEP_DONE;
+    sdRun(SD_CLASS_BULK, [&]() {
+        String path = TRASH_DIR;
+        File dir = SD_MMC.open(path);
+        if (!dir || !dir.isDirectory()) return;  // No trash
+        
+        // Down to the first directory holding files (or nothing)
+        File entry = dir.openNextFile();
+        while (entry && entry.isDirectory()) {
+            path = entry.path();
+            entry.close();
+            dir.close();
+            dir = SD_MMC.open(path);
+            entry = dir.openNextFile();
+        }
+        
+        if (!entry) {
+            dir.close();
+            if (!SD_MMC.rmdir(path)) {
+                Serial.printf("[TRASH] Failed to remove dir: %s\n", path.c_str());
+                trashErrors++;
+                trashSetAside(path);
+                result = TRASH_STEP_ERROR;
+                return;
+            }
+            if (path != TRASH_DIR) result = TRASH_STEP_MORE;
+            return;
+        }
+        
+        for (int n = 0; entry && !entry.isDirectory() && n < TRASH_BATCH; n++) {
+            String file = entry.path();
+            size_t size = entry.size();
+            entry.close();
+            if (!SD_MMC.remove(file)) {
+                Serial.printf("[TRASH] Failed to delete: %s\n", file.c_str());
+                trashErrors++;
+                dir.close();
+                trashSetAside(file);
+                result = TRASH_STEP_ERROR;
+                return;
+            }
+            trashFiles++;
+            trashBytes += size;
+            sdUsedBytes = (sdUsedBytes > size) ? sdUsedBytes - size : 0;
+            if (n + 1 < TRASH_BATCH) entry = dir.openNextFile();
+        }
+        if (entry) entry.close();
+        dir.close();
+        result = TRASH_STEP_MORE;
+    });
+    return result;
+}
+
+// SDMMCFS keeps its card handle protected - needed for the FatFs drive number
+struct SdCardHandle : SDMMCFS {
+    static sdmmc_card_t* get() { return SD_MMC.*(&SdCardHandle::_card); }
+};
+
+// RESET:FORMAT - a fresh FAT instead of deleting a full card file by file.
+// The drive number comes from the card's diskio registration (another
+// FatFs volume mounted first would take drive 0); f_mkfs drops the mounted
+// volume and FatFs remounts it on the next access.
+bool sdFormat() {
+    bool ok = false;
+    sdRun(SD_CLASS_BULK, [&]() {
+        BYTE pdrv = ff_diskio_get_pdrv_card(SdCardHandle::get());
+        if (pdrv == 0xFF) return;
+        const char drive[] = { (char)('0' + pdrv), ':', 0 };
+        const UINT workLen = 4096;
+        void* work = malloc(workLen);
+        if (!work) return;
+        MKFS_PARM opt = { FM_ANY, 0, 0, 0, TRASH_FORMAT_AU };
+        ok = f_mkfs(drive, &opt, work, workLen) == FR_OK;
+        free(work);
+        if (ok) {
+            SD_MMC.mkdir("/events");
+            SD_MMC.mkdir("/logs");
+        }
+    });
+    return ok;
+}
+
+// RESET - move the data into the trash and start over; the files are
+// deleted by the maintenance trash job. Both renames are single FAT directory updates.
+bool trashData() {
+    String tag = String(esp_random() & 0xFFFFFF, HEX);
+    bool ok = false;
+    sdRun(SD_CLASS_BULK, [&]() {
+        if (!SD_MMC.exists(TRASH_DIR)) SD_MMC.mkdir(TRASH_DIR);
+        ok = true;
+        if (SD_MMC.exists("/events")) ok &= SD_MMC.rename("/events", String(TRASH_DIR) + "/events-" + tag);
+        if (SD_MMC.exists("/logs")) ok &= SD_MMC.rename("/logs", String(TRASH_DIR) + "/logs-" + tag);
+        SD_MMC.mkdir("/events");
+        SD_MMC.mkdir("/logs");
+    });
+    if (!ok) return false;
+    
+    if (trashState == TRASH_IDLE) {
+        trashFiles = 0;
+        trashBytes = 0;
+        trashTotalBytes = 0;
+        trashStartMs = millis();
+    }
+    trashTotalBytes = trashBytes + sdUsedBytes;  // Roughly - includes anything else on the card
+    trashState = TRASH_RECLAIMING;
+    maintSetCursor("");
+    maintQueue(MAINT_TRASH);
+    return true;
+}
+
+// RESET:STATUS and DIAG TRASH: line
+String trashString() {
+    static const char* names[] = { "idle", "reclaiming", "formatting", "error" };
+    String s = "state=" + String(names[trashState]);
+    s += ",files=" + String(trashFiles);
+    s += ",freedKB=" + String((uint32_t)(trashBytes / 1024));
+    if (trashTotalBytes > 0) {
+        s += ",totalKB=" + String((uint32_t)(trashTotalBytes / 1024));
+        s += ",pct=" + String(min(100, (int)(trashBytes * 100 / trashTotalBytes)));
+    }
+    s += ",errors=" + String(trashErrors);
+    if (trashState != TRASH_IDLE) s += ",sec=" + String((millis() - trashStartMs) / 1000);
+    return s;
+}
+
+// ============================================================================
+// MAINTENANCE SCHEDULER
+// ============================================================================
+
+// Jobs may run: card not handed to a USB host, nothing writing clips or
+// streaming a file, and it is daytime or a quiet stretch of the night
+bool maintMayRun() {
+    if (usbMscMode || maintPaused || isRecording || captureActive || finalizeBusy() || transfer.state != IDLE) return false;
+    if (trashFormatPending || trashMovePending || !isActiveHours) return true;
+    return millis() - lastActivityMs >= MAINT_IDLE_MS;
+}
+
+// Anything left that is worth staying awake for
+bool maintPending() {
+    if (trashFormatPending || trashMovePending) return true;
+    if (maintMahToday >= MAINT_BUDGET_MAH) return false;
+    for (int i = 0; i < MAINT_JOB_COUNT; i++) {
+        if (maintJobs[i].pending) return true;
+    }
+    return false;
+}
+
+// Deferred deletes: RESET:FORMAT, RESET's move into the trash, then
+// whatever is in the trash. Requests are latched by the BLE task and
+// taken here, so one made while a step runs is never lost.
+bool maintTrashStep() {
+    if (trashFormatPending) {
+        trashFormatPending = false;
+        trashMovePending = false;  // Nothing left to move
+        trashFiles = 0;
+        trashBytes = 0;
+        trashTotalBytes = 0;
+        trashStartMs = millis();
+        trashState = TRASH_FORMATTING;
+        maintSetCursor("");
+        detectionCount = 0;        // Finalizer queue is drained - no row can still use the old count
+        bool ok = sdFormat();
+        Serial.printf("[TRASH] Format %s in %lu ms\n", ok ? "done" : "FAILED", millis() - trashStartMs);
+        if (!ok) trashErrors++;
+        refreshStorageUsage();
+        trashState = TRASH_IDLE;
+        if (deviceConnected) sendBLE(ok ? "RESET:OK,formatted=1" : "ERROR:Format failed");
+        return true;  // Go round again for anything queued meanwhile
+    }
+    
+    if (trashMovePending) {
+        trashMovePending = false;
+        bool ok = trashData();
+        if (ok) detectionCount = 0;
+        Serial.printf("[RESET] %s\n", ok ? "Data moved to the trash, detection counter reset to 0" : "Failed to move data");
+        if (!ok) trashErrors++;
+        if (deviceConnected) sendBLE(ok ? "RESET:OK," + trashString() : String("ERROR:Reset failed"));
+        return true;
+    }
+    
+    // Trash left over from before a deep sleep or reboot
+    if (trashState == TRASH_IDLE) {
+        if (!sdExists(SD_CLASS_BULK, TRASH_DIR)) return false;
+        trashTotalBytes = 0;  // Size unknown
+        trashStartMs = millis();
+        trashState = TRASH_RECLAIMING;
+        Serial.println("[TRASH] Resuming deletion");
+    }
+    
+    // A failed delete keeps the job going - the entry was set aside, or
+    // the next step tries it again - and shows as state=error until done
+    TrashStepResult step = trashStep();
+    if (step == TRASH_STEP_ERROR) trashState = TRASH_ERROR;
+    if (step != TRASH_STEP_DONE) return true;
+    Serial.printf("[TRASH] Done: %lu files, %llu KB in %lu s, %lu errors\n",
+        (unsigned long)trashFiles, trashBytes / 1024, (millis() - trashStartMs) / 1000, (unsigned long)trashErrors);
+    refreshStorageUsage();
+    trashState = TRASH_IDLE;
+    return false;
+}
+
+// Key of an event file: "YYYYMMDD/<timestamp>", without the vid_/aud_
+// prefix, so a clip's .avi and .wav share one key
+String eventKey(const String& date, const String& name) {
+    int dot = name.indexOf('.');
+    String stem = dot < 0 ? name : name.substring(0, dot);
+    if (stem.startsWith("vid_") || stem.startsWith("aud_")) stem = stem.substring(4);
+    return date + "/" + stem;
+}
+
+// Path of one of an event's files from its key ("vid_" or "aud_" prefix)
+String eventPath(const String& key, const char* prefix, const char* ext) {
+    int slash = key.indexOf('/');
+    return "/events/" + key.substring(0, slash + 1) + prefix + key.substring(slash + 1) + ext;
+}
+
+// Smallest event key under /events past `after` with a file ending in
+// suffixA or suffixB ("" = none). Folders before the date of `after`
+// are skipped unopened, so a pass costs one or two folders.
+String eventsNext(const String& after, const char* suffixA, const char* suffixB) {
+    String best;
+    String afterDate = after.substring(0, after.indexOf('/'));
+    sdRun(SD_CLASS_BULK, [&]() {
+        File events = SD_MMC.open("/events");
+        if (!events || !events.isDirectory()) return;
+        File day;
+        while ((day = events.openNextFile())) {
+            String date = day.name();
+            date = date.substring(date.lastIndexOf('/') + 1);
+            if (!day.isDirectory() || date < afterDate) { day.close(); continue; }
+            
+            File entry;
+            while ((entry = day.openNextFile())) {
+                String name = entry.name();
+                name = name.substring(name.lastIndexOf('/') + 1);
+                entry.close();
+                if (!name.endsWith(suffixA) && !(suffixB && name.endsWith(suffixB))) continue;
+                String key = eventKey(date, name);
+                if (key > after && (best.length() == 0 || key < best)) best = key;
+            }
+            day.close();
+        }
+        events.close();
+    });
+    return best;
+}
+
+// Frame size from a JPEG's SOF marker
+bool jpegSize(const uint8_t* jpg, size_t len, int* width, int* height) {
+    size_t i = 2;
+    while (i + 9 <= len && jpg[i] == 0xFF) {
+        uint8_t marker = jpg[i + 1];
+        if (marker >= 0xC0 && marker <= 0xC2) {
+            *height = (jpg[i + 5] << 8) | jpg[i + 6];
+            *width = (jpg[i + 7] << 8) | jpg[i + 8];
+            return true;
+        }
+        i += 2 + ((jpg[i + 2] << 8) | jpg[i + 3]);
+    }
+    return false;
+}
+
+// Journal recovery: a capture cut off by a reset or power loss leaves its
+// .avi.tmp - plain "00dc" chunks, enough to wrap a normal AVI around
+bool recoverClip(const String& base) {
+    FinalizeJob job;
+    job.videoTemp = eventPath(base, "vid_", ".avi.tmp");
+    job.videoPath = eventPath(base, "vid_", ".avi");
+    job.fps = cfg.videoFps;
+    
+    // Power lost between the AVI and removing the temp
+    if (sdExists(SD_CLASS_BULK, job.videoPath)) return sdRemove(SD_CLASS_BULK, job.videoTemp);
+    
+    int capacity = 0;
+    uint8_t head[1024];  // Through the SOF marker
+    size_t headLen = 0;
+    sdRun(SD_CLASS_BULK, [&]() {
+        File f = SD_MMC.open(job.videoTemp, FILE_READ);
+        if (!f) return;
+        uint32_t fileSize = f.size(), pos = 0;
+        uint8_t ch[8];
+        while (pos + 8 <= fileSize) {
+            f.seek(pos);
+            if (f.read(ch, 8) != 8 || memcmp(ch, "00dc", 4) != 0) break;
+            uint32_t size;
+            memcpy(&size, ch + 4, 4);
+            if (pos + 8 + size > fileSize) break;  // Last frame cut short
+            
+            if (job.frameCount == capacity) {
+                capacity += 64;
+                job.frameSizes = (uint32_t*)realloc(job.frameSizes, capacity * sizeof(uint32_t));
+                job.frameOffsets = (uint32_t*)realloc(job.frameOffsets, capacity * sizeof(uint32_t));
+                if (!job.frameSizes || !job.frameOffsets) { job.frameCount = 0; break; }
+            }
+            if (size > 0 && headLen == 0) headLen = f.read(head, min((uint32_t)sizeof(head), size));
+            job.frameSizes[job.frameCount] = size;
+            job.frameOffsets[job.frameCount] = pos;
+            job.frameCount++;
+            job.maxFrameSize = max(job.maxFrameSize, size);
+            pos += 8 + ((size + 1) & ~1);
+        }
+        job.totalDataSize = pos;
+        f.close();
+    });
+    
+    bool ok = job.frameCount > 0 && jpegSize(head, headLen, &job.width, &job.height);
+    if (ok) {
+        // No capture times survive - space the frames at the configured rate
+        job.frameTimes = (uint32_t*)malloc(job.frameCount * sizeof(uint32_t));
+        ok = job.frameTimes != NULL;
+        for (int i = 0; ok && i < job.frameCount; i++) job.frameTimes[i] = i * 1000 / job.fps;
+    }
+    if (ok) {
+        // A detection during recovery queues a clip - the finalizer waits
+        xSemaphoreTake(finalizeMutex, portMAX_DELAY);
+        ok = finalizeVideo(&job);
+        xSemaphoreGive(finalizeMutex);
+    }
+    free(job.frameSizes);
+    free(job.frameOffsets);
+    free(job.frameTimes);
+    
+    logHealthEvent(ok ? "clip_recovered" : "clip_unrecoverable", base + " " + String(job.frameCount) + " frames");
+    if (!ok) sdRun(SD_CLASS_BULK, [&]() { SD_MMC.rename(job.videoTemp, job.videoTemp + ".bad"); });
+    else addStorageUsage(job.videoPath);
+    return ok;
+}
+
+bool maintRecoverStep() {
+    String base = eventsNext("", ".avi.tmp", NULL);
+    if (base.length() == 0) return false;
+    // A capture's temp file exists only while isRecording or finalizeBusy()
+    // is set (finalizeQueued goes up before isRecording drops), so with
+    // either set the temp just found may be live - try again once idle
+    if (isRecording || finalizeBusy()) return true;
+    if (recoverClip(base)) maintRecovered++;
+    return true;
+}
+
+// Middle kept frame of a clip (from idx1) and the frame size (from avih)
+bool aviMiddleFrame(File& f, uint32_t* offset, uint32_t* size, int* width, int* height) {
+    uint8_t ch[12];
+    if (f.read(ch, 12) != 12 || memcmp(ch, "RIFF", 4) != 0 || memcmp(ch + 8, "AVI ", 4) != 0) return false;
+    uint32_t riffSize;
+    memcpy(&riffSize, ch + 4, 4);
+    uint32_t end = min((uint32_t)f.size(), riffSize + 8);
+    uint32_t pos = 12, movi = 0;
+    
+    while (pos + 12 <= end) {
+        f.seek(pos);
+        if (f.read(ch, 12) != 12) return false;
+        uint32_t len;
+        memcpy(&len, ch + 4, 4);
+        
+        if (memcmp(ch, "LIST", 4) == 0 && memcmp(ch + 8, "hdrl", 4) == 0) {
+            AVI_AVIH avih;  // First chunk in hdrl
+            if (f.read((uint8_t*)&avih, sizeof(avih)) != sizeof(avih)) return false;
+            *width = avih.width;
+            *height = avih.height;
+        } else if (memcmp(ch, "LIST", 4) == 0 && memcmp(ch + 8, "movi", 4) == 0) {
+            movi = pos + 8;  // idx1 offsets count from the 'movi' fourcc
+        } else if (memcmp(ch, "idx1", 4) == 0) {
+            int n = len / 16;
+            for (int i = n / 2; i < n; i++) {
+                uint8_t e[16];
+                f.seek(pos + 8 + i * 16);
+                if (f.read(e, 16) != 16) return false;
+                memcpy(size, e + 12, 4);
+                if (*size == 0) continue;  // Elided - try the next one
+                uint32_t rel;
+                memcpy(&rel, e + 8, 4);
+                *offset = movi + rel + 8;
+                return movi > 0 && *width > 0;
+            }
+            return false;
+        }
+        pos += 8 + len + (len & 1);
+    }
+    return false;
+}
+
+// Quarter-scale gray JPEG of the middle of the clip, for browsing over BLE
+bool writeThumbnail(const String& aviPath, const String& jpgPath) {
+    uint32_t offset = 0, len = 0;
+    int width = 0, height = 0;
+    uint8_t* jpg = NULL;
+    size_t got = 0;
+    sdRun(SD_CLASS_BULK, [&]() {
+        File f = SD_MMC.open(aviPath, FILE_READ);
+        if (!f) return;
+        if (aviMiddleFrame(f, &offset, &len, &width, &height) && len < 512 * 1024) {
+            jpg = (uint8_t*)ps_malloc(len);
+            if (jpg) {
+                f.seek(offset);
+                got = f.read(jpg, len);
+            }
+        }
+        f.close();
+    });
+    if (!jpg) return false;
+    
+    int w = width / 4, h = height / 4;
+    uint8_t* gray = (uint8_t*)ps_malloc(w * h);
+    MotionDecode d = { jpg, gray, w, h };
+    bool ok = gray && got == len && esp_jpg_decode(len, JPG_SCALE_4X, motionJpgRead, motionJpgWrite, &d) == ESP_OK;
+    uint8_t* out = NULL;
+    size_t outLen = 0;
+    if (ok) ok = fmt2jpg(gray, w * h, w, h, PIXFORMAT_GRAYSCALE, MAINT_THUMB_QUALITY, &out, &outLen);
+    free(jpg);
+    free(gray);
+    
+    if (ok) {
+        sdRun(SD_CLASS_BULK, [&]() {
+            File t = SD_MMC.open(jpgPath, FILE_WRITE);
+            ok = t && t.write(out, outLen) == outLen;
+            if (t) t.close();
+        });
+    }
+    free(out);
+    return ok;
+}
+
+// CRC-32 (zlib-compatible) of a finished file into checksums.csv, one SD
+// request per 4 KB. False if cut short by sleep - the clip is redone.
+bool logChecksum(const String& path) {
+    File f;
+    sdRun(SD_CLASS_BULK, [&]() { f = SD_MMC.open(path, FILE_READ); });
+    if (!f) return true;  // Gone (discarded / deleted) - nothing to check
+    
+    uint8_t* buf = (uint8_t*)malloc(4096);
+    uint32_t crc = 0, bytes = 0;
+    size_t r = buf ? 1 : 0;
+    while (r > 0 && !maintPaused) {
+        sdRun(SD_CLASS_BULK, [&]() { r = f.read(buf, 4096); });
+        crc = esp_rom_crc32_le(crc, buf, r);
+        bytes += r;
+    }
+    bool done = buf && r == 0;
+    free(buf);
+    sdRun(SD_CLASS_BULK, [&]() { f.close(); });
+    if (!done) return false;
+    
+    char hex[9];
+    sprintf(hex, "%08lx", (unsigned long)crc);
+    sdAppendLine("/logs/checksums.csv", "file,bytes,crc32", path + "," + String(bytes) + "," + hex);
+    maintChecksums++;
+    return true;
+}
+
+// Thumbnail and checksums for the next clip past the checkpoint. The
+// checkpoint is kept in NVS so a power cut doesn't restart the pass.
+bool maintClipsStep() {
+    String base = eventsNext(maintClipCursor, ".avi", ".wav");
+    if (base.length() == 0) return false;
+    
+    String video = eventPath(base, "vid_", ".avi");
+    String thumb = eventPath(base, "vid_", ".jpg");
+    bool done = true;
+    if (sdExists(SD_CLASS_BULK, video)) {
+        if (!sdExists(SD_CLASS_BULK, thumb) && writeThumbnail(video, thumb)) maintThumbs++;
+        done = logChecksum(video);
+    }
+    if (done) done = logChecksum(eventPath(base, "aud_", ".wav"));
+    if (!done) return true;  // Paused for sleep - same clip next time
+    
+    maintSetCursor(base);
+    return true;
+}
+
+void maintSetCursor(const String& cursor) {
+    maintClipCursor = cursor;
+    Preferences prefs;
+    if (prefs.begin(MAINT_NVS_NAMESPACE, false)) {
+        prefs.putString("clips", cursor);
+        prefs.end();
+    }
+}
+
+// Move /logs/<name>.csv to the next free /logs/archive/<name>-N.csv.
+// Call inside sdRun.
+bool archiveLog(const char* name) {
+    if (!SD_MMC.exists("/logs/archive")) SD_MMC.mkdir("/logs/archive");
+    int n = 1;
+    while (SD_MMC.exists("/logs/archive/" + String(name) + "-" + String(n) + ".csv")) n++;
+    return SD_MMC.rename("/logs/" + String(name) + ".csv", "/logs/archive/" + String(name) + "-" + String(n) + ".csv");
+}
+
+// Rotate big logs into /logs/archive and drop event folders left empty by
+// discarded clips. detections.csv is never rotated - the boot count comes
+// from it. One pass per wake.
+bool maintLogsStep() {
+    static const char* ROTATED[] = { "environment", "energy", "health", "checksums" };
+    for (const char* name : ROTATED) {
+        sdRun(SD_CLASS_BULK, [&]() {
+            String path = "/logs/" + String(name) + ".csv";
+            File f = SD_MMC.open(path, FILE_READ);
+            if (!f) return;
+            size_t size = f.size();
+            f.close();
+            if (size < MAINT_LOG_ROTATE_KB * 1024UL) return;
+            
+            if (archiveLog(name)) {
+                Serial.printf("[MAINT] Rotated %s (%u KB)\n", path.c_str(), (unsigned)(size / 1024));
+                maintRotated++;
+            }
+        });
+    }
+    
+    // The newest folder is left alone - a clip may be about to go into it
+    sdRun(SD_CLASS_BULK, [&]() {
+        File events = SD_MMC.open("/events");
+        if (!events || !events.isDirectory()) return;
+        String newest;
+        File day;
+        while ((day = events.openNextFile())) {
+            if (day.isDirectory() && String(day.path()) > newest) newest = day.path();
+            day.close();
+        }
+        events.rewindDirectory();
+        while ((day = events.openNextFile())) {
+            String path = day.path();
+            bool empty = day.isDirectory() && path != newest && !day.openNextFile();
+            day.close();
+            if (empty && SD_MMC.rmdir(path)) maintCompacted++;
+        }
+        events.close();
+    });
+    return false;
+}
+
+MaintJob maintJobs[MAINT_JOB_COUNT] = {
+    { "replay",  maintReplayStep,  false },  // Queued by initFlashLog / serviceSdRetry
+    { "trash",   maintTrashStep,   true },   // Before the rest - RESET:FORMAT is waited on
+    { "recover", maintRecoverStep, true },
+    { "clips",   maintClipsStep,   true },
+    { "logs",    maintLogsStep,    true },
+};
+
+// Lowest priority - only runs when everything else on the core is waiting.
+// Each step is a bounded unit of work; its SD request time is charged to
+// the daily budget (wall time would bill preemption and sdio queue waits).
+// Over budget, only a RESET the user is waiting on still runs.
+void maintTask(void* param) {
+    for (;;) {
+        MaintJob* job = NULL;
+        if (sdOK && !usbMscMode && maintMayRun()) {
+            if (maintMahToday < MAINT_BUDGET_MAH) {
+                for (int i = 0; i < MAINT_JOB_COUNT && !job; i++) {
+                    if (maintJobs[i].pending) job = &maintJobs[i];
+                }
+            } else if (trashFormatPending || trashMovePending) {
+                job = &maintJobs[MAINT_TRASH];
+            }
+        }
+        if (!job) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        
+        maintBusy = true;
+        int64_t ioStart = maintIoUs;
+        uint32_t requests = job->requests;
+        if (!job->step() && job->requests == requests) job->pending = false;
+        job->steps++;
+        maintMahToday += (maintIoUs - ioStart) / 3.6e9f * (CURRENT_CPU_ACTIVE_MA + CURRENT_SD_WRITE_MA);
+        maintBusy = false;
+        vTaskDelay(1);
+    }
+}
+
+void startMaintenance() {
+    Preferences prefs;
+    if (prefs.begin(MAINT_NVS_NAMESPACE, true)) {
+        maintClipCursor = prefs.getString("clips", "");
+        prefs.end();
+        // Saved by older firmware with the vid_/aud_ prefix still on
+        int slash = maintClipCursor.indexOf('/');
+        if (slash >= 0) maintClipCursor = eventKey(maintClipCursor.substring(0, slash), maintClipCursor.substring(slash + 1));
+    }
+    xTaskCreatePinnedToCore(maintTask, "maint", 16384, NULL, 0, &maintTaskHandle, 0);
+}
+
+// Stop between steps before deep sleep (a checksum stops mid-file)
+void maintPause() {
+    maintPaused = true;
+    unsigned long start = millis();
+    while (maintBusy && millis() - start < 5000) delay(10);
+}
+
+void maintQueue(int job) {
+    maintJobs[job].requests++;
+    maintJobs[job].pending = true;
+}
+
+// DIAG MAINT: line
+String maintString() {
+    String s = "pending=";
+    bool any = false;
+    for (int i = 0; i < MAINT_JOB_COUNT; i++) {
+        if (!maintJobs[i].pending) continue;
+        s += (any ? "|" : "") + String(maintJobs[i].name);
+        any = true;
+    }
+    if (!any) s += "none";
+    s += ",mah=" + String(maintMahToday, 2) + "/" + String(MAINT_BUDGET_MAH, 1);
+    s += ",thumbs=" + String(maintThumbs) + ",crcs=" + String(maintChecksums);
+    s += ",recovered=" + String(maintRecovered) + ",rotated=" + String(maintRotated);
+    s += ",compacted=" + String(maintCompacted);
+    s += ",cursor=" + (maintClipCursor.length() ? maintClipCursor : String("-"));
+    return s;
+}
+
+// ============================================================================
+// IMA-ADPCM ENCODER
+// ============================================================================
+
+// Standard IMA/DVI tables - any WAV reader that knows format 0x11 decodes this
+const int16_t IMA_STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+const int8_t IMA_INDEX_TABLE[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// One block being filled by the audio task
+int16_t adpcmBlockIn[ADPCM_SAMPLES_PER_BLOCK];
+uint8_t adpcmBlockOut[ADPCM_BLOCK_ALIGN];
+int adpcmPending = 0;
+int adpcmStepIndex = 0;            // Carried across blocks, reset per file
+uint32_t adpcmEncodeUs = 0;        // Encoder time for the last clip
+volatile bool adpcmBenchPending = false;  // AUDIO:BENCH from BLE, run in loop()
+
+// Advance the predictor by one 4-bit code. Shared by encoder and decoder so
+// the encoder tracks exactly what a reader will reconstruct.
+void imaStep(uint8_t code, int* predictor, int* index) {
+    int step = IMA_STEP_TABLE[*index];
+    int delta = step >> 3;
+    if (code & 4) delta += step;
+    if (code & 2) delta += step >> 1;
+    if (code & 1) delta += step >> 2;
+    *predictor += (code & 8) ? -delta : delta;
+    *predictor = constrain(*predictor, -32768, 32767);
+    *index = constrain(*index + IMA_INDEX_TABLE[code], 0, 88);
+}
+
+uint8_t imaEncodeSample(int sample, int* predictor, int* index) {
+    int step = IMA_STEP_TABLE[*index];
+    int diff = sample - *predictor;
+    uint8_t code = 0;
+    if (diff < 0) { code = 8; diff = -diff; }
+    if (diff >= step) { code |= 4; diff -= step; }
+    if (diff >= step >> 1) { code |= 2; diff -= step >> 1; }
+    if (diff >= step >> 2) code |= 1;
+    imaStep(code, predictor, index);
+    return code;
+}
+
+// One WAV block: first sample verbatim + step index, then the remaining
+// samples two per byte, low nibble first
+void adpcmEncodeBlock(const int16_t* in, uint8_t* out, int* index) {
+    int predictor = in[0];
+    out[0] = predictor & 0xFF;
+    out[1] = (predictor >> 8) & 0xFF;
+    out[2] = *index;
+    out[3] = 0;
+    for (int i = 1; i < ADPCM_SAMPLES_PER_BLOCK; i += 2) {
+        uint8_t lo = imaEncodeSample(in[i], &predictor, index);
+        uint8_t hi = imaEncodeSample(in[i + 1], &predictor, index);
+        out[4 + (i - 1) / 2] = lo | (hi << 4);
+    }
+}
+
+// Only used by the benchmark to check the round trip on the device
+void adpcmDecodeBlock(const uint8_t* in, int16_t* out) {
+    int predictor = (int16_t)(in[0] | (in[1] << 8));
+    int index = min((int)in[2], 88);
+    out[0] = predictor;
+    for (int i = 1; i < ADPCM_SAMPLES_PER_BLOCK; i += 2) {
+        uint8_t b = in[4 + (i - 1) / 2];
+        imaStep(b & 0x0F, &predictor, &index);
+        out[i] = predictor;
+        imaStep(b >> 4, &predictor, &index);
+        out[i + 1] = predictor;
+    }
+}
+
+uint32_t adpcmDataSize(uint32_t samples) {
+    return (samples + ADPCM_SAMPLES_PER_BLOCK - 1) / ADPCM_SAMPLES_PER_BLOCK * ADPCM_BLOCK_ALIGN;
+}
+
+void adpcmBegin() {
+    adpcmPending = 0;
+    adpcmStepIndex = 0;
+    adpcmEncodeUs = 0;
+}
+
+void adpcmWriteBlock(File& file) {
+    int64_t t0 = esp_timer_get_time();
+    adpcmEncodeBlock(adpcmBlockIn, adpcmBlockOut, &adpcmStepIndex);
+    adpcmEncodeUs += esp_timer_get_time() - t0;
+    
+    sdRun(SD_CLASS_RECORD, [&]() {
+        unsigned long sdStart = micros();
+        file.write(adpcmBlockOut, ADPCM_BLOCK_ALIGN);
+        energyAddSdWrite(sdStart);
+    });
+    adpcmPending = 0;
+}
+
+// Buffer PCM from the mic and write every completed block
+void adpcmFeed(File& file, const int16_t* samples, int count) {
+    while (count > 0) {
+        int n = min(count, ADPCM_SAMPLES_PER_BLOCK - adpcmPending);
+        memcpy(adpcmBlockIn + adpcmPending, samples, n * sizeof(int16_t));
+        adpcmPending += n;
+        samples += n;
+        count -= n;
+        if (adpcmPending == ADPCM_SAMPLES_PER_BLOCK) adpcmWriteBlock(file);
+    }
+}
+
+// Pad the last block by holding the final sample; the fact chunk keeps the
+// real sample count so readers drop the padding
+void adpcmFinish(File& file) {
+    if (adpcmPending == 0) return;
+    int16_t hold = adpcmBlockIn[adpcmPending - 1];
+    while (adpcmPending < ADPCM_SAMPLES_PER_BLOCK) adpcmBlockIn[adpcmPending++] = hold;
+    adpcmWriteBlock(file);
+}
+
+// WAV header for the configured format. Written with the expected length
+// up front and rewritten with the real one when the clip closes.
+void writeWavHeader(File& file, uint32_t samples) {
+    if (!ENABLE_ADPCM_AUDIO) {
+        WAV_HEADER wav;
+        wav.dataSize = samples * sizeof(int16_t);
+        wav.chunkSize = 36 + wav.dataSize;
+        wav.sampleRate = AUDIO_SAMPLE_RATE;
+        wav.bitsPerSample = AUDIO_BITS;
+        wav.numChannels = 1;
+        wav.byteRate = AUDIO_SAMPLE_RATE * 1 * (AUDIO_BITS / 8);
+        wav.blockAlign = 1 * (AUDIO_BITS / 8);
+        sdRun(SD_CLASS_RECORD, [&]() { file.write((uint8_t*)&wav, sizeof(wav)); });
+        return;
+    }
+    
+    WAV_HEADER_ADPCM wav;
+    wav.dataSize = adpcmDataSize(samples);
+    wav.chunkSize = sizeof(wav) - 8 + wav.dataSize;
+    wav.sampleRate = AUDIO_SAMPLE_RATE;
+    wav.byteRate = (uint32_t)((uint64_t)AUDIO_SAMPLE_RATE * ADPCM_BLOCK_ALIGN / ADPCM_SAMPLES_PER_BLOCK);
+    wav.factSamples = samples;
+    sdRun(SD_CLASS_RECORD, [&]() { file.write((uint8_t*)&wav, sizeof(wav)); });
+}
+
+// AUDIO:BENCH - encode synthetic wingbeat-like audio, decode it again and
+// report encoder cost, round-trip SNR and what the format saves per clip
+String adpcmBenchmark() {
+    const int blocks = AUDIO_SAMPLE_RATE / ADPCM_SAMPLES_PER_BLOCK + 1;  // ~1 s
+    int16_t* pcm = (int16_t*)malloc(ADPCM_SAMPLES_PER_BLOCK * sizeof(int16_t));
+    int16_t* back = (int16_t*)malloc(ADPCM_SAMPLES_PER_BLOCK * sizeof(int16_t));
+    uint8_t* enc = (uint8_t*)malloc(ADPCM_BLOCK_ALIGN);
+    if (!pcm || !back || !enc) {
+        free(pcm);
+        free(back);
+        free(enc);
+        return "ERROR:No memory";
+    }
+    
+    int index = 0;
+    int64_t encUs = 0;
+    double sig = 0, err = 0;
+    for (int b = 0; b < blocks; b++) {
+        for (int i = 0; i < ADPCM_SAMPLES_PER_BLOCK; i++) {
+            float t = (float)(b * ADPCM_SAMPLES_PER_BLOCK + i) / AUDIO_SAMPLE_RATE;
+            pcm[i] = 6000 * sinf(2 * PI * 180 * t) + 2000 * sinf(2 * PI * 360 * t) + random(-400, 400);
+        }
+        int64_t t0 = esp_timer_get_time();
+        adpcmEncodeBlock(pcm, enc, &index);
+        encUs += esp_timer_get_time() - t0;
+        
+        adpcmDecodeBlock(enc, back);
+        for (int i = 0; i < ADPCM_SAMPLES_PER_BLOCK; i++) {
+            sig += (double)pcm[i] * pcm[i];
+            err += (double)(pcm[i] - back[i]) * (pcm[i] - back[i]);
+        }
+    }
+    free(pcm);
+    free(back);
+    free(enc);
+    
+    uint32_t clipSamples = AUDIO_SAMPLE_RATE * (cfg.recordingMs / 1000);
+    uint32_t pcmBytes = clipSamples * sizeof(int16_t);
+    uint32_t adpcmBytes = adpcmDataSize(clipSamples);
+    float secPerByte = (float)max(cfg.chunkDelayMs, (uint32_t)10) / transferChunkBytes() / 1000.0f;
+    float usPerSec = (float)encUs * AUDIO_SAMPLE_RATE / (blocks * ADPCM_SAMPLES_PER_BLOCK);
+    
+    String s = "ADPCM:bench,encUsPerSec=" + String(usPerSec, 0);
+    s += ",snrDb=" + String(err > 0 ? 10 * log10(sig / err) : 99.0, 1);
+    s += ",pcmKB=" + String(pcmBytes / 1024) + ",adpcmKB=" + String(adpcmBytes / 1024);
+    s += ",savedKB=" + String((pcmBytes - adpcmBytes) / 1024);
+    s += ",bleSavedS=" + String((pcmBytes - adpcmBytes) * secPerByte, 0);
+    s += ",active=" + String(ENABLE_ADPCM_AUDIO ? "YES" : "NO");
+    return s;
+}
+
+// AUDIO:BENCH from loop() - the run is too long for the BLE callback
+void serviceAdpcmBench() {
+    if (!adpcmBenchPending || isRecording) return;
+    adpcmBenchPending = false;
+    sendBLE(adpcmBenchmark());
+}
+
+// ============================================================================
+// AUDIO RECORDING TASK (Core 1)
+// ============================================================================
+
+void audioRecordTask(void* param) {
+    RecordParams* params = (RecordParams*)param;
+    
+    Serial.println("[AUDIO] Task started on Core " + String(xPortGetCoreID()));
+    
+    if (!micOK || mic_handle == NULL) {
+        Serial.println("[AUDIO] Microphone not available");
+        audioTaskDone = true;
+        vTaskDelete(NULL);
+        return;
+    }
+    
+    File audioFile;
+    sdRun(SD_CLASS_RECORD, [&]() { audioFile = SD_MMC.open(params->audioPath, FILE_WRITE); });
+    if (!audioFile) {
+        Serial.println("[AUDIO] Failed to create file");
+        night.recFailures++;
+        audioTaskDone = true;
+        vTaskDelete(NULL);
+        return;
+    }
+    
+    // Write WAV header
+    int totalSamples = AUDIO_SAMPLE_RATE * (params->durationMs / 1000);
+    writeWavHeader(audioFile, totalSamples);
+    if (ENABLE_ADPCM_AUDIO) adpcmBegin();
+    
+    // Wingbeat features are computed as the audio arrives
+    if (ENABLE_WINGBEAT_ANALYSIS) wingbeatBegin(spectrumPath(params->audioPath));
+    
+    // Take the mic from the acoustic listener (back at the recording rate)
+    bool micLocked = micLock(500);
+    acousticStop();
+    
+    // Enable microphone
+    i2s_channel_enable(mic_handle);
+    micActive = true;
+    
+    // Record in chunks
+    const int chunkSamples = 1600;  // 100ms at 16kHz
+    int16_t* buffer = (int16_t*)malloc(chunkSamples * sizeof(int16_t));
+    
+    if (!buffer) {
+        Serial.println("[AUDIO] Buffer allocation failed");
+        i2s_channel_disable(mic_handle);
+        micActive = false;
+        if (micLocked) micUnlock();
+        sdRun(SD_CLASS_RECORD, [&]() { audioFile.close(); });
+        audioTaskDone = true;
+        vTaskDelete(NULL);
+        return;
+    }
+    
+    int samplesRecorded = 0;
+    unsigned long startTime = millis();
+    double sumSq = 0;
+    int peak = 0;
+    
+    while (samplesRecorded < totalSamples && (millis() - startTime) < (params->durationMs + 1000)) {
+        size_t bytesRead = 0;
+        int samplesToRead = min(chunkSamples, totalSamples - samplesRecorded);
+        
+        esp_err_t err = i2s_channel_read(mic_handle, buffer, 
+            samplesToRead * sizeof(int16_t), &bytesRead, 500);
+        
+        if (err == ESP_OK && bytesRead > 0) {
+            int got = bytesRead / sizeof(int16_t);
+            if (ENABLE_ADPCM_AUDIO) {
+                adpcmFeed(audioFile, buffer, got);
+            } else {
+                sdRun(SD_CLASS_RECORD, [&]() {
+                    unsigned long sdStart = micros();
+                    audioFile.write((uint8_t*)buffer, bytesRead);
+                    energyAddSdWrite(sdStart);
+                });
+            }
+            samplesRecorded += got;
+            wingbeatFeed(buffer, got);
+            
+            int64_t chunkSq = 0;
+            for (int i = 0; i < got; i++) {
+                int v = buffer[i];
+                chunkSq += v * v;
+                if (abs(v) > peak) peak = abs(v);
+            }
+            sumSq += chunkSq;
+        }
+        
+        vTaskDelay(1);  // Yield to other tasks
+    }
+    
+    free(buffer);
+    i2s_channel_disable(mic_handle);
+    micActive = false;
+    if (micLocked) micUnlock();
+    if (ENABLE_ADPCM_AUDIO) adpcmFinish(audioFile);
+    
+    // Short read - make the header match what was actually written
+    if (samplesRecorded != totalSamples) {
+        sdRun(SD_CLASS_RECORD, [&]() {
+            audioFile.seek(0);
+            writeWavHeader(audioFile, samplesRecorded);  // Nested - runs inline
+        });
+    }
+    sdRun(SD_CLASS_RECORD, [&]() { audioFile.close(); });
+    wingbeatFinish();
+    
+    if (samplesRecorded > 0) {
+        float rms = sqrt(sumSq / samplesRecorded);
+        eventFeatures.hasAudio = true;
+        eventFeatures.rmsDbfs = 20.0f * log10f(max(rms, 1.0f) / 32768.0f);
+        eventFeatures.peakDbfs = 20.0f * log10f(max(peak, 1) / 32768.0f);
+    }
+    
+    Serial.printf("[AUDIO] WAV saved: %s (%d samples, %.1fs)\n", 
+        params->audioPath.c_str(), samplesRecorded, 
+        (float)samplesRecorded / AUDIO_SAMPLE_RATE);
+    if (ENABLE_ADPCM_AUDIO) Serial.printf("[AUDIO] ADPCM encode: %lu ms\n", (unsigned long)(adpcmEncodeUs / 1000));
+    
+    audioTaskDone = true;
+    vTaskDelete(NULL);
+}
+
+// Band summary saved next to an event's WAV
+String spectrumPath(String audioPath) {
+    return audioPath.substring(0, audioPath.lastIndexOf('.')) + "_spec.csv";
+}
+
+// ============================================================================
+// RECORDING
+// ============================================================================
+
+void recordEvent(bool fromAudio) {
+    unsigned long triggerMs = millis();
+    
+    // No card - counted, and logged to the flash ring
+    if (!sdOK) {
+        Serial.println("[REC] SD card not available");
+        night.recFailures++;
+        countOnlyDetection();
+        lastActivityMs = millis();
+        return;
+    }
+    
+    // Lowest battery step - keep counting, record nothing
+    if (powerMode == POWER_COUNT_ONLY) {
+        countOnlyDetection();
+        Serial.printf("[REC] Count-only (low battery): #%lu\n", detectionCount);
+        lastActivityMs = millis();
+        return;
+    }
+    
+    // Storm protection - a faulty or flickering beam is counted, not recorded
+    const char* suppressed = recordingSuppressed();
+    if (suppressed) {
+        countOnlyDetection();
+        stormSuppressed++;
+        Serial.printf("[REC] Count-only (%s): #%lu\n", suppressed, detectionCount);
+        lastActivityMs = millis();
+        return;
     }
     
     isRecording = true;
     detectionCount++;
     
-    Serial.println("[REC] ════════════════════════════════════════");
-    Serial.printf("[REC] MOTH DETECTED! (Count: %lu)\n", detectionCount);
-    Serial.println("[REC] Starting simultaneous AVI+WAV recording...");
+    cpuBoost();  // Capture, AVI finalization and logging at full clock
+    energySample();
+    float eventStartMah = energyTotalMah();
+    
+    Serial.println("[REC] ════════════════════════════════════════");
+    Serial.printf("[REC] MOTH DETECTED! (Count: %lu)\n", detectionCount);
+    Serial.println("[REC] Starting simultaneous AVI+WAV recording...");
+    
+    lcdPrint("MOTH DETECTED!", "Recording 10s...");
+    
+    cameraWake();
+    readSensors();
+    
+    String datePath = getDatePath();
+    createDirectory(datePath);
+    
+    String timestamp = getTimestamp();
+    currentVideoPath = datePath + "/vid_" + timestamp + ".avi";
+    currentAudioPath = datePath + "/aud_" + timestamp + ".wav";
+    
+    Serial.printf("[REC] Video: %s\n", currentVideoPath.c_str());
+    Serial.printf("[REC] Audio: %s\n", currentAudioPath.c_str());
+    
+    // Setup recording parameters
+    static RecordParams params;
+    params.videoPath = currentVideoPath;
+    params.audioPath = currentAudioPath;
+    params.durationMs = cfg.recordingMs;  // Snapshot - a CFG:SET mid-recording waits for the next one
+    params.fps = cfg.videoFps;
+    
+    FinalizeJob* job = new FinalizeJob();
+    job->videoPath = currentVideoPath;
+    job->audioPath = currentAudioPath;
+    job->fps = params.fps;
+    job->conditions = sensors;
+    params.job = job;
+    
+    // Fresh metadata record - the tasks fill in their capture stats
+    eventFeatures = EventFeatures();
+    eventFeatures.detection = detectionCount;
+    
+    // The break behind this event: the one that triggered it, or for an
+    // acoustic trigger one still in progress
+    portENTER_CRITICAL(&beamMux);
+    unsigned long breakStartMs = (!fromAudio || beamNow.clearMs == 0) ? beamNow.breakMs : 0;
+    portEXIT_CRITICAL(&beamMux);
+    
+    // Reset completion flags
+    wbHz = -1;
+    videoTaskDone = false;
+    audioTaskDone = false;
+    
+    // Start both tasks on different cores (audio only on low battery)
+    captureActive = true;
+    if (powerMode >= POWER_AUDIO_ONLY) {
+        currentVideoPath = "";
+        job->videoPath = "";
+        videoTaskDone = true;
+    } else {
+        xTaskCreatePinnedToCore(videoRecordTask, "video", 16384, &params, 1, NULL, 0);
+    }
+    xTaskCreatePinnedToCore(audioRecordTask, "audio", 8192, &params, 1, NULL, 1);
+    
+    // Wait for both to complete
+    unsigned long waitStart = millis();
+    int lastSecond = -1;
+    
+    while ((!videoTaskDone || !audioTaskDone) && (millis() - waitStart) < (unsigned long)(params.durationMs + 5000)) {
+        int elapsed = (millis() - waitStart) / 1000;
+        if (elapsed != lastSecond) {
+            lastSecond = elapsed;
+            lcdPrint("Recording...", String(elapsed) + "s / 10s");
+        }
+        energySample();
+        delay(100);
+    }
+    
+    // The tasks own the job and the files until they finish (both loops are time-bounded)
+    while (!videoTaskDone || !audioTaskDone) delay(10);
+    captureActive = false;
+    
+    Serial.println("[REC] Recording complete!");
+    
+    // Beam-break duration (still broken = at least the whole recording)
+    if (breakStartMs) {
+        unsigned long clearMs = beamClearFor(breakStartMs);
+        eventFeatures.beamMs = (clearMs ? clearMs : millis()) - breakStartMs;
+    }
+    
+    if (wbHz >= 0) {
+        eventFeatures.wingbeatHz = wbHz;
+        eventFeatures.wingbeatSnrDb = wbSnrDb;
+        eventFeatures.harm2Db = wbHarm2Db;
+        eventFeatures.harm3Db = wbHarm3Db;
+    }
+    eventFeatures.trigger = triggerAgreement(fromAudio, triggerMs);
+    job->features = eventFeatures;
+    
+    // AVI build, verdicts and logging happen on the finalizer. Only blocks
+    // here if FINALIZE_QUEUE_LEN events are already waiting.
+    finalizeQueued++;
+    xQueueSend(finalizeQueue, &job, portMAX_DELAY);
+    
+    Serial.println("[REC] ════════════════════════════════════════");
+    
+    lcdPrint("Detection #" + String(detectionCount), "Saving...");
+    
+    cameraIdle();
+    energySample();
+    lastEventMah = energyTotalMah() - eventStartMah;
+    periodEventMah += lastEventMah;
+    periodEvents++;
+    // cpuRelease() comes from serviceFinalize() once the clip is written
+    Serial.printf("[REC] Capture energy: %.3f mAh (CPU %s)\n", lastEventMah, cpuPolicyName());
+    
+    isRecording = false;
+    lastActivityMs = millis();
+}
+
+const char DETECTIONS_CSV_HEADER[] =
+    "timestamp,detection_num,air_temp,humidity,soil_temp,soil_moisture,video_file,audio_file,class,class_score,motion,wingbeat_hz,wingbeat_snr_db,harm2_db,harm3_db,trigger,frames,fps,jpeg_mean,jpeg_std,audio_rms_dbfs,audio_peak_dbfs,beam_ms";
+const char ENVIRONMENT_CSV_HEADER[] = "timestamp,air_temp,humidity,soil_temp,soil_moisture";
+
+void logDetection(String videoPath, String audioPath, const EventFeatures& f, const SensorData& at) {
+    xSemaphoreTake(logMutex, portMAX_DELAY);
+    lastEvent = f;
+    nightAddDetection(at.timestamp);
+    if (!sdOK) {
+        flogDetection(f, at);
+        xSemaphoreGive(logMutex);
+        return;
+    }
+    
+    String row = at.timestamp + "," + String(f.detection) + ",";
+    row += String(at.airTemp, 1) + "," + String(at.humidity, 1) + ",";
+    row += String(at.soilTemp, 1) + "," + String(at.soilMoisture) + ",";
+    row += videoPath + "," + audioPath + ",";
+    row += eventFeaturesCsv(f);
+    
+    if (sdAppendLine("/logs/detections.csv", DETECTIONS_CSV_HEADER, row)) {
+        Serial.println("[LOG] Detection logged to CSV");
+    } else {
+        sdLost();  // Card gone since boot
+        flogDetection(f, at);
+    }
+    xSemaphoreGive(logMutex);
+}
+
+// Feature columns of a detections.csv row (blank = not measured)
+String eventFeaturesCsv(const EventFeatures& f) {
+    String s = f.label + "," + (f.classScore >= 0 ? String(f.classScore, 2) : "") + ",";
+    s += (f.motionPeak >= 0 ? String(f.motionPeak) : "") + ",";
+    if (f.wingbeatHz >= 0) {
+        s += String(f.wingbeatHz, 1) + "," + String(f.wingbeatSnrDb, 1) + ",";
+        s += String(f.harm2Db, 1) + "," + String(f.harm3Db, 1) + ",";
+    } else {
+        s += ",,,,";
+    }
+    s += f.trigger + ",";
+    if (f.frames >= 0) {
+        s += String(f.frames) + "," + String(f.fps, 1) + "," + String(f.jpegMean, 0) + "," + String(f.jpegStd, 0) + ",";
+    } else {
+        s += ",,,,";
+    }
+    s += (f.hasAudio ? String(f.rmsDbfs, 1) + "," + String(f.peakDbfs, 1) : ",") + ",";
+    s += (f.beamMs >= 0 ? String(f.beamMs) : "");
+    return s;
+}
+
+// CHANGE interrupt on the receiver - exact edge times for beam_ms, however
+// long recordEvent() takes to get going
+void IRAM_ATTR onBeamEdge() {
+    unsigned long now = millis();
+    portENTER_CRITICAL_ISR(&beamMux);
+    if (digitalRead(IR_RECEIVER_PIN) == LOW) {
+        if (beamNow.clearMs != 0 || beamNow.breakMs == 0) {
+            beamPrev.breakMs = beamNow.breakMs;
+            beamPrev.clearMs = beamNow.clearMs;
+            beamNow.breakMs = now;
+            beamNow.clearMs = 0;
+        }
+    } else if (beamNow.clearMs == 0) {
+        beamNow.clearMs = now;
+    }
+    portEXIT_CRITICAL_ISR(&beamMux);
+}
+
+// Call after pinMode() on the receiver
+void attachBeamEdges() {
+    attachInterrupt(digitalPinToInterrupt(IR_RECEIVER_PIN), onBeamEdge, CHANGE);
+}
+
+// When the break that began at breakMs cleared, 0 = not yet
+unsigned long beamClearFor(unsigned long breakMs) {
+    portENTER_CRITICAL(&beamMux);
+    unsigned long clearMs = 0;
+    if (beamNow.breakMs == breakMs) clearMs = beamNow.clearMs;
+    else if (beamPrev.breakMs == breakMs) clearMs = beamPrev.clearMs;
+    portEXIT_CRITICAL(&beamMux);
+    return clearMs;
+}
+
+// A detection with no media - low battery or counted by the ULP while asleep
+void countOnlyDetection() {
+    EventFeatures f;
+    f.detection = ++detectionCount;
+    f.trigger = "ir";
+    logDetection("", "", f, sensors);
+}
+
+void logEnvironment() {
+    // Read fresh sensor data
+    readSensors();
+    nightAddEnv(sensors);
+    if (!sdOK) {
+        flogEnvironment(sensors);
+        return;
+    }
+    
+    String row = sensors.timestamp + ",";
+    row += String(sensors.airTemp, 1) + "," + String(sensors.humidity, 1) + ",";
+    row += String(sensors.soilTemp, 1) + "," + String(sensors.soilMoisture);
+    
+    if (sdAppendLine("/logs/environment.csv", ENVIRONMENT_CSV_HEADER, row)) {
+        Serial.printf("[ENV] Logged: %.1f°C, %.1f%%, Soil: %.1f°C, %d\n",
+            sensors.airTemp, sensors.humidity, sensors.soilTemp, sensors.soilMoisture);
+    } else {
+        sdLost();
+        flogEnvironment(sensors);
+    }
+}
+
+// ============================================================================
+// NIGHTLY SUMMARY
+// ============================================================================
+
+// Start tonight's counters (once per active window)
+void nightOpen() {
+    if (night.night != 0 || !rtcOK) return;
+    DateTime now = rtc.now();
+    memset(&night, 0, sizeof(night));
+    night.night = (uint32_t)now.year() * 10000 + now.month() * 100 + now.day();
+    night.firstSec = -1;
+    night.lastSec = -1;
+    energySample();
+    night.energyMarkMah = energyTotalMah();
+    Serial.printf("[NIGHT] Window opened (%lu)\n", (unsigned long)night.night);
+}
+
+// Time of day from the SensorData timestamp - the finalizer can't use the RTC
+void nightAddDetection(const String& timestamp) {
+    if (night.night == 0) return;
+    night.detections++;
+    uint32_t t = sensorTimeUnix(timestamp);
+    if (t == 0) return;  // No RTC - counted, but no time
+    
+    int32_t sec = t % 86400;
+    night.perHour[sec / 3600]++;
+    if (night.firstSec < 0) night.firstSec = sec;
+    night.lastSec = sec;
+}
+
+void nightAddEnv(const SensorData& s) {
+    if (night.night == 0) return;
+    night.envSamples++;
+    NightRange* ranges[3] = { &night.air, &night.hum, &night.soil };
+    float values[3] = { s.airTemp, s.humidity, s.soilTemp };
+    for (int i = 0; i < 3; i++) {
+        NightRange* r = ranges[i];
+        float v = values[i];
+        if (isnan(v) || v <= -100) continue;  // Sensor missing this time
+        if (r->samples == 0 || v < r->min) r->min = v;
+        if (r->samples == 0 || v > r->max) r->max = v;
+        r->sum += v;
+        r->samples++;
+    }
+}
+
+// min,mean,max (blank when the sensor never read)
+String nightRange(const NightRange& r, const char* sep = ",") {
+    if (r.samples == 0) return String(sep) + sep;
+    return String(r.min, 1) + sep + String(r.sum / r.samples, 1) + sep + String(r.max, 1);
+}
+
+String nightClock(int32_t sec) {
+    if (sec < 0) return "";
+    char buf[6];
+    sprintf(buf, "%02d:%02d", (int)(sec / 3600), (int)(sec / 60 % 60));
+    return String(buf);
+}
+
+// The window is over: one row to nightly.csv, then keep it for BLE
+void logNightSummary() {
+    if (night.night == 0) return;
+    energySample();
+    night.energyMah += energyTotalMah() - night.energyMarkMah;
+    
+    String header = "night,detections,first,last";
+    for (int h = 0; h < 24; h++) header += ",h" + String(h);
+    header += ",air_min,air_mean,air_max,hum_min,hum_mean,hum_max,soil_min,soil_mean,soil_max";
+    header += ",env_samples,rec_failures,dropped_frames,energy_mah";
+    
+    String row = String(night.night) + "," + String(night.detections) + ",";
+    row += nightClock(night.firstSec) + "," + nightClock(night.lastSec);
+    for (int h = 0; h < 24; h++) row += "," + String(night.perHour[h]);
+    row += "," + nightRange(night.air) + "," + nightRange(night.hum) + "," + nightRange(night.soil);
+    row += "," + String(night.envSamples) + "," + String(night.recFailures);
+    row += "," + String(night.droppedFrames) + "," + String(night.energyMah, 2);
+    
+    if (sdOK && sdAppendLine("/logs/nightly.csv", header, row)) {
+        Serial.printf("[NIGHT] %lu: %u detections logged\n", (unsigned long)night.night, night.detections);
+    }
+    lastNight = night;
+    night.night = 0;
+    updateAdvertising();
+}
+
+// NIGHT command: tonight so far and the last finished night
+String nightString(const NightStats& n) {
+    String s = "night=" + String(n.night) + ",det=" + String(n.detections);
+    s += ",first=" + nightClock(n.firstSec) + ",last=" + nightClock(n.lastSec);
+    s += ",hours=";
+    for (int h = 0; h < 24; h++) s += (h ? "|" : "") + String(n.perHour[h]);
+    s += ",air=" + nightRange(n.air, "/") + ",hum=" + nightRange(n.hum, "/") + ",soil=" + nightRange(n.soil, "/");
+    s += ",recFail=" + String(n.recFailures) + ",dropped=" + String(n.droppedFrames);
+    return s;
+}
+
+// Scan response: name plus tonight's count and last night's total and
+// busiest hour, readable by a phone without connecting. Manufacturer data:
+// company ID (LE), format 1, tonight (u16 LE), last night (u16 LE), hour.
+void updateAdvertising() {
+    if (!ENABLE_NIGHT_ADVERT || !bleEnabled) return;
+    
+    uint8_t busiest = 0xFF;
+    uint16_t most = 0;
+    for (int h = 0; h < 24; h++) {
+        if (lastNight.perHour[h] > most) { most = lastNight.perHour[h]; busiest = h; }
+    }
+    uint8_t m[8] = {
+        ADVERT_COMPANY_ID & 0xFF, ADVERT_COMPANY_ID >> 8, 1,
+        (uint8_t)(night.detections & 0xFF), (uint8_t)(night.detections >> 8),
+        (uint8_t)(lastNight.detections & 0xFF), (uint8_t)(lastNight.detections >> 8),
+        busiest
+    };
+    String data;
+    data.concat((const char*)m, sizeof(m));
+    
+    BLEAdvertisementData scan;
+    scan.setName(DEVICE_NAME);
+    scan.setManufacturerData(data);
+    BLEDevice::getAdvertising()->setScanResponseData(scan);
+    advertisedDetections = night.detections;
+}
+
+void serviceAdvertising() {
+    if (night.detections != advertisedDetections) updateAdvertising();
+}
+
+// ============================================================================
+// FLASH LOG
+// ============================================================================
+
+// Covers seq and time too; replayed is taken as still set
+uint32_t flogCrc(const FlogRecord& r) {
+    FlogRecord c = r;
+    c.crc = 0;
+    c.replayed = 0xFF;
+    return esp_rom_crc32_le(0, (const uint8_t*)&c, sizeof(c));
+}
+
+const FlogRecord* flogSlot(uint32_t seq) {
+    return &flogRecords[seq % flogSlots];
+}
+
+// Map the partition and find where writing stopped. Slots fill in seq order
+// and seq % slots is the slot, so only sector heads and one sector are read.
+void initFlashLog() {
+    if (!ENABLE_FLASH_LOG) return;
+    flogPart = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FLOG_PARTITION);
+    if (!flogPart) {
+        Serial.println("[FLOG] No " FLOG_PARTITION " partition - flash log off");
+        return;
+    }
+    const void* map;
+    if (esp_partition_mmap(flogPart, 0, flogPart->size, ESP_PARTITION_MMAP_DATA, &map, &flogMap) != ESP_OK) {
+        Serial.println("[FLOG] mmap failed - flash log off");
+        flogPart = NULL;
+        return;
+    }
+    flogRecords = (const FlogRecord*)map;
+    flogSlots = flogPart->size / sizeof(FlogRecord);
+    
+    // Newest sector = the valid head record with the highest seq
+    int newest = -1;
+    for (uint32_t sector = 0; sector < flogSlots / FLOG_PER_SECTOR; sector++) {
+        const FlogRecord& r = flogRecords[sector * FLOG_PER_SECTOR];
+        if (r.seq == 0xFFFFFFFF || r.crc != flogCrc(r)) continue;
+        if (newest < 0 || r.seq > flogRecords[newest * FLOG_PER_SECTOR].seq) newest = sector;
+    }
+    if (newest >= 0) {
+        // First erased slot after it (a torn record still takes its slot)
+        uint32_t head = flogRecords[newest * FLOG_PER_SECTOR].seq;
+        uint32_t i = 1;
+        while (i < FLOG_PER_SECTOR && flogRecords[newest * FLOG_PER_SECTOR + i].seq != 0xFFFFFFFF) i++;
+        flogNextSeq = head + i;
+    }
+    
+    // Cold boot - anything still in the ring may be unreplayed
+    uint32_t oldest = flogNextSeq > flogSlots ? flogNextSeq - flogSlots : 0;
+    if (!stateRestored || flogReplaySeq < oldest || flogReplaySeq > flogNextSeq) flogReplaySeq = oldest;
+    flogMutex = xSemaphoreCreateMutex();
+    
+    Serial.printf("[FLOG] %lu slots, next seq %lu, %lu to check for replay\n",
+        (unsigned long)flogSlots, (unsigned long)flogNextSeq, (unsigned long)(flogNextSeq - flogReplaySeq));
+    if (flogReplaySeq != flogNextSeq) maintQueue(MAINT_REPLAY);
+}
+
+// Append one record. Entering a sector erases it first - the oldest data in
+// the ring - so every sector is erased once per lap.
+bool flogAppend(FlogRecord& r) {
+    if (!flogPart) return false;
+    xSemaphoreTake(flogMutex, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    
+    uint32_t slot = flogNextSeq % flogSlots;
+    bool ok = true;
+    if (slot % FLOG_PER_SECTOR == 0) {
+        ok = esp_partition_erase_range(flogPart, slot * sizeof(FlogRecord), FLOG_SECTOR_SIZE) == ESP_OK;
+        flogErases++;
+        // Overwritten before a card came back
+        uint32_t dropTo = flogNextSeq - flogSlots + FLOG_PER_SECTOR;
+        if (flogNextSeq >= flogSlots && flogReplaySeq < dropTo) {
+            flogLost += dropTo - flogReplaySeq;
+            flogReplaySeq = dropTo;
+        }
+    }
+    r.seq = flogNextSeq++;
+    r.replayed = 0xFF;
+    r.crc = flogCrc(r);
+    if (ok) ok = esp_partition_write(flogPart, slot * sizeof(FlogRecord), &r, sizeof(r)) == ESP_OK;
+    
+    flogLastUs = esp_timer_get_time() - start;
+    if (flogLastUs > flogMaxUs) flogMaxUs = flogLastUs;
+    if (ok) flogWritten++;
+    xSemaphoreGive(flogMutex);
+    return ok;
+}
+
+int16_t flogTenths(float v) {
+    return (isnan(v) || v <= -100) ? INT16_MIN : (int16_t)lroundf(v * 10);
+}
+
+void flogSensors(FlogRecord& r, const SensorData& s) {
+    r.time = sensorTimeUnix(s.timestamp);
+    r.airTemp = flogTenths(s.airTemp);
+    r.humidity = flogTenths(s.humidity);
+    r.soilTemp = flogTenths(s.soilTemp);
+    r.soilMoisture = s.soilMoisture;
+}
+
+void flogDetection(const EventFeatures& f, const SensorData& at) {
+    FlogRecord r;
+    memset(&r, 0, sizeof(r));
+    r.type = FLOG_DETECTION;
+    flogSensors(r, at);
+    r.detection = f.detection;
+    if (f.trigger.indexOf("ir") >= 0) r.flags |= FLOG_IR;
+    if (f.trigger.indexOf("audio") >= 0) r.flags |= FLOG_AUDIO;
+    if (f.label == "moth") r.flags |= FLOG_MOTH;
+    if (f.label == "other") r.flags |= FLOG_OTHER;
+    r.classScore = f.classScore >= 0 ? (uint8_t)lroundf(f.classScore * 100) : 0xFF;
+    r.motion = f.motionPeak >= 0 ? f.motionPeak : 0xFFFF;
+    r.beamMs = f.beamMs >= 0 ? (uint16_t)min(f.beamMs, 0xFFFEL) : 0xFFFF;
+    if (flogAppend(r)) Serial.printf("[FLOG] Detection %lu kept in flash\n", (unsigned long)f.detection);
+}
+
+void flogEnvironment(const SensorData& s) {
+    FlogRecord r;
+    memset(&r, 0, sizeof(r));
+    r.type = FLOG_ENV;
+    flogSensors(r, s);
+    flogAppend(r);
+}
+
+String flogTenthsCsv(int16_t v) {
+    return v == INT16_MIN ? String("") : String(v / 10.0f, 1);
+}
+
+// Same form as the rows written straight to SD (readSensors)
+String flogTimestamp(uint32_t t) {
+    if (t == 0) return "";
+    DateTime d(t);
+    char buf[20];
+    sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d", d.year(), d.month(), d.day(), d.hour(), d.minute(), d.second());
+    return String(buf);
+}
+
+// detections.csv row - no media, and only the features the record keeps
+String flogDetectionRow(const FlogRecord& r) {
+    String s = flogTimestamp(r.time) + "," + String(r.detection) + ",";
+    s += flogTenthsCsv(r.airTemp) + "," + flogTenthsCsv(r.humidity) + ",";
+    s += flogTenthsCsv(r.soilTemp) + "," + String(r.soilMoisture) + ",,,";
+    s += String((r.flags & FLOG_MOTH) ? "moth" : (r.flags & FLOG_OTHER) ? "other" : "") + ",";
+    s += (r.classScore != 0xFF ? String(r.classScore / 100.0f, 2) : "") + ",";
+    s += (r.motion != 0xFFFF ? String(r.motion) : "") + ",,,,,";
+    s += String((r.flags & FLOG_IR) ? "ir" : "") + ((r.flags & FLOG_IR) && (r.flags & FLOG_AUDIO) ? "+" : "");
+    s += String((r.flags & FLOG_AUDIO) ? "audio" : "") + ",,,,,,,";
+    s += (r.beamMs != 0xFFFF ? String(r.beamMs) : "");
+    return s;
+}
+
+String flogEnvRow(const FlogRecord& r) {
+    return flogTimestamp(r.time) + "," + flogTenthsCsv(r.airTemp) + "," + flogTenthsCsv(r.humidity) + "," +
+        flogTenthsCsv(r.soilTemp) + "," + String(r.soilMoisture);
+}
+
+// Maintenance job: copy a batch of records to the CSVs, read straight from
+// the mapped partition, then clear each one's replayed byte in place
+bool maintReplayStep() {
+    if (!flogPart) return false;
+    String det, env;
+    uint32_t from = flogReplaySeq, seq = from;
+    int batch = 0;
+    for (uint32_t scanned = 0; seq < flogNextSeq && batch < FLOG_REPLAY_BATCH && scanned < FLOG_PER_SECTOR * 8; seq++, scanned++) {
+        const FlogRecord& r = *flogSlot(seq);
+        if (r.seq != seq || r.replayed != 0xFF || r.crc != flogCrc(r)) continue;
+        if (r.type == FLOG_DETECTION) det += (det.length() ? "\r\n" : "") + flogDetectionRow(r);
+        else if (r.type == FLOG_ENV) env += (env.length() ? "\r\n" : "") + flogEnvRow(r);
+        else continue;
+        batch++;
+    }
+    
+    if (det.length() && !sdAppendLine("/logs/detections.csv", DETECTIONS_CSV_HEADER, det)) return false;
+    if (env.length() && !sdAppendLine("/logs/environment.csv", ENVIRONMENT_CSV_HEADER, env)) return false;
+    
+    xSemaphoreTake(flogMutex, portMAX_DELAY);
+    uint8_t done = 0;
+    for (uint32_t s = max(from, flogReplaySeq); s < seq; s++) {
+        const FlogRecord& r = *flogSlot(s);
+        if (r.seq != s || r.replayed != 0xFF) continue;
+        esp_partition_write(flogPart, (s % flogSlots) * sizeof(FlogRecord) + offsetof(FlogRecord, replayed), &done, 1);
+    }
+    if (seq > flogReplaySeq) flogReplaySeq = seq;
+    flogReplayed += batch;
+    xSemaphoreGive(flogMutex);
+    
+    if (batch) Serial.printf("[FLOG] Replayed %d records to SD\n", batch);
+    return flogReplaySeq < flogNextSeq;
+}
+
+// A log append failed - treat the card as pulled so the logs go to flash
+// and serviceSdRetry() remounts it
+void sdLost() {
+    if (!sdOK) return;
+    sdOK = false;
+    Serial.println("[SD] Write failed - card treated as missing");
+}
+
+// Retry a missing card now and then - the flash holds the logs meanwhile.
+// Not while recording or finishing a clip: SD_MMC.begin() can block for a
+// while with no card, and the remount closes any open file. Runs on the SD
+// task so requests queued before the card was lost finish first.
+void serviceSdRetry() {
+    static unsigned long lastTry = 0;
+    if (sdOK || isRecording || finalizeBusy() || maintBusy) return;
+    if (millis() - lastTry < FLOG_SD_RETRY_MS) return;
+    lastTry = millis();
+    sdRun(SD_CLASS_BULK, [&]() { initSDCard(); });
+    if (!sdOK) return;
+    createDirectory("/events");
+    createDirectory("/logs");
+    if (flogPart && flogReplaySeq != flogNextSeq) maintQueue(MAINT_REPLAY);
+}
+
+// FLOG:BENCH - time record appends against detections-sized SD CSV appends.
+// Endurance: a flash slot is written once per lap and its sector erased
+// once per lap; an SD append rewrites at least the data sector, FAT and
+// directory entry (3 x 512 B, before the card's own wear levelling).
+// The bench records go into the ring, so it only runs with nothing left to
+// replay - a sector erase can then only drop records already on the card.
+// Replay steps over them (FLOG_BENCH is never copied).
+String flogBenchmark() {
+    if (!flogPart) return "ERROR:No flash log partition";
+    if (flogReplaySeq != flogNextSeq) return "ERROR:Flash log not replayed yet (" + String(flogNextSeq - flogReplaySeq) + " records)";
+    
+    FlogRecord r;
+    int64_t flashSum = 0, flashMax = 0;
+    for (int i = 0; i < FLOG_BENCH_RECORDS; i++) {
+        memset(&r, 0, sizeof(r));
+        r.type = FLOG_BENCH;
+        flogAppend(r);
+        flashSum += flogLastUs;
+        if (flogLastUs > flashMax) flashMax = flogLastUs;
+    }
+    
+    String s = "FLOG:bench,flashUs=" + String((uint32_t)(flashSum / FLOG_BENCH_RECORDS));
+    s += ",flashMaxUs=" + String((uint32_t)flashMax);
+    
+    String row = flogDetectionRow(r);
+    if (sdOK) {
+        int64_t sdSum = 0, sdMax = 0;
+        for (int i = 0; i < FLOG_BENCH_RECORDS; i++) {
+            int64_t t0 = esp_timer_get_time();
+            sdAppendLine("/logs/flog_bench.csv", DETECTIONS_CSV_HEADER, row);
+            int64_t us = esp_timer_get_time() - t0;
+            sdSum += us;
+            if (us > sdMax) sdMax = us;
+        }
+        sdRemove(SD_CLASS_LOG, "/logs/flog_bench.csv");
+        s += ",sdUs=" + String((uint32_t)(sdSum / FLOG_BENCH_RECORDS)) + ",sdMaxUs=" + String((uint32_t)sdMax);
+    } else {
+        s += ",sdUs=-,sdMaxUs=-";
+    }
+    
+    // Records the ring takes before its sectors reach rated endurance
+    float lifeM = (float)flogSlots * FLOG_ERASE_CYCLES / 1e6f;
+    s += ",flashBytesPerRec=" + String(sizeof(FlogRecord)) + ",sdBytesPerRec=" + String(3 * 512);
+    s += ",flashLifeMRec=" + String(lifeM, 0) + ",lapRec=" + String(flogSlots);
+    maintQueue(MAINT_REPLAY);  // Step the replay position past the bench records
+    return s;
+}
+
+// Run a FLOG:BENCH request on the loop task, between recordings
+void serviceFlogBench() {
+    if (!flogBenchPending || isRecording) return;
+    flogBenchPending = false;
+    sendBLE(flogBenchmark());
+}
+
+// DIAG FLOG: line
+String flogString() {
+    if (!flogPart) return "off";
+    String s = "slots=" + String(flogSlots) + ",next=" + String(flogNextSeq);
+    s += ",unreplayed<=" + String(flogNextSeq - flogReplaySeq);
+    s += ",written=" + String(flogWritten) + ",replayed=" + String(flogReplayed);
+    s += ",lost=" + String(flogLost) + ",erases=" + String(flogErases);
+    s += ",lastUs=" + String((uint32_t)flogLastUs) + ",maxUs=" + String((uint32_t)flogMaxUs);
+    return s;
+}
+
+// ============================================================================
+// SD I/O SCHEDULER
+// ============================================================================
+
+// The one task that touches the card. Serves the highest-priority class
+// first; a request is one short unit of I/O, so a frame write never waits
+// behind more than one log append or transfer chunk.
+void sdTask(void* param) {
+    for (;;) {
+        xSemaphoreTake(sdWork, portMAX_DELAY);
+        
+        SdRequest req;
+        int cls;
+        for (cls = 0; cls < SD_CLASS_COUNT; cls++) {
+            if (xQueueReceive(sdQueues[cls], &req, 0) == pdTRUE) break;
+        }
+        if (cls == SD_CLASS_COUNT) continue;
+        
+        int64_t start = esp_timer_get_time();
+        (*req.fn)();
+        *req.runUs = esp_timer_get_time() - start;
+        sdRecordLatency(cls, esp_timer_get_time() - req.queuedUs);
+        xSemaphoreGive(req.done);
+    }
+}
+
+void startSdTask() {
+    if (sdTaskHandle) return;
+    for (int i = 0; i < SD_CLASS_COUNT; i++) sdQueues[i] = xQueueCreate(SDIO_QUEUE_LEN, sizeof(SdRequest));
+    sdWork = xSemaphoreCreateCounting(SD_CLASS_COUNT * SDIO_QUEUE_LEN, 0);
+    xTaskCreatePinnedToCore(sdTask, "sdio", 8192, NULL, SDIO_TASK_PRIORITY, &sdTaskHandle, 0);
+}
+
+// Run fn on the SD task and wait for it. Before the task is up (boot) and
+// from inside a request it runs inline.
+void sdRun(SdClass cls, std::function<void()> fn) {
+    int64_t runUs = 0;
+    if (!sdTaskHandle || xTaskGetCurrentTaskHandle() == sdTaskHandle) {
+        int64_t start = esp_timer_get_time();
+        fn();
+        runUs = esp_timer_get_time() - start;
+    } else {
+        StaticSemaphore_t doneBuf;
+        SdRequest req = { &fn, xSemaphoreCreateBinaryStatic(&doneBuf), esp_timer_get_time(), &runUs };
+        xQueueSend(sdQueues[cls], &req, portMAX_DELAY);
+        xSemaphoreGive(sdWork);
+        xSemaphoreTake(req.done, portMAX_DELAY);
+        vSemaphoreDelete(req.done);
+    }
+    if (maintTaskHandle && xTaskGetCurrentTaskHandle() == maintTaskHandle) maintIoUs += runUs;
+}
+
+// Submit-to-done latency into per-class log buckets (SDIO_HIST_EDGES_MS)
+void sdRecordLatency(int cls, int64_t us) {
+    static const uint16_t edgesMs[] = { SDIO_HIST_EDGES_MS };
+    int b = 0;
+    while (b < SDIO_HIST_BUCKETS - 1 && us >= edgesMs[b] * 1000LL) b++;
+    sdHist[cls][b]++;
+    if (us > sdMaxUs[cls]) sdMaxUs[cls] = us;
+}
+
+// DIAG SDIO: line - one bucket list per class, '|' separated
+String sdioString() {
+    static const char* names[SD_CLASS_COUNT] = { "rec", "log", "bulk" };
+    static const uint16_t edgesMs[] = { SDIO_HIST_EDGES_MS };
+    
+    String s = "edgesMs=";
+    for (int b = 0; b < SDIO_HIST_BUCKETS - 1; b++) s += (b ? "|" : "") + String(edgesMs[b]);
+    for (int c = 0; c < SD_CLASS_COUNT; c++) {
+        s += "," + String(names[c]) + "=";
+        for (int b = 0; b < SDIO_HIST_BUCKETS; b++) s += (b ? "|" : "") + String(sdHist[c][b]);
+        s += "," + String(names[c]) + "MaxMs=" + String(sdMaxUs[c] / 1000);
+    }
+    return s;
+}
+
+bool sdExists(SdClass cls, String path) {
+    bool found = false;
+    sdRun(cls, [&]() { found = SD_MMC.exists(path); });
+    return found;
+}
+
+bool sdRemove(SdClass cls, String path) {
+    bool ok = false;
+    sdRun(cls, [&]() { ok = SD_MMC.remove(path); });
+    return ok;
+}
+
+// Append one line to a CSV, writing the header first if the file is new
+bool sdAppendLine(String path, const String& header, const String& line) {
+    bool ok = false;
+    sdRun(SD_CLASS_LOG, [&]() {
+        bool newFile = !SD_MMC.exists(path);
+        File f = SD_MMC.open(path, FILE_APPEND);
+        if (!f) return;
+        unsigned long sdStart = micros();
+        if (newFile) f.println(header);
+        f.println(line);
+        f.close();
+        energyAddSdWrite(sdStart);
+        ok = true;
+    });
+    return ok;
+}
+
+// ============================================================================
+// FILE TRANSFER
+// ============================================================================
+
+// File bytes per DATA chunk: cfg.chunkSize, capped by the negotiated MTU.
+// A notification carries MTU - 3 bytes: "DATA:" and two hex digits per byte
+size_t transferChunkBytes() {
+    uint16_t mtu = pServer ? pServer->getPeerMTU(pServer->getConnId()) : 0;
+    size_t mtuChunk = mtu > 3 + 5 + 2 ? (mtu - 3 - 5) / 2 : 7;  // 7 = default 23-byte MTU
+    return min((size_t)cfg.chunkSize, mtuChunk);
+}
+
+void processTransfer() {
+    // Hold full clock for the whole transfer (hex encoding + notify pacing)
+    static bool boosted = false;
+    if (transfer.state == TRANSFERRING && !boosted) { cpuBoost(); boosted = true; }
+    if (transfer.state != TRANSFERRING && boosted) { cpuRelease(); boosted = false; }
+    
+    if (transfer.state != TRANSFERRING) return;
+    if (!bleEnabled || !deviceConnected) {
+        if (transfer.file) sdRun(SD_CLASS_BULK, [&]() { transfer.file.close(); });
+        transfer.state = IDLE;
+        return;
+    }
+    
+    if (millis() - transfer.lastChunkTime < cfg.chunkDelayMs) return;
+    
+    if (transfer.sentBytes >= transfer.totalSize) {
+        sdRun(SD_CLASS_BULK, [&]() { transfer.file.close(); });
+        sendBLE("FILE_END");
+        Serial.printf("[TRANSFER] Complete: %s\n", transfer.filename.c_str());
+        transfer.state = IDLE;
+        return;
+    }
+    
+    uint8_t buffer[CHUNK_SIZE_MAX];
+    size_t toRead = min(transferChunkBytes(), transfer.totalSize - transfer.sentBytes);
+    size_t bytesRead = 0;
+    sdRun(SD_CLASS_BULK, [&]() { bytesRead = transfer.file.read(buffer, toRead); });
+    
+    if (bytesRead > 0) {
+        String chunk = "DATA:";
+        for (size_t i = 0; i < bytesRead; i++) {
+            char hex[3];
+            sprintf(hex, "%02X", buffer[i]);
+            chunk += hex;
+        }
+        
+        pTxCharacteristic->setValue(chunk.c_str());
+        pTxCharacteristic->notify();
+        
+        transfer.sentBytes += bytesRead;
+        transfer.lastChunkTime = millis();
+        
+        int percent = (transfer.sentBytes * 100) / transfer.totalSize;
+        static int lastPercent = 0;
+        if (percent / 10 > lastPercent / 10) {
+            Serial.printf("[TRANSFER] %d%%\n", percent);
+            lcdPrint("Sending...", String(percent) + "%");
+            lastPercent = percent;
+        }
+    }
+    
+    yield();
+}
+
+void sendBLE(String msg) {
+    if (bleEnabled && deviceConnected && pTxCharacteristic) {
+        pTxCharacteristic->setValue(msg.c_str());
+        pTxCharacteristic->notify();
+        delay(10);
+    }
+}
+
+// ============================================================================
+// BLE TOGGLE (Power Saving)
+// ============================================================================
+
+void toggleBLE() {
+    if (bleEnabled) {
+        // Turn OFF BLE
+        if (deviceConnected) {
+            // Disconnect any connected device first
+            pServer->disconnect(pServer->getConnId());
+            delay(100);
+        }
+        BLEDevice::getAdvertising()->stop();
+        BLEDevice::deinit(false);  // false = don't release memory (faster reinit)
+        bleEnabled = false;
+        
+        Serial.println("[BLE] Disabled - Power saving mode");
+        lcdPrint("BLE: OFF", "Power saving");
+    } else {
+        // Turn ON BLE
+        bleInitPending = false;
+        BLEDevice::init(DEVICE_NAME);
+        pServer = BLEDevice::createServer();
+        pServer->setCallbacks(new ServerCallbacks());
+        
+        BLEService* pService = pServer->createService(SERVICE_UUID);
+        
+        pTxCharacteristic = pService->createCharacteristic(
+            CHARACTERISTIC_UUID_TX,
+            BLECharacteristic::PROPERTY_NOTIFY | BLECharacteristic::PROPERTY_READ
+        );
+        pTxCharacteristic->addDescriptor(new BLE2902());
+        
+        BLECharacteristic* pRxCharacteristic = pService->createCharacteristic(
+            CHARACTERISTIC_UUID_RX,
+            BLECharacteristic::PROPERTY_WRITE
+        );
+        pRxCharacteristic->setCallbacks(new RxCallbacks());
+        
+        pService->start();
+        BLEDevice::getAdvertising()->addServiceUUID(SERVICE_UUID);
+        BLEDevice::getAdvertising()->start();
+        
+        bleEnabled = true;
+        deviceConnected = false;
+        updateAdvertising();
+        
+        Serial.println("[BLE] Enabled - Advertising");
+        lcdPrint("BLE: ON", "Advertising...");
+    }
+    delay(1500);
+}
+
+// ============================================================================
+// LCD & BUTTON
+// ============================================================================
+
+void lcdPrint(String line1, String line2) {
+    if (!lcdOK) return;
+    lcd.clear();
+    lcd.setCursor(0, 0);
+    lcd.print(line1.substring(0, 16));
+    if (line2.length() > 0) {
+        lcd.setCursor(0, 1);
+        lcd.print(line2.substring(0, 16));
+    }
+}
+
+void updateLCD() {
+    if (!lcdOK || !lcdBacklightOn || isRecording) return;
+    
+    lcd.clear();
+    
+    switch (lcdPage % 4) {
+        case 0: {
+            lcd.setCursor(0, 0);
+            lcd.printf("Moths: %lu", detectionCount);
+            lcd.setCursor(0, 1);
+            if (rtcOK) {
+                DateTime now = rtc.now();
+                lcd.printf("%02d:%02d ", now.hour(), now.minute());
+            }
+            // Show BLE status
+            if (!bleEnabled) lcd.print("BLE:OFF");
+            else if (deviceConnected) lcd.print("BLE:CON");
+            else lcd.print("BLE:ON");
+            break;
+        }
+        case 1: {
+            lcd.setCursor(0, 0);
+            lcd.printf("Air: %.1fC", sensors.airTemp);
+            lcd.setCursor(0, 1);
+            lcd.printf("Humidity: %.0f%%", sensors.humidity);
+            break;
+        }
+        case 2: {
+            lcd.setCursor(0, 0);
+            lcd.printf("Soil: %.1fC", sensors.soilTemp);
+            lcd.setCursor(0, 1);
+            int pct = map(sensors.soilMoisture, 4095, 1000, 0, 100);
+            lcd.printf("Moist: %d%%", constrain(pct, 0, 100));
+            break;
+        }
+        case 3: {
+            lcd.setCursor(0, 0);
+            lcd.print("IR Beam:");
+            lcd.setCursor(0, 1);
+            lcd.print(digitalRead(IR_RECEIVER_PIN) ? "CLEAR" : "BLOCKED!");
+            break;
+        }
+    }
+}
+
+void handleButton() {
+    bool pressed = (digitalRead(BUTTON_PIN) == LOW);
+    
+    if (pressed && !buttonWasPressed) {
+        buttonPressTime = millis();
+        buttonWasPressed = true;
+        lastActivityMs = millis();
+    }
+    else if (!pressed && buttonWasPressed) {
+        unsigned long duration = millis() - buttonPressTime;
+        buttonWasPressed = false;
+        
+        if (duration < 1000) {
+            // Short press - toggle LCD backlight on/off
+            lcdBacklightOn = !lcdBacklightOn;
+            if (lcdBacklightOn) {
+                lcd.backlight();
+                updateLCD();
+                Serial.println("[BTN] LCD ON");
+            } else {
+                lcd.noBacklight();
+                Serial.println("[BTN] LCD OFF");
+            }
+        }
+        else if (duration >= 5000) {
+            // Long press (5+ seconds) - toggle BLE on/off
+            toggleBLE();
+        }
+    }
+    
+    // Show countdown feedback for long press
+    if (buttonWasPressed && lcdOK) {
+        unsigned long held = millis() - buttonPressTime;
+        if (held >= 2000 && held < 5000) {
+            int remaining = 5 - (held / 1000);
+            lcdPrint("Hold for BLE", "Toggle in " + String(remaining) + "s...");
+        }
+    }
+}
+
+void checkIRDetection() {
+    static bool lastIRState = true;
+    bool currentIRState = digitalRead(IR_RECEIVER_PIN);
+    
+    if (lastIRState && !currentIRState) {
+        unsigned long now = millis();
+        beamWindowBreaks++;  // Raw break rate for checkBeamHealth()
+        if (now - lastIRTime > cfg.irDebounceMs) {
+            irTriggered = true;
+            lastIRTime = now;
+        }
+    }
+    lastIRState = currentIRState;
+}
+
+// ============================================================================
+// POWER SAVING FUNCTIONS
+// ============================================================================
+
+bool isWithinActiveHours() {
+    if (!ENABLE_SCHEDULED_SLEEP) return true;  // Always active if disabled
+    if (!rtcOK) return true;  // Can't check without RTC
+    
+    DateTime now = rtc.now();
+    int untilChange;
+    if (ENABLE_SOLAR_SCHEDULE) return solarScheduleState(now, &untilChange);
+    
+    int currentHour = now.hour();
+    int startHour = cfg.activeStartHour;
+    int endHour = cfg.activeEndHour;
+    
+    if (startHour == endHour) return true;  // No gap between end and start - always on
+    
+    // Handle overnight schedule (e.g., 20:00 - 06:00)
+    if (startHour > endHour) {
+        // Overnight: active if hour >= start OR hour < end
+        return (currentHour >= startHour || currentHour < endHour);
+    } else {
+        // Same day: active if hour >= start AND hour < end
+        return (currentHour >= startHour && currentHour < endHour);
+    }
+}
+
+int getMinutesUntilActive() {
+    if (!rtcOK) return 60;  // Default 1 hour if no RTC
+    
+    DateTime now = rtc.now();
+    if (ENABLE_SOLAR_SCHEDULE) {
+        int untilChange;
+        if (solarScheduleState(now, &untilChange)) return 0;
+        return untilChange >= 0 ? untilChange : 24 * 60;  // No window soon (polar day) - check tomorrow
+    }
+    
+    int currentHour = now.hour();
+    int currentMin = now.minute();
+    
+    int startHour = cfg.activeStartHour;
+    int hoursUntilActive;
+    
+    if (currentHour < startHour) {
+        hoursUntilActive = startHour - currentHour;
+    } else {
+        hoursUntilActive = (24 - currentHour) + startHour;
+    }
+    
+    return (hoursUntilActive * 60) - currentMin;
+}
+
+int getMinutesUntilInactive() {
+    if (!rtcOK) return 60;  // Default 1 hour if no RTC
+    
+    DateTime now = rtc.now();
+    if (ENABLE_SOLAR_SCHEDULE) {
+        int untilChange;
+        if (!solarScheduleState(now, &untilChange)) return 0;
+        return untilChange;
+    }
+    
+    int hoursUntilEnd = ((int)cfg.activeEndHour - now.hour() + 24) % 24;
+    if (hoursUntilEnd == 0) hoursUntilEnd = 24;
+    
+    return (hoursUntilEnd * 60) - now.minute();
+}
+
+// ----------------------------------------------------------------------------
+// Solar schedule
+// ----------------------------------------------------------------------------
+
+// Sunrise / sunset for a date, in minutes after local midnight (NOAA
+// almanac algorithm, accurate to a minute or two). Polar night gives
+// rise=1440/set=0 so dusk-to-dawn windows cover the whole day; polar day
+// returns false (no night to be active in).
+bool sunTimes(int year, int month, int day, int* riseMin, int* setMin) {
+    const double rad = PI / 180.0;
+    static const int cumDays[] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+    int doy = cumDays[month - 1] + day;
+    if (month > 2 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) doy++;
+    
+    double lngHour = SITE_LONGITUDE / 15.0;
+    double cosZenith = cos(90.833 * rad);  // Refraction + solar disc
+    int result[2];
+    
+    for (int i = 0; i < 2; i++) {
+        bool rising = (i == 0);
+        double t = doy + ((rising ? 6.0 : 18.0) - lngHour) / 24.0;
+        double m = 0.9856 * t - 3.289;
+        double l = fmod(m + 1.916 * sin(m * rad) + 0.020 * sin(2 * m * rad) + 282.634 + 360.0, 360.0);
+        double ra = fmod(atan(0.91764 * tan(l * rad)) / rad + 360.0, 360.0);
+        ra += (floor(l / 90.0) - floor(ra / 90.0)) * 90.0;  // Same quadrant as L
+        ra /= 15.0;
+        
+        double sinDec = 0.39782 * sin(l * rad);
+        double cosDec = cos(asin(sinDec));
+        double cosH = (cosZenith - sinDec * sin(SITE_LATITUDE * rad)) / (cosDec * cos(SITE_LATITUDE * rad));
+        if (cosH < -1.0) return false;           // Sun never sets
+        if (cosH > 1.0) {                        // Sun never rises
+            *riseMin = 1440;
+            *setMin = 0;
+            return true;
+        }
+        
+        double h = (rising ? 360.0 - acos(cosH) / rad : acos(cosH) / rad) / 15.0;
+        double ut = fmod(h + ra - 0.06571 * t - 6.622 - lngHour + 48.0, 24.0);
+        int local = (int)lround(ut * 60.0) + SITE_UTC_OFFSET_MIN;
+        result[i] = ((local % 1440) + 1440) % 1440;
+    }
+    
+    *riseMin = result[0];
+    *setMin = result[1];
+    return true;
+}
+
+// Minutes after the day's midnight for an anchor + offset
+bool anchorMinutes(int anchor, int offset, DateTime day, int* minutes) {
+    if (anchor == SUN_CLOCK) {
+        *minutes = offset;
+        return true;
+    }
+    int rise, set;
+    if (!sunTimes(day.year(), day.month(), day.day(), &rise, &set)) return false;
+    *minutes = (anchor == SUN_RISE ? rise : set) + offset;
+    return true;
+}
+
+// Window `idx` as it opens on the day `dayOffset` days from today. Start/end
+// are minutes relative to today's midnight; an end at or before the start
+// (sunset -> sunrise) is taken from the following day.
+bool windowInstance(int idx, DateTime today, int dayOffset, long* start, long* end) {
+    const ActiveWindow& w = ACTIVE_WINDOWS[idx];
+    DateTime day = today + TimeSpan(dayOffset, 0, 0, 0);
+    int s, e;
+    if (!anchorMinutes(w.startAnchor, w.startOffset, day, &s)) return false;
+    if (!anchorMinutes(w.endAnchor, w.endOffset, day, &e)) return false;
+    if (e <= s && !anchorMinutes(w.endAnchor, w.endOffset, day + TimeSpan(1, 0, 0, 0), &e)) return false;
+    if (e <= s) e += 1440;
+    
+    *start = (long)dayOffset * 1440 + s;
+    *end = (long)dayOffset * 1440 + e;
+    return true;
+}
+
+// Window instances opening yesterday..two days ahead, for one calendar day.
+// The trig runs once per date, not on every loop() pass.
+struct SolarDay {
+    uint32_t date;                       // YYYYMMDD, 0 = not computed
+    int count;
+    long start[ACTIVE_WINDOW_COUNT * 4];
+    long end[ACTIVE_WINDOW_COUNT * 4];
+};
+SolarDay solarDay = { 0 };
+portMUX_TYPE solarMux = portMUX_INITIALIZER_UNLOCKED;  // Asked from loop() and BLE
+
+// Returns true if `now` is inside a window instance, with *untilChange =
+// minutes until it closes; otherwise *untilChange = minutes until the next
+// one opens (-1 if none found).
+bool solarScheduleState(DateTime now, int* untilChange) {
+    uint32_t date = (uint32_t)now.year() * 10000 + now.month() * 100 + now.day();
+    SolarDay day;
+    portENTER_CRITICAL(&solarMux);
+    day = solarDay;
+    portEXIT_CRITICAL(&solarMux);
+    
+    if (day.date != date) {
+        DateTime today(now.year(), now.month(), now.day());
+        day.date = date;
+        day.count = 0;
+        for (int i = 0; i < ACTIVE_WINDOW_COUNT; i++) {
+            for (int d = -1; d <= 2; d++) {
+                if (windowInstance(i, today, d, &day.start[day.count], &day.end[day.count])) day.count++;
+            }
+        }
+        portENTER_CRITICAL(&solarMux);
+        solarDay = day;
+        portEXIT_CRITICAL(&solarMux);
+    }
+    
+    long nowMin = now.hour() * 60 + now.minute();
+    long latestEnd = -1;
+    long nextStart = -1;
+    for (int i = 0; i < day.count; i++) {
+        long start = day.start[i], end = day.end[i];
+        if (start <= nowMin && nowMin < end) {
+            if (end > latestEnd) latestEnd = end;
+        } else if (start > nowMin && (nextStart < 0 || start < nextStart)) {
+            nextStart = start;
+        }
+    }
+    
+    if (latestEnd >= 0) {
+        *untilChange = latestEnd - nowMin;
+        return true;
+    }
+    *untilChange = nextStart >= 0 ? nextStart - nowMin : -1;
+    return false;
+}
+
+String hhmm(int minutes) {
+    char buf[6];
+    minutes = ((minutes % 1440) + 1440) % 1440;
+    sprintf(buf, "%02d:%02d", minutes / 60, minutes % 60);
+    return String(buf);
+}
+
+// Schedule for display: fixed hours, or today's solar windows
+String scheduleString() {
+    if (!ENABLE_SOLAR_SCHEDULE || !rtcOK) {
+        return hhmm(cfg.activeStartHour * 60) + "-" + hhmm(cfg.activeEndHour * 60);
+    }
+    
+    DateTime now = rtc.now();
+    DateTime today(now.year(), now.month(), now.day());
+    String s = "";
+    for (int i = 0; i < ACTIVE_WINDOW_COUNT; i++) {
+        long start, end;
+        if (!windowInstance(i, today, 0, &start, &end)) continue;
+        if (s.length() > 0) s += "+";
+        s += hhmm(start) + "-" + hhmm(end);
+    }
+    return s.length() > 0 ? s : "none";
+}
+
+// Clock time the trap will next become active
+String nextWakeString() {
+    if (!rtcOK) return hhmm(cfg.activeStartHour * 60);
+    DateTime now = rtc.now();
+    return hhmm(now.hour() * 60 + now.minute() + getMinutesUntilActive());
+}
+
+void prepareSleep() {
+    Serial.println("[POWER] Preparing for sleep...");
+    
+    // Maintenance stops at a step boundary - the rest resumes after the wake
+    maintPause();
+    
+    // Turn off IR LED
+    setIRLed(false);
+    Serial.println("[POWER] IR LED OFF");
+    
+    // Turn off LCD backlight
+    if (lcdOK) {
+        lcd.noBacklight();
+        lcd.clear();
+        lcdBacklightOn = false;
+    }
+    
+    // Disable BLE if enabled
+    if (bleEnabled) {
+        if (deviceConnected) {
+            pServer->disconnect(pServer->getConnId());
+            delay(100);
+        }
+        BLEDevice::getAdvertising()->stop();
+        BLEDevice::deinit(false);
+        bleEnabled = false;
+        Serial.println("[POWER] BLE disabled");
+    }
+    
+    // Deinit camera to save power
+    // The sensor stays powered in deep sleep - leave it in standby
+    if (cameraOK) {
+        cameraSetStandby(true);
+        esp_camera_deinit();
+        cameraStandby = false;
+        cameraOK = false;
+        Serial.println("[POWER] Camera disabled");
+    }
+    
+    // Disable microphone
+    if (mic_handle != NULL) {
+        bool locked = micLock(500);
+        acousticStop();
+        // Try to disable (may fail if not enabled - that's OK)
+        i2s_channel_disable(mic_handle);
+        // Delete the channel
+        i2s_del_channel(mic_handle);
+        mic_handle = NULL;
+        micOK = false;
+        if (locked) micUnlock();
+        Serial.println("[POWER] Microphone disabled");
+    }
+}
+
+void enterDeepSleep(int sleepMinutes) {
+    // Don't cut off a clip that's still being written
+    if (!finalizeDrain(FINALIZE_DRAIN_MS)) Serial.println("[POWER] Finalizer still busy - sleeping anyway");
+    
+    // Alarm must be armed while the I2C bus is still up
+    bool useAlarm = armWakeAlarm(sleepMinutes);
     
-    lcdPrint("MOTH DETECTED!", "Recording 10s...");
+    recordSleepStats();
+    saveRtcState();  // Before prepareSleep() clears BLE / camera state
+    prepareSleep();
     
-    readSensors();
+    // Calculate sleep time in microseconds
+    uint64_t sleepTimeUs = (uint64_t)sleepMinutes * 60ULL * 1000000ULL;
     
-    String datePath = getDatePath();
-    createDirectory(datePath);
+    if (useAlarm) {
+        // DS3231 alarm does the real wake - timer is only a backstop
+        sleepTimeUs = (uint64_t)(sleepMinutes + RTC_ALARM_BACKSTOP_MIN) * 60ULL * 1000000ULL;
+        Serial.printf("[POWER] Entering deep sleep until RTC alarm (%d minutes)\n", sleepMinutes);
+    } else {
+        // Limit to max ~71 minutes per sleep cycle (ESP32 limitation)
+        // For longer sleep, we'll wake up and check again
+        if (sleepMinutes > 60) {
+            sleepTimeUs = 60ULL * 60ULL * 1000000ULL;  // 60 minutes max
+        }
+        Serial.printf("[POWER] Entering deep sleep for %d minutes\n", min(sleepMinutes, 60));
+    }
+    Serial.println("[POWER] ═══════════════════════════════════════════");
+    Serial.flush();
     
-    String timestamp = getTimestamp();
-    currentVideoPath = datePath + "/vid_" + timestamp + ".avi";
-    currentAudioPath = datePath + "/aud_" + timestamp + ".wav";
+    // Configure wake-up source (timer)
+    esp_sleep_enable_timer_wakeup(sleepTimeUs);
     
-    Serial.printf("[REC] Video: %s\n", currentVideoPath.c_str());
-    Serial.printf("[REC] Audio: %s\n", currentAudioPath.c_str());
+    if (useAlarm) {
+        // Button and DS3231 INT share GPIO4 - either pulls it LOW
+        esp_sleep_enable_ext1_wakeup(1ULL << RTC_ALARM_PIN, ESP_EXT1_WAKEUP_ANY_LOW);
+    } else {
+        // Also allow button wake-up (GPIO4)
+        // Requires external 10kΩ pull-up resistor to 3.3V for reliability
+        esp_sleep_enable_ext0_wakeup(GPIO_NUM_4, 0);  // Wake on LOW (button pressed)
+    }
     
-    // Setup recording parameters
-    static RecordParams params;
-    params.videoPath = currentVideoPath;
-    params.audioPath = currentAudioPath;
-    params.durationMs = RECORDING_DURATION;
+    // Enter deep sleep
+    esp_deep_sleep_start();
+}
+
+// Program DS3231 alarm 1 to fire at the start of the next active window.
+// Returns false (caller falls back to timer chunks) if the RTC is unusable.
+bool armWakeAlarm(int sleepMinutes) {
+    if (!ENABLE_RTC_ALARM_WAKE || !rtcOK) return false;
     
-    // Reset completion flags
-    videoTaskDone = false;
-    audioTaskDone = false;
+    DateTime now = rtc.now();
+    DateTime target = now + TimeSpan((int32_t)sleepMinutes * 60);
+    DateTime alarmTime(target.year(), target.month(), target.day(), target.hour(), target.minute(), 0);
+    
+    rtc.disableAlarm(2);
+    rtc.clearAlarm(1);
+    rtc.clearAlarm(2);
+    rtc.writeSqwPinMode(DS3231_OFF);  // INT mode, not square wave
+    
+    // Match date + time so a stale alarm can never fire a day early.
+    // setAlarm1() also re-enables alarm 1 (initRTC() disabled it for the wake).
+    if (!rtc.setAlarm1(alarmTime, DS3231_A1_Date)) {
+        Serial.println("[POWER] RTC alarm set failed - using timer wake");
+        return false;
+    }
     
-    // Start both tasks on different cores
-    xTaskCreatePinnedToCore(videoRecordTask, "video", 16384, &params, 1, NULL, 0);
-    xTaskCreatePinnedToCore(audioRecordTask, "audio", 8192, &params, 1, NULL, 1);
+    Serial.printf("[POWER] RTC alarm set for %04d-%02d-%02d %02d:%02d\n",
+        alarmTime.year(), alarmTime.month(), alarmTime.day(), alarmTime.hour(), alarmTime.minute());
+    return true;
+}
+
+float wakeEnergyMah(uint32_t awakeMs) {
+    return (float)awakeMs / 3600000.0f * AWAKE_CURRENT_MA;
+}
+
+// Count this boot as a wake and roll the daily counters over at midnight
+void updateWakeStats() {
+    if (!rtcOK) return;
     
-    // Wait for both to complete
-    unsigned long waitStart = millis();
-    int lastSecond = -1;
+    DateTime now = rtc.now();
+    uint32_t today = (uint32_t)now.year() * 10000 + now.month() * 100 + now.day();
+    if (today != wakeStatsDay) {
+        if (wakeStatsDay != 0) {
+            spuriousWakesYesterday = spuriousWakesToday;
+            spuriousAwakeMsYesterday = spuriousAwakeMsToday;
+        }
+        wakeStatsDay = today;
+        wakesToday = 0;
+        spuriousWakesToday = 0;
+        spuriousAwakeMsToday = 0;
+        maintMahToday = 0;
+    }
     
-    while ((!videoTaskDone || !audioTaskDone) && (millis() - waitStart) < (RECORDING_DURATION + 5000)) {
-        int elapsed = (millis() - waitStart) / 1000;
-        if (elapsed != lastSecond) {
-            lastSecond = elapsed;
-            lcdPrint("Recording...", String(elapsed) + "s / 10s");
+    if (wakeupCause != ESP_SLEEP_WAKEUP_UNDEFINED) wakesToday++;
+}
+
+// Called right before deep sleep: charge this boot's awake time to the
+// spurious counters if it never reached active hours
+void recordSleepStats() {
+    if (wakeupCause == ESP_SLEEP_WAKEUP_UNDEFINED || bootSawActiveHours) return;
+    
+    spuriousWakesToday++;
+    spuriousAwakeMsToday += millis();
+    
+    Serial.printf("[POWER] Spurious wake: %lus awake, today %u wakes / %.2f mAh\n",
+        millis() / 1000, spuriousWakesToday, wakeEnergyMah(spuriousAwakeMsToday));
+}
+
+void wakeUp() {
+    // Check wake-up reason
+    esp_sleep_wakeup_cause_t wakeupReason = esp_sleep_get_wakeup_cause();
+    wakeupCause = wakeupReason;
+    
+    switch (wakeupReason) {
+        case ESP_SLEEP_WAKEUP_TIMER:
+            Serial.println("[POWER] Woke up from timer");
+            break;
+        case ESP_SLEEP_WAKEUP_EXT0:
+            Serial.println("[POWER] Woke up from button press");
+            break;
+        case ESP_SLEEP_WAKEUP_EXT1:
+            // Button or RTC alarm - told apart once the RTC is up
+            Serial.println("[POWER] Woke up from GPIO4 (button / RTC alarm)");
+            break;
+        case ESP_SLEEP_WAKEUP_ULP:
+            Serial.println("[POWER] Woke up from ULP beam monitor");
+            break;
+        default:
+            Serial.println("[POWER] Normal boot / reset");
+            break;
+    }
+    
+    // Re-enable IR LED
+    setIRLed(true);
+    
+    // Re-init will happen in setup()
+}
+
+void checkScheduleAndSleep() {
+    if (!ENABLE_SCHEDULED_SLEEP) return;
+    
+    // Grace period after startup to allow BLE connection
+    // (not after a fast wake - nobody is there to connect)
+    if (!fastWake && millis() < STARTUP_GRACE_PERIOD) return;
+    
+    // If outside active hours, go to sleep immediately (don't wait for interval)
+    // If inside active hours, check periodically if it's time to sleep
+    if (isWithinActiveHours()) {
+        bootSawActiveHours = true;
+        nightOpen();
+        // During active hours - check every minute if active hours have ended
+        if (millis() - lastSleepCheck < SLEEP_CHECK_INTERVAL) return;
+        lastSleepCheck = millis();
+        return;  // Still in active hours, nothing to do
+    }
+    
+    // Outside active hours - go to sleep now
+    int sleepMins = getMinutesUntilActive();
+    
+    // Use WAKE_CHECK_INTERVAL for the sleep timer (wake up to recheck)
+    // But cap at sleepMins if that's shorter
+    // With the RTC alarm there is nothing to recheck - sleep the whole way
+    int actualSleepMins = (ENABLE_RTC_ALARM_WAKE && rtcOK) ? sleepMins :
+        min(sleepMins, (int)(WAKE_CHECK_INTERVAL / 60000));
+    if (actualSleepMins < 1) actualSleepMins = 1;
+    
+    if (rtcOK) {
+        DateTime now = rtc.now();
+        Serial.printf("[POWER] Outside active hours (%s). Current: %02d:%02d\n",
+            scheduleString().c_str(), now.hour(), now.minute());
+    }
+    
+    // Don't sleep if recording or transferring
+    if (isRecording) {
+        Serial.println("[POWER] Recording in progress, delaying sleep");
+        return;
+    }
+    
+    if (transfer.state != IDLE) {
+        Serial.println("[POWER] Transfer in progress, delaying sleep");
+        return;
+    }
+    
+    // Don't sleep if BLE device is connected
+    if (deviceConnected) {
+        Serial.println("[POWER] BLE device connected, delaying sleep");
+        return;
+    }
+    
+    // Give queued maintenance a bounded daytime window before the long sleep
+    if (maintPending() && powerMode == POWER_FULL) {
+        if (maintSleepHoldMs == 0) {
+            maintSleepHoldMs = millis();
+            Serial.println("[POWER] Maintenance pending, delaying sleep");
+        }
+        if (millis() - maintSleepHoldMs < MAINT_SLEEP_HOLD_MS) return;
+    }
+    
+    // Night is over - write the summaries once, before the first sleep
+    logNightSummary();
+    if (bootSawActiveHours) logEnergy();
+    
+    // Show message on LCD before sleeping
+    if (lcdOK) {
+        lcdPrint("Sleeping...", "Wake at " + nextWakeString());
+        delay(2000);
+    }
+    
+    enterDeepSleep(actualSleepMins);
+}
+
+void setActiveMode(bool active) {
+    isActiveHours = active;
+    
+    if (active) {
+        // Turn ON monitoring
+        setIRLed(true);
+        Serial.println("[POWER] Active mode - IR LED ON");
+        
+        // Re-init camera if needed
+        if (!cameraOK) {
+            initCamera();
+            cameraIdle();
+        }
+        
+        // Re-init microphone if needed
+        if (!micOK && micLock(500)) {
+            initMicrophone();
+            micUnlock();
+        }
+        
+        if (lcdOK) {
+            lcd.backlight();
+            lcdBacklightOn = true;
+            lcdPrint("Active Mode", "Monitoring...");
+        }
+    } else {
+        // Turn OFF monitoring (but stay awake for BLE access)
+        setIRLed(false);
+        Serial.println("[POWER] Inactive mode - IR LED OFF");
+    }
+}
+
+// ============================================================================
+// ULP BEAM MONITOR (deep sleep detection)
+// ============================================================================
+
+// Variables shared with the ULP program (word offsets in RTC slow memory,
+// past the end of the program, inside the ULP reserved area)
+#define ULP_DATA_BASE     96
+#define ULP_VAR_COUNT     0      // Beam breaks seen
+#define ULP_VAR_LAST      1      // Previous receiver level (1 = clear)
+
+uint32_t ulpRead(int var) {
+#if ENABLE_ULP_BEAM_MONITOR
+    return RTC_SLOW_MEM[ULP_DATA_BASE + var] & 0xFFFF;  // ULP only writes the low 16 bits
+#else
+    return 0;
+#endif
+}
+
+// Load and start the ULP program. Call after prepareSleep() - the IR pins
+// are switched to RTC IO and driven by the ULP from here on.
+bool startUlpBeamMonitor(uint32_t wakeThreshold) {
+#if ENABLE_ULP_BEAM_MONITOR
+    gpio_num_t ledPin = (gpio_num_t)IR_LED_PIN;
+    gpio_num_t rxPin = (gpio_num_t)IR_RECEIVER_PIN;
+    int ledIo = rtc_io_number_get(ledPin);
+    int rxIo = rtc_io_number_get(rxPin);
+    
+    rtc_gpio_init(ledPin);
+    rtc_gpio_set_direction(ledPin, RTC_GPIO_MODE_OUTPUT_ONLY);
+    rtc_gpio_set_level(ledPin, 0);
+    rtc_gpio_init(rxPin);
+    rtc_gpio_set_direction(rxPin, RTC_GPIO_MODE_INPUT_ONLY);
+    rtc_gpio_pullup_en(rxPin);
+    
+    enum { L_DONE = 1 };
+    
+    // One sample per ULP timer period:
+    //   LED on, settle, read receiver, LED off, count clear->blocked edges,
+    //   wake the CPU once the count reaches the threshold
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, ULP_DATA_BASE),
+        I_WR_REG(RTC_GPIO_OUT_W1TS_REG, RTC_GPIO_OUT_DATA_W1TS_S + ledIo, RTC_GPIO_OUT_DATA_W1TS_S + ledIo, 1),
+        I_DELAY(ULP_SETTLE_CYCLES),
+        I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + rxIo, RTC_GPIO_IN_NEXT_S + rxIo),
+        I_WR_REG(RTC_GPIO_OUT_W1TC_REG, RTC_GPIO_OUT_DATA_W1TC_S + ledIo, RTC_GPIO_OUT_DATA_W1TC_S + ledIo, 1),
+        I_MOVR(R2, R0),                       // R2 = level now
+        I_LD(R1, R3, ULP_VAR_LAST),           // R1 = level last sample
+        I_ST(R2, R3, ULP_VAR_LAST),
+        I_MOVR(R0, R2),
+        M_BGE(L_DONE, 1),                     // Beam clear now - nothing to do
+        I_MOVR(R0, R1),
+        M_BL(L_DONE, 1),                      // Was already blocked - same break
+        I_LD(R0, R3, ULP_VAR_COUNT),
+        I_ADDI(R0, R0, 1),
+        I_ST(R0, R3, ULP_VAR_COUNT),
+        M_BL(L_DONE, wakeThreshold),          // Below threshold - keep sleeping
+        I_WAKE(),
+        M_LABEL(L_DONE),
+        I_HALT()
+    };
+    
+    RTC_SLOW_MEM[ULP_DATA_BASE + ULP_VAR_COUNT] = 0;
+    RTC_SLOW_MEM[ULP_DATA_BASE + ULP_VAR_LAST] = 1;
+    
+    size_t size = sizeof(program) / sizeof(ulp_insn_t);
+    if (ulp_process_macros_and_load(0, program, &size) != ESP_OK) {
+        Serial.println("[ULP] Program load failed");
+        return false;
+    }
+    
+    ulp_set_wakeup_period(0, ULP_SAMPLE_PERIOD_US);
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);  // Keep RTC IO powered
+    esp_sleep_enable_ulp_wakeup();
+    if (ulp_run(0) != ESP_OK) {
+        Serial.println("[ULP] Start failed");
+        return false;
+    }
+    
+    ulpArmed = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Stop the ULP and return the IR pins to the digital GPIO matrix
+void stopUlpBeamMonitor() {
+#if ENABLE_ULP_BEAM_MONITOR
+    if (!ulpArmed) return;
+    ulp_timer_stop();
+    rtc_gpio_deinit((gpio_num_t)IR_LED_PIN);
+    rtc_gpio_deinit((gpio_num_t)IR_RECEIVER_PIN);
+#endif
+}
+
+// Turn breaks counted in deep sleep into detections.csv rows. The break
+// that woke us gets a normal recording; the rest are logged count-only.
+void mergeUlpDetections() {
+    if (!ulpArmed) return;
+    ulpArmed = false;
+    
+    uint32_t breaks = ulpRead(ULP_VAR_COUNT);
+    ulpLastBatch = breaks;
+    if (breaks == 0) return;
+    
+    bool recordOne = ULP_RECORD_ON_WAKE && wakeupCause == ESP_SLEEP_WAKEUP_ULP && powerMode != POWER_COUNT_ONLY;
+    uint32_t countOnly = recordOne ? breaks - 1 : breaks;
+    
+    Serial.printf("[ULP] %lu beam breaks while asleep (%lu count-only)\n", breaks, countOnly);
+    for (uint32_t i = 0; i < countOnly; i++) countOnlyDetection();
+    
+    if (recordOne) irTriggered = true;  // Picked up by loop() once IR is armed
+}
+
+// During active hours, sleep with the ULP watching the beam once nothing
+// else needs the CPU. Wakes on a break, for the next env log, at the end
+// of active hours, or on the button.
+void checkBeamMonitorSleep() {
+    if (!ENABLE_ULP_BEAM_MONITOR || !ENABLE_SCHEDULED_SLEEP) return;
+    if (!isActiveHours || !isWithinActiveHours()) return;
+    if (isRecording || irTriggered || transfer.state != IDLE || deviceConnected) return;
+    if (finalizeBusy()) return;
+    if (!fastWake && millis() < STARTUP_GRACE_PERIOD) return;
+    if (millis() - lastActivityMs < ULP_IDLE_BEFORE_SLEEP_MS) return;
+    
+    // Next timed wake: env log due or end of active hours, whichever is first
+    uint64_t envDueMs = cfg.envLogIntervalMs - min((unsigned long)cfg.envLogIntervalMs, millis() - lastEnvLog);
+    uint64_t endMs = (uint64_t)getMinutesUntilInactive() * 60000ULL;
+    uint64_t sleepMs = min(envDueMs, endMs);
+    if (sleepMs < 1000) return;  // Something is due right now
+    
+    Serial.printf("[ULP] Idle - deep sleep with beam monitor for %llus\n", sleepMs / 1000);
+    Serial.flush();
+    
+    saveRtcState();
+    prepareSleep();
+    uint32_t threshold = (powerMode == POWER_COUNT_ONLY) ? ULP_COUNT_ONLY_BATCH : ULP_WAKE_THRESHOLD;
+    if (!startUlpBeamMonitor(threshold)) {
+        // Can't hand over - reboot into normal monitoring rather than sleep blind
+        ESP.restart();
+    }
+    
+    esp_sleep_enable_timer_wakeup(sleepMs * 1000ULL);
+    esp_sleep_enable_ext0_wakeup(GPIO_NUM_4, 0);  // Button only - initRTC() disabled the RTC alarm
+    esp_deep_sleep_start();
+}
+
+// ============================================================================
+// ACOUSTIC TRIGGER
+// ============================================================================
+
+// Serializes the mic between the listener, audioRecordTask and the code that
+// tears the channel down. No-op when the listener was never started.
+bool micLock(uint32_t timeoutMs) {
+    if (!micMutex) return true;
+    return xSemaphoreTake(micMutex, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+}
+
+void micUnlock() {
+    if (micMutex) xSemaphoreGive(micMutex);
+}
+
+// Switch the mic between the listener's low rate and the recording rate.
+// Call with micLock held.
+void acousticStart() {
+    i2s_pdm_rx_clk_config_t clk = I2S_PDM_RX_CLK_DEFAULT_CONFIG(ACOUSTIC_RATE);
+    if (i2s_channel_reconfig_pdm_rx_clock(mic_handle, &clk) != ESP_OK) return;
+    if (i2s_channel_enable(mic_handle) != ESP_OK) return;
+    acousticListening = true;
+    micActive = true;
+}
+
+void acousticStop() {
+    if (!acousticListening) return;
+    acousticListening = false;
+    micActive = false;
+    if (mic_handle == NULL) return;
+    i2s_channel_disable(mic_handle);
+    i2s_pdm_rx_clk_config_t clk = I2S_PDM_RX_CLK_DEFAULT_CONFIG(AUDIO_SAMPLE_RATE);
+    i2s_channel_reconfig_pdm_rx_clock(mic_handle, &clk);
+}
+
+bool acousticShouldListen() {
+    return micOK && mic_handle != NULL && isActiveHours && !isRecording && powerMode < POWER_COUNT_ONLY;
+}
+
+// Band-pass energy against a slowly tracking noise floor
+void acousticProcess(const int16_t* samples, int n) {
+    static float in[ACOUSTIC_BLOCK_SAMPLES], out[ACOUSTIC_BLOCK_SAMPLES];
+    static float dc = 0;
+    static int above = 0;
+    
+    for (int i = 0; i < n; i++) {
+        dc += (samples[i] - dc) * 0.001f;
+        in[i] = samples[i] - dc;
+    }
+    dsps_biquad_f32(in, out, n, acousticCoef, acousticState);
+    
+    float energy = 0;
+    for (int i = 0; i < n; i++) energy += out[i] * out[i];
+    float db = 10.0f * log10f(energy / n + 1.0f);
+    acousticLevelDb = db;
+    
+    if (acousticFloorDb == 0) acousticFloorDb = db;
+    if (db > acousticFloorDb + ACOUSTIC_TRIGGER_DB) {
+        above++;
+    } else {
+        above = 0;
+        acousticFloorDb += (db - acousticFloorDb) * ACOUSTIC_FLOOR_ALPHA;  // Only track quiet blocks
+    }
+    
+    unsigned long now = millis();
+    if (above == ACOUSTIC_HOLD_BLOCKS && now - acousticLastHitMs > ACOUSTIC_REFRACTORY_MS) {
+        acousticLastHitMs = now;
+        acousticHits++;
+        acousticPending = true;
+        if (ACOUSTIC_MODE == ACOUSTIC_MODE_TRIGGER) acousticTriggered = true;
+    }
+}
+
+// Listens on DMA blocks between recordings. i2s_channel_read blocks until a
+// block is ready, so the task costs nothing while the DMA fills.
+void acousticTask(void* param) {
+    int16_t* block = (int16_t*)malloc(ACOUSTIC_BLOCK_SAMPLES * sizeof(int16_t));
+    int64_t lastUs = esp_timer_get_time();
+    
+    while (block) {
+        if (!acousticShouldListen()) {
+            if (acousticListening && micLock(100)) {
+                acousticStop();
+                micUnlock();
+            }
+            vTaskDelay(pdMS_TO_TICKS(200));
+            lastUs = esp_timer_get_time();
+            continue;
+        }
+        
+        if (!micLock(0)) {  // Recording has the mic
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        size_t got = 0;
+        if (mic_handle != NULL && !acousticListening) acousticStart();
+        if (acousticListening) {
+            i2s_channel_read(mic_handle, block, ACOUSTIC_BLOCK_SAMPLES * sizeof(int16_t), &got, 100);
+        }
+        micUnlock();
+        
+        int64_t start = esp_timer_get_time();
+        acousticListenUs += start - lastUs;
+        if (got > 0) acousticProcess(block, got / sizeof(int16_t));
+        lastUs = esp_timer_get_time();
+        acousticCpuUs += lastUs - start;
+        
+        if (!acousticListening) vTaskDelay(pdMS_TO_TICKS(200));
+    }
+    vTaskDelete(NULL);
+}
+
+void startAcousticListener() {
+    if (!ENABLE_ACOUSTIC_TRIGGER || micMutex) return;
+    
+    micMutex = xSemaphoreCreateMutex();
+    dsps_biquad_gen_bpf_f32(acousticCoef, ACOUSTIC_BAND_HZ / ACOUSTIC_RATE, ACOUSTIC_BAND_Q);
+    xTaskCreatePinnedToCore(acousticTask, "acoustic", 4096, NULL, 1, NULL, 1);
+    Serial.printf("[ACOUSTIC] Listening at %d Hz, band %.0f Hz (%s)\n", ACOUSTIC_RATE, ACOUSTIC_BAND_HZ,
+        ACOUSTIC_MODE == ACOUSTIC_MODE_TRIGGER ? "trigger" : "corroborate");
+}
+
+// Hits that no IR break claimed within the agreement window
+void acousticExpireHits() {
+    if (acousticPending && millis() - acousticLastHitMs > ACOUSTIC_AGREE_MS) {
+        acousticPending = false;
+        acousticOnly++;
+    }
+}
+
+// Which channels saw the event triggered at triggerMs; updates the agreement
+// counters. The IR beam isn't polled while recording, so only breaks shortly
+// before an acoustic trigger count. Without the acoustic trigger there is no
+// audio side - the clip's wingbeat tone stays in its own columns.
+String triggerAgreement(bool fromAudio, unsigned long triggerMs) {
+    bool ir = !fromAudio || (lastIRTime != 0 && triggerMs - lastIRTime <= ACOUSTIC_AGREE_MS);
+    bool audio = ENABLE_ACOUSTIC_TRIGGER && (fromAudio ||
+        (acousticPending && triggerMs - acousticLastHitMs <= ACOUSTIC_AGREE_MS));
+    acousticPending = false;
+    
+    if (ir && audio) { agreeBoth++; return "ir+audio"; }
+    if (ir) { agreeIrOnly++; return "ir"; }
+    acousticOnly++;
+    return "audio";
+}
+
+// Extra energy of the listener over the IR-only baseline, this period
+float acousticOverheadMah() {
+    return (acousticListenUs / 3600e6f) * CURRENT_MIC_MA + (acousticCpuUs / 3600e6f) * CURRENT_CPU_ACTIVE_MA;
+}
+
+// ============================================================================
+// WINGBEAT ANALYSIS
+// ============================================================================
+
+// Streamed from audioRecordTask: samples are decimated to WINGBEAT_RATE,
+// and every WINGBEAT_FFT_SIZE samples (~0.5 s) a Hann-windowed FFT is added
+// to the clip's average spectrum and one band row is written to the summary.
+
+bool wingbeatBegin(String summaryPath) {
+    wbRunning = false;
+    wbHz = -1;
+    
+    if (!wbFft) {
+        wbFft = (float*)malloc(WINGBEAT_FFT_SIZE * 2 * sizeof(float));
+        wbWindow = (float*)malloc(WINGBEAT_FFT_SIZE * sizeof(float));
+        wbInput = (float*)malloc(WINGBEAT_FFT_SIZE * sizeof(float));
+        wbPower = (float*)malloc(WINGBEAT_FFT_SIZE / 2 * sizeof(float));
+        if (!wbFft || !wbWindow || !wbInput || !wbPower ||
+            dsps_fft2r_init_fc32(NULL, WINGBEAT_FFT_SIZE) != ESP_OK) {
+            Serial.println("[WING] FFT setup failed");
+            free(wbFft); free(wbWindow); free(wbInput); free(wbPower);
+            wbFft = wbWindow = wbInput = wbPower = NULL;
+            return false;
+        }
+        dsps_wind_hann_f32(wbWindow, WINGBEAT_FFT_SIZE);
+    }
+    
+    memset(wbPower, 0, WINGBEAT_FFT_SIZE / 2 * sizeof(float));
+    wbFill = 0;
+    wbWindows = 0;
+    wbDecimSum = 0;
+    wbDecimCount = 0;
+    wbUs = 0;
+    
+    String hdr = "t_s,peak_hz";
+    for (int b = 0; b < WINGBEAT_SUMMARY_BANDS; b++) hdr += ",b" + String((int)wingbeatBandEdge(b)) + "hz";
+    sdRun(SD_CLASS_LOG, [&]() {
+        wbSummary = SD_MMC.open(summaryPath, FILE_WRITE);
+        if (wbSummary) wbSummary.println(hdr);
+    });
+    wbRunning = true;
+    return true;
+}
+
+// Lower edge of summary band b - log spaced from WINGBEAT_MIN_HZ to Nyquist
+float wingbeatBandEdge(int b) {
+    float nyquist = WINGBEAT_RATE / 2.0f;
+    return WINGBEAT_MIN_HZ * powf(nyquist / WINGBEAT_MIN_HZ, (float)b / WINGBEAT_SUMMARY_BANDS);
+}
+
+void wingbeatFeed(const int16_t* samples, int count) {
+    if (!wbRunning) return;
+    int64_t start = esp_timer_get_time();
+    
+    // Box-filter decimation - wingbeat fundamentals sit far below the new Nyquist
+    for (int i = 0; i < count; i++) {
+        wbDecimSum += samples[i];
+        if (++wbDecimCount < WINGBEAT_DECIMATION) continue;
+        wbInput[wbFill++] = (float)wbDecimSum / WINGBEAT_DECIMATION;
+        wbDecimSum = 0;
+        wbDecimCount = 0;
+        if (wbFill == WINGBEAT_FFT_SIZE) {
+            wingbeatWindow();
+            wbFill = 0;
         }
-        delay(100);
+    }
+    wbUs += esp_timer_get_time() - start;
+}
+
+void wingbeatWindow() {
+    const int n = WINGBEAT_FFT_SIZE;
+    const float binHz = (float)WINGBEAT_RATE / n;
+    
+    // Remove the PDM mic's DC offset, window, FFT
+    float mean = 0;
+    for (int i = 0; i < n; i++) mean += wbInput[i];
+    mean /= n;
+    for (int i = 0; i < n; i++) {
+        wbFft[i * 2] = (wbInput[i] - mean) * wbWindow[i];
+        wbFft[i * 2 + 1] = 0;
+    }
+    dsps_fft2r_fc32(wbFft, n);
+    dsps_bit_rev_fc32(wbFft, n);
+    
+    // Accumulate power; per-window peak and band levels for the summary
+    float bands[WINGBEAT_SUMMARY_BANDS] = { 0 };
+    float peakPower = 0;
+    int peakBin = 0;
+    int band = 0;
+    int minBin = (int)(WINGBEAT_MIN_HZ / binHz);
+    
+    for (int k = 1; k < n / 2; k++) {
+        float p = wbFft[k * 2] * wbFft[k * 2] + wbFft[k * 2 + 1] * wbFft[k * 2 + 1];
+        wbPower[k] += p;
+        if (k < minBin) continue;
+        if (k * binHz <= WINGBEAT_MAX_HZ && p > peakPower) {
+            peakPower = p;
+            peakBin = k;
+        }
+        while (band + 1 < WINGBEAT_SUMMARY_BANDS && k * binHz >= wingbeatBandEdge(band + 1)) band++;
+        bands[band] += p;
     }
     
-    Serial.println("[REC] Recording complete!");
-    
-    // Log detection
-    logDetection(currentVideoPath, currentAudioPath);
-    
-    Serial.println("[REC] ════════════════════════════════════════");
-    
-    lcdPrint("Detection #" + String(detectionCount), "Saved!");
-    delay(2000);
-    
-    isRecording = false;
+    if (wbSummary) {
+        String row = String(wbWindows * n / (float)WINGBEAT_RATE, 2) + "," + String(peakBin * binHz, 1);
+        for (int b = 0; b < WINGBEAT_SUMMARY_BANDS; b++) row += "," + String(10.0f * log10f(bands[b] + 1.0f), 1);
+        sdRun(SD_CLASS_LOG, [&]() { wbSummary.println(row); });
+    }
+    wbWindows++;
 }
 
-void logDetection(String videoPath, String audioPath) {
-    if (!sdOK) return;
+// Features from the clip's average spectrum
+void wingbeatFinish() {
+    if (!wbRunning) return;
+    wbRunning = false;
+    if (wbSummary) sdRun(SD_CLASS_LOG, [&]() { wbSummary.close(); });
+    if (wbWindows == 0) return;
+    
+    const int half = WINGBEAT_FFT_SIZE / 2;
+    const float binHz = (float)WINGBEAT_RATE / WINGBEAT_FFT_SIZE;
+    int minBin = max(1, (int)(WINGBEAT_MIN_HZ / binHz));
+    int maxBin = min(half - 2, (int)(WINGBEAT_MAX_HZ / binHz));
+    
+    int peak = minBin;
+    for (int k = minBin; k <= maxBin; k++) {
+        if (wbPower[k] > wbPower[peak]) peak = k;
+    }
     
-    String logPath = "/logs/detections.csv";
-    bool newFile = !SD_MMC.exists(logPath);
+    // Parabolic interpolation between bins
+    float a = wbPower[peak - 1], b = wbPower[peak], c = wbPower[peak + 1];
+    float denom = a - 2 * b + c;
+    float offset = (denom != 0) ? 0.5f * (a - c) / denom : 0;
+    wbHz = (peak + offset) * binHz;
+    
+    // SNR against the median level of the search band
+    int span = maxBin - minBin + 1;
+    float* sorted = (float*)malloc(span * sizeof(float));
+    float noise = 0;
+    if (sorted) {
+        memcpy(sorted, &wbPower[minBin], span * sizeof(float));
+        std::nth_element(sorted, sorted + span / 2, sorted + span);
+        noise = sorted[span / 2];
+        free(sorted);
+    }
+    wbSnrDb = (noise > 0) ? 10.0f * log10f(b / noise) : 0;
+    
+    // Harmonics relative to the fundamental (best bin within +-2 of n*f)
+    for (int h = 2; h <= 3; h++) {
+        int center = (int)lroundf(h * wbHz / binHz);
+        float best = 0;
+        for (int k = center - 2; k <= center + 2; k++) {
+            if (k > 0 && k < half && wbPower[k] > best) best = wbPower[k];
+        }
+        float db = (best > 0 && b > 0) ? 10.0f * log10f(best / b) : -99;
+        if (h == 2) wbHarm2Db = db;
+        else wbHarm3Db = db;
+    }
     
-    File logFile = SD_MMC.open(logPath, FILE_APPEND);
-    if (logFile) {
-        if (newFile) {
-            logFile.println("timestamp,detection_num,air_temp,humidity,soil_temp,soil_moisture,video_file,audio_file");
+    Serial.printf("[WING] %.1f Hz, SNR %.1f dB, H2 %.1f dB, H3 %.1f dB (%d windows, %lu us)\n",
+        wbHz, wbSnrDb, wbHarm2Db, wbHarm3Db, wbWindows, (unsigned long)wbUs);
+}
+
+// ============================================================================
+// MOTION DETECTOR
+// ============================================================================
+
+// Frames are decoded at 1/8 scale straight to grayscale (40x30 from QVGA),
+// differenced against the previous frame, and scored as the permille of
+// pixels that changed. Two kernels give identical results: a scalar
+// reference and a SWAR version that handles four pixels per 32-bit word.
+// MOTION:BENCH checks one against the other and times both.
+
+static size_t motionJpgRead(void* arg, size_t index, uint8_t* buf, size_t len) {
+    MotionDecode* d = (MotionDecode*)arg;
+    if (buf) memcpy(buf, d->jpg + index, len);
+    return len;
+}
+
+// Decoder hands over RGB888 blocks
+static bool motionJpgWrite(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data) {
+    MotionDecode* d = (MotionDecode*)arg;
+    if (!data) return true;  // Start / end markers
+    
+    for (int row = 0; row < h; row++) {
+        int oy = y + row;
+        if (oy >= d->height) break;
+        for (int col = 0; col < w; col++) {
+            int ox = x + col;
+            if (ox >= d->width) break;
+            const uint8_t* p = &data[(row * w + col) * 3];
+            d->gray[oy * d->width + ox] = (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8;
         }
+    }
+    return true;
+}
+
+// Reference kernel: sum of |a-b| and the number of pixels with |a-b| > threshold
+uint32_t motionDiffScalar(const uint8_t* a, const uint8_t* b, int n, uint8_t threshold, uint32_t* changed) {
+    uint32_t sum = 0, count = 0;
+    for (int i = 0; i < n; i++) {
+        int d = abs((int)a[i] - (int)b[i]);
+        sum += d;
+        if (d > threshold) count++;
+    }
+    *changed = count;
+    return sum;
+}
+
+// SWAR kernel: four pixels per word. threshold must be below 127.
+uint32_t motionDiffSwar(const uint8_t* a, const uint8_t* b, int n, uint8_t threshold, uint32_t* changed) {
+    const uint32_t H = 0x80808080, L = 0x01010101;
+    const uint32_t tb = (uint32_t)(threshold + 1) * L;
+    uint32_t sum = 0, count = 0, lanes = 0;
+    int words = n / 4;
+    
+    for (int i = 0; i < words; i++) {
+        uint32_t x, y;
+        memcpy(&x, a + i * 4, 4);
+        memcpy(&y, b + i * 4, 4);
         
-        String row = sensors.timestamp + "," + String(detectionCount) + ",";
-        row += String(sensors.airTemp, 1) + "," + String(sensors.humidity, 1) + ",";
-        row += String(sensors.soilTemp, 1) + "," + String(sensors.soilMoisture) + ",";
-        row += videoPath + "," + audioPath;
+        // Per-byte x - y without carries between bytes, then the borrow per byte
+        uint32_t diff = ((x | H) - (y & ~H)) ^ ((x ^ ~y) & H);
+        uint32_t borrow = ((~x & y) | (~(x ^ y) & diff)) & H;
         
-        logFile.println(row);
-        logFile.close();
-        Serial.println("[LOG] Detection logged to CSV");
+        // |x - y|: negate the bytes that borrowed (they are never 0, so no carry out)
+        uint32_t neg = borrow >> 7;
+        uint32_t ad = (diff ^ (neg * 0xFF)) + neg;
+        
+        // Bytes >= threshold + 1 (tb bytes are below 0x80, so no borrow between bytes)
+        count += __builtin_popcount((((ad | H) - tb) | ad) & H);
+        
+        // Two 16-bit lanes; fold before they can overflow (510 per word)
+        lanes += (ad & 0x00FF00FF) + ((ad >> 8) & 0x00FF00FF);
+        if ((i & 127) == 127) {
+            sum += (lanes & 0xFFFF) + (lanes >> 16);
+            lanes = 0;
+        }
     }
+    sum += (lanes & 0xFFFF) + (lanes >> 16);
+    
+    uint32_t tail;
+    sum += motionDiffScalar(a + words * 4, b + words * 4, n - words * 4, threshold, &tail);
+    *changed = count + tail;
+    return sum;
 }
 
-void logEnvironment() {
-    if (!sdOK) return;
+void motionReset() {
+    motionHavePrev = false;
+    motionPeak = 0;
+}
+
+// Motion score (permille of pixels changed) for a frame against the previous one
+uint16_t motionScoreFrame(const uint8_t* jpg, size_t len, int width, int height) {
+    int64_t start = esp_timer_get_time();
+    int w = width / 8, h = height / 8;
+    
+    if (w * h > motionPixels) {
+        free(motionPrev);
+        free(motionCur);
+        motionPrev = (uint8_t*)malloc(w * h);
+        motionCur = (uint8_t*)malloc(w * h);
+        motionPixels = (motionPrev && motionCur) ? w * h : 0;
+        motionHavePrev = false;
+        if (!motionPixels) return 0;
+    }
     
-    // Read fresh sensor data
-    readSensors();
+    MotionDecode d = { jpg, motionCur, w, h };
+    if (esp_jpg_decode(len, JPG_SCALE_8X, motionJpgRead, motionJpgWrite, &d) != ESP_OK) {
+        motionLastRaw = 1000;
+        return 0;
+    }
+    int64_t decoded = esp_timer_get_time();
+    
+    uint16_t score = 0;
+    motionLastRaw = 1000;  // Unknown counts as changed
+    if (motionHavePrev) {
+        uint32_t changed;
+        motionDiffSwar(motionPrev, motionCur, w * h, MOTION_PIXEL_THRESHOLD, &changed);
+        score = changed * 1000 / (w * h);
+        motionLastRaw = score;
+        
+        // Most of the frame changing at once is exposure / IR flicker, not an insect
+        if (score > MOTION_GLOBAL_PERMILLE) score = 0;
+        
+        // Blob box of the changed pixels for the peak frame
+        if (score > motionPeak) {
+            motionPeak = score;
+            motionBlobBox(motionPrev, motionCur, w, h);
+        }
+    }
     
-    String logPath = "/logs/environment.csv";
-    bool newFile = !SD_MMC.exists(logPath);
+    uint8_t* t = motionPrev;
+    motionPrev = motionCur;
+    motionCur = t;
+    motionHavePrev = true;
     
-    File logFile = SD_MMC.open(logPath, FILE_APPEND);
-    if (logFile) {
-        if (newFile) {
-            logFile.println("timestamp,air_temp,humidity,soil_temp,soil_moisture");
+    motionDecodeUs += decoded - start;
+    motionKernelUs += esp_timer_get_time() - decoded;
+    motionFrames++;
+    return score;
+}
+
+// Bounding box of changed pixels, as a fraction of the frame
+void motionBlobBox(const uint8_t* a, const uint8_t* b, int w, int h) {
+    int x0 = w, y0 = h, x1 = -1, y1 = -1;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (abs((int)a[y * w + x] - (int)b[y * w + x]) <= MOTION_PIXEL_THRESHOLD) continue;
+            if (x < x0) x0 = x;
+            if (x > x1) x1 = x;
+            if (y < y0) y0 = y;
+            if (y > y1) y1 = y;
         }
-        
-        String row = sensors.timestamp + ",";
-        row += String(sensors.airTemp, 1) + "," + String(sensors.humidity, 1) + ",";
-        row += String(sensors.soilTemp, 1) + "," + String(sensors.soilMoisture);
-        
-        logFile.println(row);
-        logFile.close();
-        Serial.printf("[ENV] Logged: %.1f°C, %.1f%%, Soil: %.1f°C, %d\n",
-            sensors.airTemp, sensors.humidity, sensors.soilTemp, sensors.soilMoisture);
     }
+    motionBlobPermille = (x1 < 0) ? 0 : (x1 - x0 + 1) * (y1 - y0 + 1) * 1000 / (w * h);
+}
+
+// Frames to keep: up to MOTION_TAIL_FRAMES past the last frame with motion
+int motionTrimFrames(const uint16_t* scores, int frameCount) {
+    int last = -1;
+    for (int i = 0; i < frameCount; i++) {
+        if (scores[i] >= MOTION_CONFIRM_PERMILLE) last = i;
+    }
+    if (last < 0) return frameCount;  // No motion - leave the decision to the caller
+    return min(frameCount, max(last + 1 + MOTION_TAIL_FRAMES, MOTION_MIN_FRAMES));
+}
+
+// Frame just scored repeats the last one written: no changed pixels and a
+// JPEG size within ELIDE_SIZE_PCT. A run is capped so slow drift still shows.
+bool frameIsStill(uint32_t size, uint32_t lastWrittenSize, int run) {
+    if (!ENABLE_FRAME_ELISION || !ENABLE_MOTION_DETECTOR) return false;
+    if (lastWrittenSize == 0 || run >= ELIDE_MAX_RUN) return false;
+    if (motionLastRaw > ELIDE_MAX_PERMILLE) return false;
+    
+    uint32_t diff = size > lastWrittenSize ? size - lastWrittenSize : lastWrittenSize - size;
+    return diff * 100 <= lastWrittenSize * ELIDE_SIZE_PCT;
+}
+
+// Both kernels on random frames: results must match, times are per frame
+String motionBenchmark() {
+    const int n = 40 * 30;
+    const int rounds = 200;
+    uint8_t* a = (uint8_t*)malloc(n);
+    uint8_t* b = (uint8_t*)malloc(n);
+    if (!a || !b) {
+        free(a);
+        free(b);
+        return "ERROR:No memory";
+    }
+    
+    bool match = true;
+    int64_t scalarUs = 0, swarUs = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < n; i++) {
+            a[i] = random(256);
+            b[i] = (r & 1) ? a[i] + random(32) - 16 : random(256);
+        }
+        uint32_t c1, c2;
+        int64_t t0 = esp_timer_get_time();
+        uint32_t s1 = motionDiffScalar(a, b, n, MOTION_PIXEL_THRESHOLD, &c1);
+        int64_t t1 = esp_timer_get_time();
+        uint32_t s2 = motionDiffSwar(a, b, n, MOTION_PIXEL_THRESHOLD, &c2);
+        int64_t t2 = esp_timer_get_time();
+        scalarUs += t1 - t0;
+        swarUs += t2 - t1;
+        if (s1 != s2 || c1 != c2) match = false;
+    }
+    free(a);
+    free(b);
+    
+    return "MOTION:bench,pixels=" + String(n) + ",scalarUs=" + String((float)scalarUs / rounds, 1) +
+           ",swarUs=" + String((float)swarUs / rounds, 1) + ",match=" + String(match ? "YES" : "NO");
+}
+
+// MOTION:BENCH from loop() - the run is too long for the BLE callback
+void serviceMotionBench() {
+    if (!motionBenchPending || isRecording) return;
+    motionBenchPending = false;
+    sendBLE(motionBenchmark());
 }
 
 // ============================================================================
-// FILE TRANSFER
+// MOTH CLASSIFIER
 // ============================================================================
 
-void processTransfer() {
-    if (transfer.state != TRANSFERRING) return;
-    if (!bleEnabled || !deviceConnected) {
-        if (transfer.file) transfer.file.close();
-        transfer.state = IDLE;
-        return;
-    }
+// Model input from a JPEG frame: decode, grayscale, nearest-neighbour resize
+// to CLASSIFIER_INPUT_SIZE square, quantize with the input tensor's params.
+// tools/classifier_bench.py mirrors this step for step - keep them in sync.
+#if ENABLE_MOTH_CLASSIFIER
+uint8_t* classifierArena = NULL;
+tflite::MicroInterpreter* classifierInterp = NULL;
+
+bool initClassifier() {
+    if (classifierInterp) return true;
+    if (!psramFound()) return false;
     
-    if (millis() - transfer.lastChunkTime < CHUNK_DELAY_MS) return;
+    const tflite::Model* model = tflite::GetModel(moth_model_tflite);
+    if (model->version() != TFLITE_SCHEMA_VERSION) {
+        Serial.println("[CLASS] Model schema mismatch");
+        return false;
+    }
     
-    if (transfer.sentBytes >= transfer.totalSize) {
-        transfer.file.close();
-        sendBLE("FILE_END");
-        Serial.printf("[TRANSFER] Complete: %s\n", transfer.filename.c_str());
-        transfer.state = IDLE;
-        return;
+    // Ops used by the reference MobileNet-style model; extend if yours needs more
+    static tflite::MicroMutableOpResolver<8> resolver;
+    resolver.AddConv2D();
+    resolver.AddDepthwiseConv2D();
+    resolver.AddAveragePool2D();
+    resolver.AddMaxPool2D();
+    resolver.AddReshape();
+    resolver.AddFullyConnected();
+    resolver.AddSoftmax();
+    resolver.AddMean();
+    
+    classifierArena = (uint8_t*)ps_malloc(CLASSIFIER_ARENA_SIZE);
+    if (!classifierArena) return false;
+    
+    classifierInterp = new tflite::MicroInterpreter(model, resolver, classifierArena, CLASSIFIER_ARENA_SIZE);
+    TfLiteTensor* in = classifierInterp->input(0);
+    if (classifierInterp->AllocateTensors() != kTfLiteOk || in->type != kTfLiteInt8 ||
+        in->dims->size != 4 || in->dims->data[1] != CLASSIFIER_INPUT_SIZE ||
+        in->dims->data[2] != CLASSIFIER_INPUT_SIZE || in->dims->data[3] != 1) {
+        Serial.println("[CLASS] Model must take a 1x96x96x1 int8 input");
+        delete classifierInterp;
+        classifierInterp = NULL;
+        free(classifierArena);
+        classifierArena = NULL;
+        return false;
     }
     
-    uint8_t buffer[CHUNK_SIZE];
-    size_t toRead = min((size_t)CHUNK_SIZE, transfer.totalSize - transfer.sentBytes);
-    size_t bytesRead = transfer.file.read(buffer, toRead);
+    Serial.printf("[CLASS] Model ready (%u of %u arena bytes)\n",
+        (unsigned)classifierInterp->arena_used_bytes(), (unsigned)CLASSIFIER_ARENA_SIZE);
+    return true;
+}
+#endif
+
+// Moth probability for one JPEG frame (0..1), or -1 if it couldn't be scored
+float classifyJpeg(const uint8_t* jpg, size_t len, int width, int height) {
+#if ENABLE_MOTH_CLASSIFIER
+    if (!initClassifier()) return -1;
+    
+    uint8_t* bgr = (uint8_t*)ps_malloc(width * height * 3);
+    if (!bgr) return -1;
+    if (!fmt2rgb888(jpg, len, PIXFORMAT_JPEG, bgr)) {  // Output is B,G,R per pixel
+        free(bgr);
+        return -1;
+    }
     
-    if (bytesRead > 0) {
-        String chunk = "DATA:";
-        for (size_t i = 0; i < bytesRead; i++) {
-            char hex[3];
-            sprintf(hex, "%02X", buffer[i]);
-            chunk += hex;
-        }
-        
-        pTxCharacteristic->setValue(chunk.c_str());
-        pTxCharacteristic->notify();
-        
-        transfer.sentBytes += bytesRead;
-        transfer.lastChunkTime = millis();
-        
-        int percent = (transfer.sentBytes * 100) / transfer.totalSize;
-        static int lastPercent = 0;
-        if (percent / 10 > lastPercent / 10) {
-            Serial.printf("[TRANSFER] %d%%\n", percent);
-            lcdPrint("Sending...", String(percent) + "%");
-            lastPercent = percent;
+    TfLiteTensor* in = classifierInterp->input(0);
+    const int n = CLASSIFIER_INPUT_SIZE;
+    for (int y = 0; y < n; y++) {
+        int sy = y * height / n;
+        for (int x = 0; x < n; x++) {
+            const uint8_t* p = &bgr[(sy * width + x * width / n) * 3];
+            int gray = (p[2] * 77 + p[1] * 150 + p[0] * 29) >> 8;
+            int q = (int)lroundf(gray / 255.0f / in->params.scale) + in->params.zero_point;
+            in->data.int8[y * n + x] = (int8_t)constrain(q, -128, 127);
         }
     }
+    free(bgr);
     
-    yield();
+    if (classifierInterp->Invoke() != kTfLiteOk) return -1;
+    
+    // Two-class output: [other, moth]
+    TfLiteTensor* out = classifierInterp->output(0);
+    return (out->data.int8[1] - out->params.zero_point) * out->params.scale;
+#else
+    (void)jpg; (void)len; (void)width; (void)height;
+    return -1;
+#endif
 }
 
-void sendBLE(String msg) {
-    if (bleEnabled && deviceConnected && pTxCharacteristic) {
-        pTxCharacteristic->setValue(msg.c_str());
-        pTxCharacteristic->notify();
-        delay(10);
+// Score the first frames of a clip from its temp file. Runs after capture so
+// inference never stalls the frame rate.
+void classifyClip(File& frames, uint32_t* offsets, uint32_t* sizes, int frameCount, int width, int height) {
+    classifierScore = -1;
+    if (!ENABLE_MOTH_CLASSIFIER) return;
+    
+    float total = 0;
+    int scored = 0;
+    int64_t start = esp_timer_get_time();
+    int last = min(frameCount, CLASSIFIER_SKIP_FRAMES + CLASSIFIER_FRAMES);
+    
+    for (int i = CLASSIFIER_SKIP_FRAMES; i < last; i++) {
+        if (sizes[i] == 0) continue;  // Elided - same picture as the frame before
+        uint8_t* jpg = (uint8_t*)ps_malloc(sizes[i]);
+        if (!jpg) break;
+        size_t got = 0;
+        sdRun(SD_CLASS_BULK, [&]() {
+            frames.seek(offsets[i] + 8);  // Skip the "00dc" chunk header
+            got = frames.read(jpg, sizes[i]);
+        });
+        float score = (got == sizes[i]) ? classifyJpeg(jpg, got, width, height) : -1;
+        free(jpg);
+        if (score < 0) continue;
+        total += score;
+        scored++;
     }
+    
+    if (scored == 0) return;
+    classifierScore = total / scored;
+    classifierLastUs = (uint32_t)((esp_timer_get_time() - start) / scored);
+    Serial.printf("[CLASS] Moth score %.2f over %d frames (%lu ms/frame)\n",
+        classifierScore, scored, (unsigned long)(classifierLastUs / 1000));
 }
 
 // ============================================================================
-// BLE TOGGLE (Power Saving)
+// RUNTIME CONFIGURATION
 // ============================================================================
 
-void toggleBLE() {
-    if (bleEnabled) {
-        // Turn OFF BLE
-        if (deviceConnected) {
-            // Disconnect any connected device first
-            pServer->disconnect(pServer->getConnId());
-            delay(100);
-        }
-        BLEDevice::getAdvertising()->stop();
-        BLEDevice::deinit(false);  // false = don't release memory (faster reinit)
-        bleEnabled = false;
-        
-        Serial.println("[BLE] Disabled - Power saving mode");
-        lcdPrint("BLE: OFF", "Power saving");
-    } else {
-        // Turn ON BLE
-        BLEDevice::init(DEVICE_NAME);
-        pServer = BLEDevice::createServer();
-        pServer->setCallbacks(new ServerCallbacks());
-        
-        BLEService* pService = pServer->createService(SERVICE_UUID);
-        
-        pTxCharacteristic = pService->createCharacteristic(
-            CHARACTERISTIC_UUID_TX,
-            BLECharacteristic::PROPERTY_NOTIFY | BLECharacteristic::PROPERTY_READ
-        );
-        pTxCharacteristic->addDescriptor(new BLE2902());
-        
-        BLECharacteristic* pRxCharacteristic = pService->createCharacteristic(
-            CHARACTERISTIC_UUID_RX,
-            BLECharacteristic::PROPERTY_WRITE
-        );
-        pRxCharacteristic->setCallbacks(new RxCallbacks());
-        
-        pService->start();
-        BLEDevice::getAdvertising()->addServiceUUID(SERVICE_UUID);
-        BLEDevice::getAdvertising()->start();
-        
-        bleEnabled = true;
-        deviceConnected = false;
-        
-        Serial.println("[BLE] Enabled - Advertising");
-        lcdPrint("BLE: ON", "Advertising...");
+const ConfigField* findConfigField(String key) {
+    for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        if (key == CONFIG_FIELDS[i].key) return &CONFIG_FIELDS[i];
     }
-    delay(1500);
+    return NULL;
 }
 
-// ============================================================================
-// LCD & BUTTON
-// ============================================================================
+// Same field in another RuntimeConfig instance
+uint32_t* configFieldIn(RuntimeConfig* c, const ConfigField* f) {
+    return (uint32_t*)((uint8_t*)c + ((uint8_t*)f->value - (uint8_t*)&cfg));
+}
 
-void lcdPrint(String line1, String line2) {
-    if (!lcdOK) return;
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print(line1.substring(0, 16));
-    if (line2.length() > 0) {
-        lcd.setCursor(0, 1);
-        lcd.print(line2.substring(0, 16));
+// Stored config replaces the compiled-in defaults if its version matches.
+// Out-of-range values (e.g. after a limit was tightened) keep the default.
+void loadConfig() {
+    Preferences prefs;
+    if (!prefs.begin(CONFIG_NVS_NAMESPACE, true)) return;  // Nothing saved yet
+    
+    RuntimeConfig stored;
+    size_t len = prefs.getBytes("cfg", &stored, sizeof(stored));
+    prefs.end();
+    
+    if (len != sizeof(stored) || stored.version != RUNTIME_CONFIG_VERSION || stored.size != sizeof(stored)) {
+        if (len > 0) Serial.println("[CONFIG] Stored config is from another version - using defaults");
+        return;
+    }
+    
+    for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        const ConfigField* f = &CONFIG_FIELDS[i];
+        uint32_t v = *configFieldIn(&stored, f);
+        if (v >= f->minVal && v <= f->maxVal) *f->value = v;
+        else Serial.printf("[CONFIG] %s=%lu out of range - keeping default\n", f->key, (unsigned long)v);
     }
+    Serial.println("[CONFIG] Loaded from NVS");
 }
 
-void updateLCD() {
-    if (!lcdOK || !lcdBacklightOn || isRecording) return;
-    
-    lcd.clear();
-    
-    switch (lcdPage % 4) {
-        case 0: {
-            lcd.setCursor(0, 0);
-            lcd.printf("Moths: %lu", detectionCount);
-            lcd.setCursor(0, 1);
-            if (rtcOK) {
-                DateTime now = rtc.now();
-                lcd.printf("%02d:%02d ", now.hour(), now.minute());
-            }
-            // Show BLE status
-            if (!bleEnabled) lcd.print("BLE:OFF");
-            else if (deviceConnected) lcd.print("BLE:CON");
-            else lcd.print("BLE:ON");
-            break;
-        }
-        case 1: {
-            lcd.setCursor(0, 0);
-            lcd.printf("Air: %.1fC", sensors.airTemp);
-            lcd.setCursor(0, 1);
-            lcd.printf("Humidity: %.0f%%", sensors.humidity);
-            break;
-        }
-        case 2: {
-            lcd.setCursor(0, 0);
-            lcd.printf("Soil: %.1fC", sensors.soilTemp);
-            lcd.setCursor(0, 1);
-            int pct = map(sensors.soilMoisture, 4095, 1000, 0, 100);
-            lcd.printf("Moist: %d%%", constrain(pct, 0, 100));
-            break;
-        }
-        case 3: {
-            lcd.setCursor(0, 0);
-            lcd.print("IR Beam:");
-            lcd.setCursor(0, 1);
-            lcd.print(digitalRead(IR_RECEIVER_PIN) ? "CLEAR" : "BLOCKED!");
-            break;
-        }
+bool saveConfig() {
+    Preferences prefs;
+    if (!prefs.begin(CONFIG_NVS_NAMESPACE, false)) return false;
+    size_t written = prefs.putBytes("cfg", &cfg, sizeof(cfg));
+    prefs.end();
+    return written == sizeof(cfg);
+}
+
+// Push a changed value to anything that cached it. Everything else reads
+// cfg directly and picks the change up on its next pass.
+void applyConfigChange(const ConfigField* f) {
+    if (f->value == &cfg.jpegQuality && cameraOK) {
+        sensor_t* s = esp_camera_sensor_get();
+        if (s && s->set_quality) s->set_quality(s, cfg.jpegQuality);
+    }
+    if (f->value == &cfg.activeStartHour || f->value == &cfg.activeEndHour) {
+        lastSleepCheck = 0;  // Re-check the schedule now
     }
 }
 
-void handleButton() {
-    bool pressed = (digitalRead(BUTTON_PIN) == LOW);
+// CFG:LIST | CFG:GET:key | CFG:SET:key=value | CFG:SAVE | CFG:DEFAULTS
+// Shared by BLE and the serial console; returns the reply line.
+String cmdConfig(String args) {
+    if (args == "LIST") {
+        String s = "CFG:v=" + String(RUNTIME_CONFIG_VERSION);
+        for (int i = 0; i < CONFIG_FIELD_COUNT; i++) {
+            s += "," + String(CONFIG_FIELDS[i].key) + "=" + String(*CONFIG_FIELDS[i].value);
+        }
+        return s;
+    }
     
-    if (pressed && !buttonWasPressed) {
-        buttonPressTime = millis();
-        buttonWasPressed = true;
+    if (args.startsWith("GET:")) {
+        const ConfigField* f = findConfigField(args.substring(4));
+        if (!f) return "ERROR:Unknown key " + args.substring(4);
+        return "CFG:" + String(f->key) + "=" + String(*f->value) +
+               ",min=" + String(f->minVal) + ",max=" + String(f->maxVal);
     }
-    else if (!pressed && buttonWasPressed) {
-        unsigned long duration = millis() - buttonPressTime;
-        buttonWasPressed = false;
-        
-        if (duration < 1000) {
-            // Short press - toggle LCD backlight on/off
-            lcdBacklightOn = !lcdBacklightOn;
-            if (lcdBacklightOn) {
-                lcd.backlight();
-                updateLCD();
-                Serial.println("[BTN] LCD ON");
-            } else {
-                lcd.noBacklight();
-                Serial.println("[BTN] LCD OFF");
-            }
-        }
-        else if (duration >= 5000) {
-            // Long press (5+ seconds) - toggle BLE on/off
-            toggleBLE();
+    
+    if (args.startsWith("SET:")) {
+        int eq = args.indexOf('=');
+        if (eq < 0) return "ERROR:Use CFG:SET:key=value";
+        String key = args.substring(4, eq);
+        String val = args.substring(eq + 1);
+        const ConfigField* f = findConfigField(key);
+        if (!f) return "ERROR:Unknown key " + key;
+        
+        char* end;
+        unsigned long v = strtoul(val.c_str(), &end, 10);
+        if (val.length() == 0 || *end != '\0' || v < f->minVal || v > f->maxVal) {
+            return "ERROR:" + key + " must be " + String(f->minVal) + ".." + String(f->maxVal);
         }
+        
+        *f->value = v;
+        applyConfigChange(f);
+        Serial.printf("[CONFIG] %s=%lu\n", f->key, v);
+        return "CFG:OK," + key + "=" + String(*f->value);
     }
     
-    // Show countdown feedback for long press
-    if (buttonWasPressed && lcdOK) {
-        unsigned long held = millis() - buttonPressTime;
-        if (held >= 2000 && held < 5000) {
-            int remaining = 5 - (held / 1000);
-            lcdPrint("Hold for BLE", "Toggle in " + String(remaining) + "s...");
-        }
+    if (args == "SAVE") {
+        return saveConfig() ? "CFG:SAVED" : "ERROR:NVS write failed";
+    }
+    
+    if (args == "DEFAULTS") {
+        cfg = CONFIG_DEFAULTS;
+        for (int i = 0; i < CONFIG_FIELD_COUNT; i++) applyConfigChange(&CONFIG_FIELDS[i]);
+        return "CFG:DEFAULTS (CFG:SAVE to keep)";
     }
+    
+    return "ERROR:Use CFG:LIST|GET:key|SET:key=value|SAVE|DEFAULTS";
 }
 
-void checkIRDetection() {
-    static bool lastIRState = true;
-    bool currentIRState = digitalRead(IR_RECEIVER_PIN);
-    
-    if (lastIRState && !currentIRState) {
-        unsigned long now = millis();
-        if (now - lastIRTime > IR_DEBOUNCE_MS) {
-            irTriggered = true;
-            lastIRTime = now;
+// Serial console - CFG: commands only. A USB cable is physical access, so no auth.
+void checkSerialCommands() {
+    static String line = "";
+    
+    while (Serial.available()) {
+        char c = Serial.read();
+        if (c != '\n' && c != '\r') {
+            if (line.length() < 128) line += c;
+            continue;
         }
+        
+        line.trim();
+        if (line.startsWith("CFG:")) Serial.println(cmdConfig(line.substring(4)));
+        else if (line.length() > 0) Serial.println("UNKNOWN:" + line);
+        line = "";
     }
-    lastIRState = currentIRState;
 }
 
 // ============================================================================
-// POWER SAVING FUNCTIONS
+// BATTERY MONITORING & DEGRADATION
 // ============================================================================
 
-bool isWithinActiveHours() {
-    if (!ENABLE_SCHEDULED_SLEEP) return true;  // Always active if disabled
-    if (!rtcOK) return true;  // Can't check without RTC
-    
-    DateTime now = rtc.now();
-    int currentHour = now.hour();
-    
-    // Handle overnight schedule (e.g., 20:00 - 06:00)
-    if (ACTIVE_START_HOUR > ACTIVE_END_HOUR) {
-        // Overnight: active if hour >= start OR hour < end
-        return (currentHour >= ACTIVE_START_HOUR || currentHour < ACTIVE_END_HOUR);
-    } else {
-        // Same day: active if hour >= start AND hour < end
-        return (currentHour >= ACTIVE_START_HOUR && currentHour < ACTIVE_END_HOUR);
+const char* powerModeName(PowerMode mode) {
+    switch (mode) {
+        case POWER_FULL: return "full";
+        case POWER_REDUCED: return "reduced";
+        case POWER_AUDIO_ONLY: return "audio";
+        default: return "count";
     }
 }
 
-int getMinutesUntilActive() {
-    if (!rtcOK) return 60;  // Default 1 hour if no RTC
-    
-    DateTime now = rtc.now();
-    int currentHour = now.hour();
-    int currentMin = now.minute();
-    
-    int hoursUntilActive;
-    
-    if (currentHour < ACTIVE_START_HOUR) {
-        hoursUntilActive = ACTIVE_START_HOUR - currentHour;
-    } else {
-        hoursUntilActive = (24 - currentHour) + ACTIVE_START_HOUR;
+// Battery mV from the simulated source or the ADC divider (0 = unknown)
+uint32_t readBatteryMv() {
+    if (batterySimMv > 0) return batterySimMv;
+    if (BATTERY_ADC_PIN < 0) return 0;
+    
+    uint32_t sum = 0;
+    for (int i = 0; i < 8; i++) sum += analogReadMilliVolts(BATTERY_ADC_PIN);
+    return (uint32_t)(sum / 8 * BATTERY_DIVIDER_RATIO);
+}
+
+// Single-cell LiPo resting voltage -> state of charge
+int batteryPercent(uint32_t mv) {
+    static const uint16_t curveMv[] = { 3300, 3500, 3600, 3700, 3750, 3800, 3900, 4000, 4100, 4200 };
+    static const uint8_t curvePct[] = {    0,    5,   10,   20,   30,   40,   60,   75,   90,  100 };
+    const int n = sizeof(curveMv) / sizeof(curveMv[0]);
+    
+    if (mv <= curveMv[0]) return 0;
+    for (int i = 1; i < n; i++) {
+        if (mv < curveMv[i]) {
+            return curvePct[i - 1] + (int)(mv - curveMv[i - 1]) * (curvePct[i] - curvePct[i - 1]) / (curveMv[i] - curveMv[i - 1]);
+        }
     }
-    
-    return (hoursUntilActive * 60) - currentMin;
+    return 100;
 }
 
-void prepareSleep() {
-    Serial.println("[POWER] Preparing for sleep...");
-    
-    // Turn off IR LED
-    digitalWrite(IR_LED_PIN, LOW);
-    Serial.println("[POWER] IR LED OFF");
-    
-    // Turn off LCD backlight
-    if (lcdOK) {
-        lcd.noBacklight();
-        lcd.clear();
-        lcdBacklightOn = false;
+// Mode for a voltage. Steps down at each threshold but only steps back up
+// after recovering BATTERY_HYSTERESIS_MV above it, so a sagging cell under
+// recording load doesn't flap between modes.
+int powerModeFor(uint32_t mv, int current) {
+    if (mv == 0) return POWER_FULL;
+    
+    static const uint32_t thresholds[] = { BATTERY_REDUCED_MV, BATTERY_AUDIO_ONLY_MV, BATTERY_COUNT_ONLY_MV };
+    int mode = POWER_FULL;
+    for (int i = 0; i < 3; i++) {
+        uint32_t t = thresholds[i];
+        if (current > i) t += BATTERY_HYSTERESIS_MV;  // Already below this step
+        if (mv < t) mode = i + 1;
     }
-    
-    // Disable BLE if enabled
-    if (bleEnabled) {
-        if (deviceConnected) {
-            pServer->disconnect(pServer->getConnId());
-            delay(100);
-        }
-        BLEDevice::getAdvertising()->stop();
-        BLEDevice::deinit(false);
-        bleEnabled = false;
-        Serial.println("[POWER] BLE disabled");
+    return mode;
+}
+
+void checkBattery(bool force) {
+    bool simulated = batterySimPending;
+    if (!force && !simulated && lastBatteryCheck != 0 && millis() - lastBatteryCheck < BATTERY_CHECK_INTERVAL_MS) return;
+    if (isRecording) return;
+    lastBatteryCheck = millis();
+    batterySimPending = false;
+    
+    batteryMv = readBatteryMv();
+    int mode = powerModeFor(batteryMv, powerMode);
+    if (mode != powerMode) applyPowerMode(mode);
+    if (simulated) sendBLE("BATSIM:OK,mv=" + String(batteryMv) + ",mode=" + String(powerModeName(powerMode)));
+}
+
+// The boot brings everything up, so shed what the mode restored from RTC
+// memory keeps off. Judged against the restored mode, so a cell that sagged
+// below a threshold before sleep still needs the hysteresis to step back up.
+void restorePowerMode() {
+    if (!stateRestored) return;
+    batteryMv = readBatteryMv();
+    int mode = powerModeFor(batteryMv, powerMode);
+    powerMode = POWER_FULL;
+    if (mode != POWER_FULL) applyPowerMode(mode);
+}
+
+void applyPowerMode(int mode) {
+    PowerMode old = powerMode;
+    powerMode = (PowerMode)mode;
+    Serial.printf("[BATTERY] %lu mV - mode %s -> %s\n", (unsigned long)batteryMv, powerModeName(old), powerModeName(powerMode));
+    
+    // Video resolution
+    if (cameraOK && powerMode <= POWER_REDUCED && psramFound()) {
+        sensor_t* s = esp_camera_sensor_get();
+        if (s && s->set_framesize) s->set_framesize(s, powerMode == POWER_REDUCED ? FRAMESIZE_QQVGA : FRAMESIZE_QVGA);
     }
     
-    // Deinit camera to save power
-    if (cameraOK) {
+    // Camera off from audio-only down; cameraWake() brings it back once allowed
+    if (powerMode >= POWER_AUDIO_ONLY && cameraOK) {
+        cameraSetStandby(true);
         esp_camera_deinit();
         cameraOK = false;
-        Serial.println("[POWER] Camera disabled");
+        cameraStandby = false;
+        cameraInitPending = true;
     }
     
-    // Disable microphone
-    if (mic_handle != NULL) {
-        // Try to disable (may fail if not enabled - that's OK)
-        i2s_channel_disable(mic_handle);
-        // Delete the channel
-        i2s_del_channel(mic_handle);
-        mic_handle = NULL;
-        micOK = false;
-        Serial.println("[POWER] Microphone disabled");
+    // Count-only: shed mic and LCD, keep BLE advertising so the trap can be found
+    if (powerMode == POWER_COUNT_ONLY) {
+        if (mic_handle != NULL && micLock(500)) {
+            acousticStop();
+            if (micActive) i2s_channel_disable(mic_handle);
+            i2s_del_channel(mic_handle);
+            mic_handle = NULL;
+            micOK = false;
+            micUnlock();
+        }
+        if (lcdOK && lcdBacklightOn) {
+            lcd.noBacklight();
+            lcdBacklightOn = false;
+        }
+    } else if (old == POWER_COUNT_ONLY && !micOK && micLock(500)) {
+        initMicrophone();
+        micUnlock();
     }
 }
 
-void enterDeepSleep(int sleepMinutes) {
-    prepareSleep();
-    
-    // Calculate sleep time in microseconds
-    uint64_t sleepTimeUs = (uint64_t)sleepMinutes * 60ULL * 1000000ULL;
-    
-    // Limit to max ~71 minutes per sleep cycle (ESP32 limitation)
-    // For longer sleep, we'll wake up and check again
-    if (sleepMinutes > 60) {
-        sleepTimeUs = 60ULL * 60ULL * 1000000ULL;  // 60 minutes max
+// ============================================================================
+// RECORDING STORM PROTECTION
+// ============================================================================
+
+const char* beamHealthName(BeamHealth h) {
+    switch (h) {
+        case BEAM_OK: return "ok";
+        case BEAM_STUCK: return "stuck";
+        default: return "oscillating";
     }
-    
-    Serial.printf("[POWER] Entering deep sleep for %d minutes\n", min(sleepMinutes, 60));
-    Serial.println("[POWER] ═══════════════════════════════════════════");
-    Serial.flush();
-    
-    // Configure wake-up source (timer)
-    esp_sleep_enable_timer_wakeup(sleepTimeUs);
-    
-    // Also allow button wake-up (GPIO4)
-    // Requires external 10kΩ pull-up resistor to 3.3V for reliability
-    esp_sleep_enable_ext0_wakeup(GPIO_NUM_4, 0);  // Wake on LOW (button pressed)
-    
-    // Enter deep sleep
-    esp_deep_sleep_start();
 }
 
-void wakeUp() {
-    // Check wake-up reason
-    esp_sleep_wakeup_cause_t wakeupReason = esp_sleep_get_wakeup_cause();
+// Top the bucket up for the time since the last refill
+void stormRefill() {
+    unsigned long now = millis();
+    stormTokens += (float)(now - stormRefillMs) / STORM_REFILL_MS;
+    if (stormTokens > STORM_BURST) stormTokens = STORM_BURST;
+    stormRefillMs = now;
+}
+
+// Append a suppression / health transition to health.csv
+void logHealthEvent(const char* event, String detail) {
+    Serial.printf("[STORM] %s %s\n", event, detail.c_str());
+    if (!sdOK) return;
     
-    switch (wakeupReason) {
-        case ESP_SLEEP_WAKEUP_TIMER:
-            Serial.println("[POWER] Woke up from timer");
-            break;
-        case ESP_SLEEP_WAKEUP_EXT0:
-            Serial.println("[POWER] Woke up from button press");
-            break;
-        default:
-            Serial.println("[POWER] Normal boot / reset");
-            break;
+    String row = getTimestamp() + "," + event + "," + detail + ",";
+    row += String(detectionCount) + "," + String(stormSuppressed);
+    sdAppendLine("/logs/health.csv", "timestamp,event,detail,detections,suppressed", row);
+}
+
+// Reason this detection gets no clip, or NULL to record it (takes a token).
+// Only the start and end of a run of suppressions are logged.
+const char* recordingSuppressed() {
+    if (!ENABLE_STORM_PROTECTION) return NULL;
+    
+    if (beamHealth != BEAM_OK) return beamHealthName(beamHealth);
+    
+    stormRefill();
+    if (stormTokens < 1.0f) {
+        if (!stormLimited) {
+            stormLimited = true;
+            stormRunStart = stormSuppressed;
+            logHealthEvent("rate_limited", String(STORM_BURST) + " clips/" + String(STORM_REFILL_MS / 60000) + "min");
+        }
+        return "rate";
     }
     
-    // Re-enable IR LED
-    digitalWrite(IR_LED_PIN, HIGH);
-    
-    // Re-init will happen in setup()
+    stormTokens -= 1.0f;
+    if (stormLimited) {
+        stormLimited = false;
+        logHealthEvent("rate_resumed", String(stormSuppressed - stormRunStart) + " counted without clip");
+    }
+    return NULL;
 }
 
-void checkScheduleAndSleep() {
-    if (!ENABLE_SCHEDULED_SLEEP) return;
-    
-    // Grace period after startup to allow BLE connection
-    if (millis() < STARTUP_GRACE_PERIOD) return;
-    
-    // If outside active hours, go to sleep immediately (don't wait for interval)
-    // If inside active hours, check periodically if it's time to sleep
-    if (isWithinActiveHours()) {
-        // During active hours - check every minute if active hours have ended
-        if (millis() - lastSleepCheck < SLEEP_CHECK_INTERVAL) return;
-        lastSleepCheck = millis();
-        return;  // Still in active hours, nothing to do
+// Watch the beam for faults that would otherwise become a recording storm.
+// Stuck: blocked for BEAM_STUCK_MS. Oscillating: break rate at or above
+// BEAM_OSC_BREAKS_MIN. Both clear by themselves once the beam behaves.
+void checkBeamHealth() {
+    if (!ENABLE_STORM_PROTECTION) return;
+    
+    unsigned long now = millis();
+    bool blocked = digitalRead(IR_RECEIVER_PIN) == LOW;
+    if (blocked) {
+        if (beamBlockedSinceMs == 0) beamBlockedSinceMs = now ? now : 1;
+        beamClearSinceMs = 0;
+    } else {
+        if (beamClearSinceMs == 0) beamClearSinceMs = now ? now : 1;
+        beamBlockedSinceMs = 0;
     }
     
-    // Outside active hours - go to sleep now
-    int sleepMins = getMinutesUntilActive();
-    
-    // Use WAKE_CHECK_INTERVAL for the sleep timer (wake up to recheck)
-    // But cap at sleepMins if that's shorter
-    int actualSleepMins = min(sleepMins, (int)(WAKE_CHECK_INTERVAL / 60000));
-    if (actualSleepMins < 1) actualSleepMins = 1;
-    
-    if (rtcOK) {
-        DateTime now = rtc.now();
-        Serial.printf("[POWER] Outside active hours (%02d:00-%02d:00). Current: %02d:%02d\n",
-            ACTIVE_START_HOUR, ACTIVE_END_HOUR, now.hour(), now.minute());
+    // Break rate over whole windows. The loop is blocked while recording, so
+    // windows stretch - scale to breaks per minute rather than count.
+    unsigned long windowMs = now - beamWindowStartMs;
+    if (windowMs >= BEAM_RATE_WINDOW_MS) {
+        beamBreaksPerMin = beamWindowBreaks * 60000UL / windowMs;
+        beamWindowBreaks = 0;
+        beamWindowStartMs = now;
     }
     
-    // Don't sleep if recording or transferring
-    if (isRecording) {
-        Serial.println("[POWER] Recording in progress, delaying sleep");
-        return;
+    BeamHealth next = beamHealth;
+    switch (beamHealth) {
+        case BEAM_OK:
+            if (beamBlockedSinceMs && now - beamBlockedSinceMs >= BEAM_STUCK_MS) next = BEAM_STUCK;
+            else if (beamBreaksPerMin >= BEAM_OSC_BREAKS_MIN) next = BEAM_OSCILLATING;
+            break;
+        case BEAM_STUCK:
+            if (beamClearSinceMs && now - beamClearSinceMs >= BEAM_RECOVER_MS) next = BEAM_OK;
+            break;
+        case BEAM_OSCILLATING:
+            if (beamBreaksPerMin <= BEAM_RECOVER_BREAKS_MIN) next = BEAM_OK;
+            break;
     }
+    if (next == beamHealth) return;
     
-    if (transfer.state != IDLE) {
-        Serial.println("[POWER] Transfer in progress, delaying sleep");
-        return;
+    if (next == BEAM_OK) {
+        logHealthEvent("beam_ok", String(stormSuppressed - stormRunStart) + " counted without clip");
+    } else {
+        stormRunStart = stormSuppressed;
+        logHealthEvent(next == BEAM_STUCK ? "beam_stuck" : "beam_oscillating",
+                       String(beamBreaksPerMin) + " breaks/min");
     }
-    
-    // Don't sleep if BLE device is connected
-    if (deviceConnected) {
-        Serial.println("[POWER] BLE device connected, delaying sleep");
-        return;
+    beamHealth = next;
+}
+
+// ============================================================================
+// ENERGY ACCOUNTING
+// ============================================================================
+
+void setIRLed(bool on) {
+    digitalWrite(IR_LED_PIN, on ? HIGH : LOW);
+    irLedOn = on;
+}
+
+// Charge the time since the last call to every state that is currently on.
+// Called from loop() and the recording wait loop, so resolution is ~100 ms.
+void energySample() {
+    unsigned long now = millis();
+    uint64_t dtUs = (uint64_t)(now - energyLastSample) * 1000ULL;
+    energyLastSample = now;
+    
+    bool lowClock = getCpuFrequencyMhz() <= CPU_FREQ_IDLE_MHZ;
+    
+    portENTER_CRITICAL(&energyMux);
+    energyUs[lowClock ? E_CPU_LOW : E_CPU_ACTIVE] += dtUs;
+    if (cameraOK) energyUs[cameraStandby ? E_CAMERA_STBY : E_CAMERA] += dtUs;
+    if (micActive) energyUs[E_MIC] += dtUs;
+    if (irLedOn) energyUs[E_IR_LED] += dtUs;
+    if (bleEnabled) energyUs[deviceConnected ? E_BLE_CONN : E_BLE_ADV] += dtUs;
+    if (lcdOK && lcdBacklightOn) energyUs[E_LCD_BACKLIGHT] += dtUs;
+    portEXIT_CRITICAL(&energyMux);
+}
+
+// SD writes are timed directly - pass micros() taken before the write
+void energyAddSdWrite(unsigned long startUs) {
+    uint32_t dt = micros() - startUs;
+    portENTER_CRITICAL(&energyMux);
+    energyUs[E_SD_WRITE] += dt;
+    portEXIT_CRITICAL(&energyMux);
+}
+
+// Deep sleep time is taken from the RTC - millis() restarted on wake. The
+// storm bucket kept refilling while asleep, so it gets the same credit.
+void creditDeepSleep() {
+    if (!stateRestored || rtcState.sleepStartEpoch == 0) return;
+    
+    uint32_t now = rtc.now().unixtime();
+    if (now > rtcState.sleepStartEpoch) {
+        uint32_t slept = now - rtcState.sleepStartEpoch;
+        energyUs[E_DEEP_SLEEP] += (uint64_t)slept * 1000000ULL;
+        stormTokens = min((float)STORM_BURST, stormTokens + slept * 1000.0f / STORM_REFILL_MS);
     }
-    
-    // Show message on LCD before sleeping
-    if (lcdOK) {
-        lcdPrint("Sleeping...", "Wake at " + String(ACTIVE_START_HOUR) + ":00");
-        delay(2000);
+    if (energyPeriodStart == 0) energyPeriodStart = rtcState.sleepStartEpoch;
+}
+
+float energyStateMah(int state) {
+    return (float)energyUs[state] / 3600000000.0f * ENERGY_CURRENT_MA[state];
+}
+
+float energyTotalMah() {
+    float total = 0;
+    for (int i = 0; i < E_STATE_COUNT; i++) total += energyStateMah(i);
+    return total;
+}
+
+String energyString() {
+    float total = energyTotalMah();
+    uint64_t periodUs = energyUs[E_CPU_ACTIVE] + energyUs[E_CPU_LOW] + energyUs[E_DEEP_SLEEP];
+    float avgMa = periodUs > 0 ? total / ((float)periodUs / 3600000000.0f) : 0;
+    
+    String s = "mAh=" + String(total, 2) + ",avgmA=" + String(avgMa, 2);
+    for (int i = 0; i < E_STATE_COUNT; i++) {
+        s += "," + String(ENERGY_STATE_NAMES[i]) + "=" + String((uint32_t)(energyUs[i] / 1000000ULL)) + "s";
     }
-    
-    enterDeepSleep(actualSleepMins);
+    return s;
 }
 
-void setActiveMode(bool active) {
-    isActiveHours = active;
+// Append this period's time-in-state and mAh to energy.csv and start a new period.
+// Seconds are logged as well as mAh so the host model can re-cost them.
+void logEnergy() {
+    energySample();
     
-    if (active) {
-        // Turn ON monitoring
-        digitalWrite(IR_LED_PIN, HIGH);
-        Serial.println("[POWER] Active mode - IR LED ON");
-        
-        // Re-init camera if needed
-        if (!cameraOK) {
-            initCamera();
+    if (sdOK) {
+        String header = "timestamp,period_start";
+        for (int i = 0; i < ENERGY_CSV_FIRST; i++) header += "," + String(ENERGY_STATE_NAMES[ENERGY_CSV_ORDER[i]]) + "_s";
+        for (int i = 0; i < ENERGY_CSV_FIRST; i++) header += "," + String(ENERGY_STATE_NAMES[ENERGY_CSV_ORDER[i]]) + "_mah";
+        header += ",total_mah,detections,cpu_policy,events,event_mah,elided_frames,elided_kb";
+        for (int i = ENERGY_CSV_FIRST; i < E_STATE_COUNT; i++) {
+            header += "," + String(ENERGY_STATE_NAMES[ENERGY_CSV_ORDER[i]]) + "_s";
+            header += "," + String(ENERGY_STATE_NAMES[ENERGY_CSV_ORDER[i]]) + "_mah";
         }
         
-        // Re-init microphone if needed
-        if (!micOK) {
-            initMicrophone();
+        readSensors();
+        String row = sensors.timestamp + "," + String(energyPeriodStart);
+        for (int i = 0; i < ENERGY_CSV_FIRST; i++) row += "," + String((uint32_t)(energyUs[ENERGY_CSV_ORDER[i]] / 1000000ULL));
+        for (int i = 0; i < ENERGY_CSV_FIRST; i++) row += "," + String(energyStateMah(ENERGY_CSV_ORDER[i]), 3);
+        row += "," + String(energyTotalMah(), 3) + "," + String(detectionCount);
+        row += "," + String(cpuPolicyName()) + "," + String(periodEvents) + "," + String(periodEventMah, 3);
+        row += "," + String(periodElidedFrames) + "," + String((uint32_t)(periodElidedBytes / 1024));
+        for (int i = ENERGY_CSV_FIRST; i < E_STATE_COUNT; i++) {
+            row += "," + String((uint32_t)(energyUs[ENERGY_CSV_ORDER[i]] / 1000000ULL));
+            row += "," + String(energyStateMah(ENERGY_CSV_ORDER[i]), 3);
         }
         
-        if (lcdOK) {
-            lcd.backlight();
-            lcdBacklightOn = true;
-            lcdPrint("Active Mode", "Monitoring...");
+        // Started under another column layout - archive it rather than mix rows
+        sdRun(SD_CLASS_LOG, [&]() {
+            File f = SD_MMC.open("/logs/energy.csv", FILE_READ);
+            if (!f) return;
+            String first = f.readStringUntil('\n');
+            f.close();
+            first.trim();
+            if (first != header && archiveLog("energy")) Serial.println("[ENERGY] Column layout changed - old energy.csv archived");
+        });
+        
+        if (sdAppendLine("/logs/energy.csv", header, row)) {
+            Serial.printf("[ENERGY] Logged: %.2f mAh this period\n", energyTotalMah());
         }
-    } else {
-        // Turn OFF monitoring (but stay awake for BLE access)
-        digitalWrite(IR_LED_PIN, LOW);
-        Serial.println("[POWER] Inactive mode - IR LED OFF");
     }
+    
+    // The period counters restart - carry the window's share so far
+    if (night.night != 0) {
+        night.energyMah += energyTotalMah() - night.energyMarkMah;
+        night.energyMarkMah = 0;
+    }
+    
+    memset(energyUs, 0, sizeof(energyUs));
+    energyPeriodStart = rtcOK ? rtc.now().unixtime() : 0;
+    periodEventMah = 0;
+    periodEvents = 0;
+    acousticListenUs = 0;
+    acousticCpuUs = 0;
+    periodElidedFrames = 0;
+    periodElidedBytes = 0;
+}
+
+// ============================================================================
+// CPU FREQUENCY SCALING
+// ============================================================================
+
+const char* cpuPolicyName() {
+    return cpuPolicy == CPU_POLICY_DYNAMIC ? "dynamic" : "fixed";
+}
+
+// With power management built in, ESP-IDF scales the clock and we only hold
+// a max-frequency lock during bursts. Without it, switch the clock by hand.
+void applyCpuPolicy() {
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t pm = {
+        .max_freq_mhz = CPU_FREQ_MAX_MHZ,
+        .min_freq_mhz = cpuPolicy == CPU_POLICY_DYNAMIC ? CPU_FREQ_IDLE_MHZ : CPU_FREQ_MAX_MHZ,
+        .light_sleep_enable = false   // IR beam is polled - can't sleep between polls
+    };
+    if (esp_pm_configure(&pm) != ESP_OK) Serial.println("[CPU] esp_pm_configure failed");
+    if (cpuMaxLock == NULL) esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "burst", &cpuMaxLock);
+#else
+    bool low = cpuPolicy == CPU_POLICY_DYNAMIC && cpuBoostCount == 0;
+    setCpuFrequencyMhz(low ? CPU_FREQ_IDLE_MHZ : CPU_FREQ_MAX_MHZ);
+#endif
+    Serial.printf("[CPU] Policy %s (%lu MHz now)\n", cpuPolicyName(), (unsigned long)getCpuFrequencyMhz());
+}
+
+// Run at full clock until the matching cpuRelease(). Calls nest.
+void cpuBoost() {
+    cpuBoostCount++;
+#if CONFIG_PM_ENABLE
+    if (cpuMaxLock) esp_pm_lock_acquire(cpuMaxLock);
+#else
+    if (cpuBoostCount == 1 && cpuPolicy == CPU_POLICY_DYNAMIC) setCpuFrequencyMhz(CPU_FREQ_MAX_MHZ);
+#endif
+}
+
+void cpuRelease() {
+    if (cpuBoostCount == 0) return;
+    cpuBoostCount--;
+#if CONFIG_PM_ENABLE
+    if (cpuMaxLock) esp_pm_lock_release(cpuMaxLock);
+#else
+    if (cpuBoostCount == 0 && cpuPolicy == CPU_POLICY_DYNAMIC) setCpuFrequencyMhz(CPU_FREQ_IDLE_MHZ);
+#endif
+}
+
+void setCpuPolicy(CpuPolicy policy) {
+    cpuPolicy = policy;
+    applyCpuPolicy();
+}
+
+// ============================================================================
+// RTC STATE PRESERVATION
+// ============================================================================
+
+uint32_t rtcStateCrc() {
+    return esp_rom_crc32_le(0, (const uint8_t*)&rtcState, offsetof(PersistedState, crc));
+}
+
+void saveRtcState() {
+    memset(&rtcState, 0, sizeof(rtcState));
+    rtcState.magic = RTC_STATE_MAGIC;
+    rtcState.version = RTC_STATE_VERSION;
+    rtcState.size = sizeof(PersistedState);
+    
+    rtcState.detectionCount = detectionCount;
+    rtcState.isActiveHours = isActiveHours;
+    rtcState.lastEnvLogEpoch = lastEnvLogEpoch;
+    
+    rtcState.airTemp = sensors.airTemp;
+    rtcState.humidity = sensors.humidity;
+    rtcState.soilTemp = sensors.soilTemp;
+    rtcState.soilMoisture = sensors.soilMoisture;
+    strncpy(rtcState.timestamp, sensors.timestamp.c_str(), sizeof(rtcState.timestamp) - 1);
+    
+    rtcState.lcdAddress = lcdAddress;
+    rtcState.lcdOK = lcdOK;
+    rtcState.dhtOK = dhtOK;
+    rtcState.ds18b20OK = ds18b20OK;
+    rtcState.bleEnabled = bleEnabled || bleInitPending;
+    
+    rtcState.sdTotalBytes = sdTotalBytes;
+    rtcState.sdUsedBytes = sdUsedBytes;
+    
+    energySample();
+    memcpy(rtcState.energyUs, energyUs, sizeof(energyUs));
+    rtcState.energyPeriodStart = energyPeriodStart;
+    rtcState.sleepStartEpoch = rtcOK ? rtc.now().unixtime() : 0;
+    rtcState.periodEventMah = periodEventMah;
+    rtcState.periodEvents = periodEvents;
+    rtcState.cpuPolicy = cpuPolicy;
+    rtcState.camPowerPolicy = camPowerPolicy;
+    rtcState.powerMode = powerMode;
+    stormRefill();
+    rtcState.stormTokens = stormTokens;
+    rtcState.maintMahToday = maintMahToday;
+    
+    rtcState.night = night;
+    rtcState.lastNight = lastNight;
+    rtcState.flogReplaySeq = flogReplaySeq;
+    
+    rtcState.crc = rtcStateCrc();
+}
+
+// Runs before any peripheral init. Only trusted on a deep-sleep wake -
+// after a reset or power-on everything is probed from scratch.
+void restoreRtcState(esp_sleep_wakeup_cause_t cause) {
+    stateRestored = false;
+    if (cause == ESP_SLEEP_WAKEUP_UNDEFINED) return;
+    
+    if (rtcState.magic != RTC_STATE_MAGIC || rtcState.version != RTC_STATE_VERSION ||
+        rtcState.size != sizeof(PersistedState) || rtcState.crc != rtcStateCrc()) {
+        Serial.println("[STATE] RTC state invalid - full probe");
+        return;
+    }
+    
+    detectionCount = rtcState.detectionCount;
+    isActiveHours = rtcState.isActiveHours;
+    lastEnvLogEpoch = rtcState.lastEnvLogEpoch;
+    
+    sensors.airTemp = rtcState.airTemp;
+    sensors.humidity = rtcState.humidity;
+    sensors.soilTemp = rtcState.soilTemp;
+    sensors.soilMoisture = rtcState.soilMoisture;
+    sensors.timestamp = String(rtcState.timestamp);
+    
+    lcdAddress = rtcState.lcdAddress;
+    
+    memcpy(energyUs, rtcState.energyUs, sizeof(energyUs));
+    energyPeriodStart = rtcState.energyPeriodStart;
+    periodEventMah = rtcState.periodEventMah;
+    periodEvents = rtcState.periodEvents;
+    cpuPolicy = (CpuPolicy)rtcState.cpuPolicy;
+    camPowerPolicy = (CamPowerPolicy)rtcState.camPowerPolicy;
+    powerMode = (PowerMode)rtcState.powerMode;  // Applied by restorePowerMode() once peripherals are up
+    stormTokens = rtcState.stormTokens;
+    maintMahToday = rtcState.maintMahToday;
+    
+    night = rtcState.night;
+    lastNight = rtcState.lastNight;
+    flogReplaySeq = rtcState.flogReplaySeq;
+    
+    stateRestored = true;
+    Serial.printf("[STATE] Restored from RTC memory (det=%lu)\n", detectionCount);
+}
+
+// Carry the env log phase across sleep: millis() restarts at 0 on wake,
+// so back-date lastEnvLog by the time already elapsed on the RTC
+void restoreEnvLogPhase() {
+    if (!stateRestored || !rtcOK || lastEnvLogEpoch == 0) return;
+    
+    uint32_t now = rtc.now().unixtime();
+    if (now < lastEnvLogEpoch) return;
+    uint64_t elapsedMs = (uint64_t)(now - lastEnvLogEpoch) * 1000;  // A long sleep overflows 32-bit ms
+    if (elapsedMs >= cfg.envLogIntervalMs) return;  // Due now - lastEnvLog = 0 already fires
+    
+    lastEnvLog = millis() - (unsigned long)elapsedMs;
 }
 
 // ============================================================================
@@ -2051,22 +6883,53 @@ void setActiveMode(bool active) {
 // ============================================================================
 
 void loop() {
+    energySample();
+    serviceAdvertising();
+    serviceSdRetry();
+    
     // Check scheduled sleep (only if enabled)
     checkScheduleAndSleep();
     
+    // Finish peripherals skipped by a fast wake
+    serviceDeferredInit();
+    serviceCamPower();
+    serviceMotionBench();
+    serviceAdpcmBench();
+    serviceFlogBench();
+    
+    // Battery level drives the degradation mode
+    checkBattery(false);
+    
+    // Clips the finalizer has finished writing
+    serviceFinalize();
+    
+    // CFG: commands from the serial console
+    checkSerialCommands();
+    
+    // Second trigger channel from the mic
+    startAcousticListener();
+    
+    // Hand the beam over to the ULP when idle in active hours
+    checkBeamMonitorSleep();
+    
     // Only monitor IR if within active hours
     if (isWithinActiveHours()) {
         processTransfer();
         checkIRDetection();
+        checkBeamHealth();
         
-        if (irTriggered && !isRecording) {
+        if ((irTriggered || acousticTriggered) && !isRecording) {
+            bool fromAudio = !irTriggered;
             irTriggered = false;
-            recordEvent();
+            acousticTriggered = false;
+            recordEvent(fromAudio);
         }
+        acousticExpireHits();
         
         // Periodic environmental logging
-        if (millis() - lastEnvLog >= ENV_LOG_INTERVAL_MS) {
+        if (millis() - lastEnvLog >= cfg.envLogIntervalMs) {
             lastEnvLog = millis();
+            if (rtcOK) lastEnvLogEpoch = rtc.now().unixtime();
             logEnvironment();
         }
     }
@@ -2086,9 +6949,9 @@ void loop() {
         String bleStatus = !bleEnabled ? "OFF" : (deviceConnected ? "Connected" : "Advertising");
         String schedStatus = ENABLE_SCHEDULED_SLEEP ? 
             (isWithinActiveHours() ? "Active" : "Inactive") : "Always On";
-        Serial.printf("[HEARTBEAT] Det: %lu, BLE: %s, Sched: %s, IR: %s\n",
+        Serial.printf("[HEARTBEAT] Det: %lu, BLE: %s, Sched: %s, IR: %s (%s)\n",
             detectionCount, bleStatus.c_str(), schedStatus.c_str(),
-            digitalRead(IR_RECEIVER_PIN) ? "Clear" : "Blocked");
+            digitalRead(IR_RECEIVER_PIN) ? "Clear" : "Blocked", beamHealthName(beamHealth));
     }
     
     delay(10);
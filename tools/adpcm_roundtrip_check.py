@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+"""
+SmartTrap IMA-ADPCM round-trip check.
+
+Builds the firmware's ADPCM encoder, block decoder and WAV header on the
+host with g++ (taken straight out of SmartTrap.ino) and writes a clip the
+way the audio task does: a synthetic wingbeat-like signal (the same one
+AUDIO:BENCH uses), a length that doesn't fill the last block, and the fact
+chunk. The WAV is then read back by an independent decoder, so a format
+0x11 reader must accept what the trap writes:
+
+    python3 tools/adpcm_roundtrip_check.py
+    python3 tools/adpcm_roundtrip_check.py --seconds 10 --keep clip.wav
+
+Decoder, first one available: soundfile (libsndfile), ffmpeg, then
+Python's audioop IMA decoder applied block by block. Checks that the
+header parses as mono 16 kHz format 0x11 with the firmware's block size,
+that the decoded length matches the fact chunk, that the independent
+decode matches the firmware's own adpcmDecodeBlock(), and that the SNR
+against the original is at least --min-snr dB. The exit status is
+non-zero if any check fails.
+
+Needs g++; soundfile or ffmpeg are optional.
+"""
+
+import argparse
+import math
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import warnings
+
+import sketch_harness as sk
+
+HARNESS = r"""
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+using std::min;
+#define constrain(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
+%(defines)s
+#pragma pack(push, 1)
+%(header)s
+#pragma pack(pop)
+%(code)s
+
+int main(int argc, char** argv) {
+    uint32_t samples = atoi(argv[1]);
+    FILE* wavf = fopen(argv[2], "wb");
+    FILE* orig = fopen(argv[3], "wb");
+    FILE* dec = fopen(argv[4], "wb");
+
+    WAV_HEADER_ADPCM wav;
+    wav.dataSize = adpcmDataSize(samples);
+    wav.chunkSize = sizeof(wav) - 8 + wav.dataSize;
+    wav.sampleRate = AUDIO_SAMPLE_RATE;
+    wav.byteRate = (uint32_t)((uint64_t)AUDIO_SAMPLE_RATE * ADPCM_BLOCK_ALIGN / ADPCM_SAMPLES_PER_BLOCK);
+    wav.factSamples = samples;
+    fwrite(&wav, sizeof(wav), 1, wavf);
+
+    // As adpcmFeed/adpcmFinish: full blocks, last one padded with the final sample
+    static int16_t in[ADPCM_SAMPLES_PER_BLOCK], back[ADPCM_SAMPLES_PER_BLOCK];
+    static uint8_t out[ADPCM_BLOCK_ALIGN];
+    int index = 0;
+    uint32_t rng = 1;
+    for (uint32_t done = 0; done < samples; done += ADPCM_SAMPLES_PER_BLOCK) {
+        int n = min<uint32_t>(ADPCM_SAMPLES_PER_BLOCK, samples - done);
+        for (int i = 0; i < n; i++) {
+            float t = (float)(done + i) / AUDIO_SAMPLE_RATE;
+            rng = rng * 1664525u + 1013904223u;
+            in[i] = 6000 * sinf(2 * M_PI * 180 * t) + 2000 * sinf(2 * M_PI * 360 * t) + (int)(rng >> 16) %% 800 - 400;
+        }
+        fwrite(in, sizeof(int16_t), n, orig);
+        for (int i = n; i < ADPCM_SAMPLES_PER_BLOCK; i++) in[i] = in[n - 1];
+        adpcmEncodeBlock(in, out, &index);
+        fwrite(out, 1, ADPCM_BLOCK_ALIGN, wavf);
+        adpcmDecodeBlock(out, back);
+        fwrite(back, sizeof(int16_t), n, dec);
+    }
+    fclose(wavf);
+    fclose(orig);
+    fclose(dec);
+}
+"""
+
+FUNCTIONS = ["imaStep", "imaEncodeSample", "adpcmEncodeBlock", "adpcmDecodeBlock", "adpcmDataSize"]
+
+
+def harness_source():
+    defines = "\n".join(sk.define(name) for name in ("AUDIO_SAMPLE_RATE", "ADPCM_BLOCK_ALIGN", "ADPCM_SAMPLES_PER_BLOCK"))
+    header = sk.declaration(r"^struct WAV_HEADER_ADPCM \{", "WAV_HEADER_ADPCM")
+    tables = "\n".join(sk.declaration(r"^const \w+ %s\[" % t, t) for t in ("IMA_STEP_TABLE", "IMA_INDEX_TABLE"))
+    code = [tables] + [sk.function(name) for name in FUNCTIONS]
+    return HARNESS % {"defines": defines, "header": header, "code": "\n\n".join(code)}
+
+
+def parse_wav(path):
+    """fmt fields, fact sample count and the data chunk of a WAV file."""
+    data = open(path, "rb").read()
+    if data[:4] != b"RIFF" or data[8:12] != b"WAVE":
+        raise ValueError("not a RIFF/WAVE file")
+    if struct.unpack_from("<I", data, 4)[0] != len(data) - 8:
+        raise ValueError("RIFF size %d, file has %d" % (struct.unpack_from("<I", data, 4)[0], len(data) - 8))
+    chunks = {}
+    pos = 12
+    while pos + 8 <= len(data):
+        fourcc, size = struct.unpack_from("<4sI", data, pos)
+        chunks[fourcc] = data[pos + 8:pos + 8 + size]
+        pos += 8 + size + (size & 1)
+    fmt = chunks[b"fmt "]
+    tag, channels, rate, byte_rate, align, bits, extra, spb = struct.unpack_from("<HHIIHHHH", fmt)
+    return {"tag": tag, "channels": channels, "rate": rate, "byte_rate": byte_rate, "align": align,
+            "bits": bits, "extra": extra, "samples_per_block": spb,
+            "fact": struct.unpack("<I", chunks[b"fact"])[0], "data": chunks[b"data"]}
+
+
+def decode_soundfile(path):
+    import soundfile
+    return list(soundfile.read(path, dtype="int16")[0])
+
+
+def decode_ffmpeg(path):
+    raw = subprocess.check_output(["ffmpeg", "-v", "error", "-i", path, "-f", "s16le", "-"])
+    return list(struct.unpack("<%dh" % (len(raw) // 2), raw))
+
+
+def decode_audioop(path):
+    """CPython's IMA/DVI decoder, one WAV block at a time. audioop reads the
+    high nibble first and has no block header, so both are handled here."""
+    with warnings.catch_warnings():
+        warnings.simplefilter("ignore", DeprecationWarning)
+        import audioop
+    wav = parse_wav(path)
+    out = []
+    for pos in range(0, len(wav["data"]), wav["align"]):
+        block = wav["data"][pos:pos + wav["align"]]
+        first, index = struct.unpack_from("<hB", block)
+        swapped = bytes(((b & 0x0F) << 4) | (b >> 4) for b in block[4:])
+        pcm, _ = audioop.adpcm2lin(swapped, 2, (first, index))
+        out.append(first)
+        out.extend(struct.unpack("<%dh" % (len(pcm) // 2), pcm))
+    return out[:wav["fact"]]
+
+
+def independent_decoder():
+    try:
+        import soundfile  # noqa: F401
+        return "soundfile", decode_soundfile
+    except ImportError:
+        pass
+    if shutil.which("ffmpeg"):
+        return "ffmpeg", decode_ffmpeg
+    try:
+        with warnings.catch_warnings():
+            warnings.simplefilter("ignore", DeprecationWarning)
+            import audioop  # noqa: F401
+        return "audioop", decode_audioop
+    except ImportError:
+        sys.exit("no independent decoder: install soundfile or ffmpeg")
+
+
+def read_s16(path):
+    raw = open(path, "rb").read()
+    return list(struct.unpack("<%dh" % (len(raw) // 2), raw))
+
+
+def snr_db(ref, got):
+    sig = sum(x * x for x in ref)
+    err = sum((a - b) ** 2 for a, b in zip(ref, got))
+    return 99.0 if err == 0 else 10 * math.log10(sig / err)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Round-trip the firmware's IMA-ADPCM WAVs through an independent decoder")
+    ap.add_argument("--seconds", type=float, default=3.3, help="clip length (default 3.3 s, last block partial)")
+    ap.add_argument("--min-snr", type=float, default=25.0, help="minimum SNR in dB (default 25)")
+    ap.add_argument("--keep", help="also save the generated WAV here")
+    args = ap.parse_args()
+
+    failures = []
+
+    def check(ok, what):
+        print("%-4s %s" % ("ok" if ok else "FAIL", what))
+        if not ok:
+            failures.append(what)
+
+    with sk.workdir() as work:
+        wav_path, orig_path, dec_path = (os.path.join(work, n) for n in ("clip.wav", "orig.raw", "fw.raw"))
+        exe = sk.build(work, "adpcm", harness_source(), opt="-O2")
+
+        rate = sk.define_int("AUDIO_SAMPLE_RATE")
+        samples = int(args.seconds * rate)
+        subprocess.check_call([exe, str(samples), wav_path, orig_path, dec_path])
+        if args.keep:
+            shutil.copy(wav_path, args.keep)
+
+        wav = parse_wav(wav_path)
+        orig = read_s16(orig_path)
+        firmware = read_s16(dec_path)
+        name, decode = independent_decoder()
+        decoded = decode(wav_path)
+
+    check(wav["tag"] == 0x11 and wav["channels"] == 1 and wav["bits"] == 4,
+          "fmt: tag 0x%x, %d channel(s), %d bits" % (wav["tag"], wav["channels"], wav["bits"]))
+    check(wav["rate"] == rate, "sample rate %d" % wav["rate"])
+    check(wav["samples_per_block"] == (wav["align"] - 4) * 2 + 1 and wav["extra"] == 2,
+          "block %d bytes, %d samples per block" % (wav["align"], wav["samples_per_block"]))
+    check(len(wav["data"]) % wav["align"] == 0, "data is whole blocks (%d bytes)" % len(wav["data"]))
+    check(wav["fact"] == samples, "fact chunk %d samples" % wav["fact"])
+    check(len(decoded) == samples, "%s decoded %d samples" % (name, len(decoded)))
+    mismatches = sum(1 for a, b in zip(decoded, firmware) if a != b)
+    check(mismatches == 0, "%s matches the firmware decoder (%d samples differ)" % (name, mismatches))
+    snr = snr_db(orig, decoded)
+    check(snr >= args.min_snr, "SNR %.1f dB (%s decode vs original)" % (snr, name))
+    pcm_bytes = samples * 2
+    print("     %d PCM bytes -> %d ADPCM bytes (%.1f%%)" % (pcm_bytes, len(wav["data"]), 100.0 * len(wav["data"]) / pcm_bytes))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
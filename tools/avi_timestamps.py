@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+SmartTrap AVI frame timestamp extractor.
+
+Trap clips carry the capture time of every frame in an "ftms" chunk after
+the idx1 index (uint32 ms from the first frame, one per index entry). This
+writes them out as a per-frame CSV for timing analysis:
+
+    python3 tools/avi_timestamps.py 214532.avi                # CSV to stdout
+    python3 tools/avi_timestamps.py 214532.avi -o 214532.csv
+    python3 tools/avi_timestamps.py events/20240115/*.avi --summary
+
+Columns: frame, ms (from the first frame), interval_ms (from the previous
+frame), bytes (JPEG size, 0 = still frame stored as a drop-frame chunk).
+
+Clips from firmware without the ftms chunk fall back to the nominal rate in
+the stream header, and --summary flags them.
+
+Only needs the Python standard library.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+
+def read_chunks(f, end):
+    """Yield (fourcc, data offset, size) for the chunks up to end."""
+    while f.tell() + 8 <= end:
+        fourcc, size = struct.unpack("<4sI", f.read(8))
+        start = f.tell()
+        yield fourcc, start, size
+        f.seek(start + size + (size & 1))
+
+
+def parse_avi(path):
+    """Return (us_per_frame, frame sizes from idx1, ftms times or None)."""
+    with open(path, "rb") as f:
+        riff, riff_size, kind = struct.unpack("<4sI4s", f.read(12))
+        if riff != b"RIFF" or kind != b"AVI ":
+            raise ValueError("not an AVI file")
+        end = 8 + riff_size
+
+        us_per_frame = None
+        sizes = []
+        times = None
+        for fourcc, start, size in read_chunks(f, end):
+            if fourcc == b"LIST":
+                f.seek(start)
+                if f.read(4) == b"hdrl":
+                    # avih is the first chunk in hdrl; microSecPerFrame leads it
+                    f.seek(start + 4 + 8)
+                    us_per_frame = struct.unpack("<I", f.read(4))[0]
+            elif fourcc == b"idx1":
+                f.seek(start)
+                data = f.read(size)
+                for i in range(0, len(data) - 15, 16):
+                    sizes.append(struct.unpack_from("<I", data, i + 12)[0])
+            elif fourcc == b"ftms":
+                f.seek(start)
+                data = f.read(size)
+                times = list(struct.unpack("<%dI" % (len(data) // 4), data))
+            f.seek(start + size + (size & 1))
+    return us_per_frame, sizes, times
+
+
+def frame_rows(path):
+    us_per_frame, sizes, times = parse_avi(path)
+    if times is None:
+        step = (us_per_frame or 66667) / 1000.0
+        times = [round(i * step) for i in range(len(sizes))]
+    rows = []
+    for i, ms in enumerate(times):
+        interval = ms - times[i - 1] if i > 0 else 0
+        rows.append((i, ms, interval, sizes[i] if i < len(sizes) else ""))
+    return rows
+
+
+def summary(path):
+    us_per_frame, sizes, times = parse_avi(path)
+    if times is None:
+        print("%s: %d frames, no ftms chunk (nominal %.2f fps)"
+              % (path, len(sizes), 1e6 / us_per_frame if us_per_frame else 0))
+        return
+    if len(times) < 2:
+        print("%s: %d frames" % (path, len(times)))
+        return
+    intervals = [b - a for a, b in zip(times, times[1:])]
+    mean = sum(intervals) / len(intervals)
+    late = sum(1 for d in intervals if d > 1.5 * mean)
+    elided = sum(1 for s in sizes if s == 0)
+    print("%s: %d frames over %.2f s, %.2f fps, interval %d-%d ms, %d late, %d elided"
+          % (path, len(times), times[-1] / 1000.0, 1000.0 / mean if mean else 0,
+             min(intervals), max(intervals), late, elided))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Per-frame timestamps from SmartTrap AVI clips")
+    ap.add_argument("avi", nargs="+", help="AVI clip(s) from the trap's /events folder")
+    ap.add_argument("-o", "--output", help="CSV file to write (default stdout, single clip only)")
+    ap.add_argument("--summary", action="store_true", help="one line per clip instead of a CSV")
+    args = ap.parse_args()
+
+    if args.summary:
+        for path in args.avi:
+            try:
+                summary(path)
+            except (OSError, ValueError, struct.error) as e:
+                print("%s: %s" % (path, e), file=sys.stderr)
+        return
+
+    if len(args.avi) > 1:
+        sys.exit("CSV output takes one clip - use --summary for several")
+
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    writer = csv.writer(out)
+    writer.writerow(["frame", "ms", "interval_ms", "bytes"])
+    writer.writerows(frame_rows(args.avi[0]))
+    if args.output:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()
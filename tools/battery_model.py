@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""
+SmartTrap battery runtime model.
+
+Reads /logs/energy.csv copied from a trap's SD card and projects how long a
+given battery would last at the measured usage.
+
+Each energy.csv row is one period (normally one night plus the following
+day's sleep) with the seconds spent in every state. The firmware's own mAh
+columns are ignored by default and recomputed from the seconds, so the
+current table can be changed here without re-flashing:
+
+    python3 tools/battery_model.py energy.csv --capacity 10000
+    python3 tools/battery_model.py energy.csv --capacity 3000 --current cam=150 --current ir=20
+"""
+
+import argparse
+import csv
+import sys
+
+# Must match CURRENT_*_MA in SmartTrap.ino
+DEFAULT_CURRENT_MA = {
+    "cpu": 45.0,
+    "cpuLow": 22.0,
+    "deep": 0.014,
+    "cam": 190.0,
+    "camStby": 6.0,
+    "mic": 1.5,
+    "ir": 15.0,
+    "bleAdv": 8.0,
+    "bleConn": 12.0,
+    "sd": 40.0,
+    "lcd": 20.0,
+}
+
+# States that together cover wall-clock time (the rest overlap them)
+TIME_STATES = ("cpu", "cpuLow", "deep")
+
+
+def parse_args():
+    ap = argparse.ArgumentParser(description="Project SmartTrap battery runtime from energy.csv")
+    ap.add_argument("csv", help="energy.csv from the trap's /logs folder")
+    ap.add_argument("--capacity", type=float, required=True, help="battery capacity in mAh")
+    ap.add_argument("--usable", type=float, default=0.8,
+                    help="usable fraction of rated capacity (default 0.8)")
+    ap.add_argument("--current", action="append", default=[], metavar="STATE=MA",
+                    help="override a state's current, e.g. cam=150 (repeatable)")
+    ap.add_argument("--firmware-mah", action="store_true",
+                    help="use the firmware's logged mAh instead of recomputing")
+    return ap.parse_args()
+
+
+# Older energy.csv files may lack newer state columns - missing columns count as 0
+def load_rows(path):
+    with open(path, newline="") as f:
+        return list(csv.DictReader(f))
+
+
+def main():
+    args = parse_args()
+
+    currents = dict(DEFAULT_CURRENT_MA)
+    for item in args.current:
+        state, _, value = item.partition("=")
+        if state not in currents:
+            sys.exit(f"unknown state '{state}' (known: {', '.join(currents)})")
+        currents[state] = float(value)
+
+    rows = load_rows(args.csv)
+    if not rows:
+        sys.exit("no periods in energy.csv")
+
+    total_hours = 0.0
+    total_mah = 0.0
+    state_mah = {s: 0.0 for s in currents}
+
+    for row in rows:
+        hours = sum(float(row.get(f"{s}_s") or 0) for s in TIME_STATES) / 3600.0
+        total_hours += hours
+        for state, ma in currents.items():
+            if args.firmware_mah:
+                mah = float(row.get(f"{state}_mah") or 0)
+            else:
+                mah = float(row.get(f"{state}_s") or 0) / 3600.0 * ma
+            state_mah[state] += mah
+            total_mah += mah
+
+    if total_hours <= 0:
+        sys.exit("energy.csv covers no time")
+
+    avg_ma = total_mah / total_hours
+    per_day = avg_ma * 24.0
+    usable = args.capacity * args.usable
+    days = usable / per_day if per_day > 0 else float("inf")
+
+    print(f"Periods:        {len(rows)} ({total_hours:.1f} h logged)")
+    print(f"Average draw:   {avg_ma:.2f} mA")
+    print(f"Per day:        {per_day:.1f} mAh")
+    print(f"Battery:        {args.capacity:.0f} mAh x {args.usable:.2f} usable")
+    print(f"Projected life: {days:.1f} days")
+    policies = sorted({row.get("cpu_policy", "") for row in rows} - {""})
+    if policies:
+        print(f"CPU policy:     {', '.join(policies)}")
+    print()
+    print("Where the energy goes:")
+    for state, mah in sorted(state_mah.items(), key=lambda kv: -kv[1]):
+        share = 100.0 * mah / total_mah if total_mah > 0 else 0.0
+        print(f"  {state:8s} {mah:10.1f} mAh  {share:5.1f}%")
+
+
+if __name__ == "__main__":
+    main()
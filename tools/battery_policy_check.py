@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""
+SmartTrap battery policy check.
+
+Builds the firmware's powerModeFor() and batteryPercent() on the host with
+g++ (taken straight out of SmartTrap.ino) and checks the degradation
+policy against the BATTERY_*_MV thresholds in the sketch:
+
+    python3 tools/battery_policy_check.py
+    python3 tools/battery_policy_check.py --trace discharge.csv
+
+Checks that a falling voltage steps down exactly at each threshold, that a
+rising one only steps back up BATTERY_HYSTERESIS_MV above it, that noise
+smaller than the hysteresis around a threshold changes the mode at most
+once, that the mode never rises as the voltage falls, and that 0 mV
+(unknown) means full mode. batteryPercent() must run from 0 to 100 without
+going down and hit each point of its discharge curve.
+
+--trace feeds a simulated source through the policy instead: one mV
+reading per line (a CSV's last column is used, so a column of logged
+readings works too), printing each mode change. The exit status is
+non-zero if any check fails.
+
+Needs g++ and the Python standard library.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+import sketch_harness as sk
+
+MAX_MV = 5000
+DEFINES = ("BATTERY_REDUCED_MV", "BATTERY_AUDIO_ONLY_MV", "BATTERY_COUNT_ONLY_MV", "BATTERY_HYSTERESIS_MV")
+
+HARNESS = r"""
+#include <cstdio>
+#include <cstdint>
+%(defines)s
+%(enum)s
+%(code)s
+
+int main() {
+    for (int current = 0; current < 4; current++) {
+        for (uint32_t mv = 0; mv <= %(max)d; mv++) printf("%%d ", powerModeFor(mv, current));
+        printf("\n");
+    }
+    for (uint32_t mv = 0; mv <= %(max)d; mv++) printf("%%d ", batteryPercent(mv));
+    printf("\n");
+}
+"""
+
+
+def build_tables():
+    """(mode[current][mv], percent[mv]) from the firmware code, and the thresholds."""
+    defines = {name: sk.define_int(name) for name in DEFINES}
+    code = HARNESS % {
+        "defines": "\n".join("#define %s %d" % kv for kv in defines.items()),
+        "enum": sk.find(r"^enum PowerMode \{.*\};", "enum PowerMode").group(0),
+        "code": sk.function("batteryPercent") + "\n\n" + sk.function("powerModeFor"),
+        "max": MAX_MV,
+    }
+    with sk.workdir() as work:
+        exe = sk.build(work, "battery", code)
+        lines = subprocess.check_output([exe], text=True).splitlines()
+    rows = [[int(v) for v in line.split()] for line in lines]
+    return rows[:4], rows[4], defines
+
+
+def run(modes, readings, start=0):
+    """Feed readings through the policy the way checkBattery() does."""
+    mode, changes = start, []
+    for i, mv in enumerate(readings):
+        new = modes[mode][min(mv, MAX_MV)]
+        if new != mode:
+            changes.append((i, mv, mode, new))
+            mode = new
+    return mode, changes
+
+
+def check_policy(modes, d, check):
+    steps = [d["BATTERY_REDUCED_MV"], d["BATTERY_AUDIO_ONLY_MV"], d["BATTERY_COUNT_ONLY_MV"]]
+    hyst = d["BATTERY_HYSTERESIS_MV"]
+
+    _, down = run(modes, range(MAX_MV, 0, -1))
+    got = [(mv, new) for _, mv, _, new in down]
+    want = [(t - 1, i + 1) for i, t in enumerate(steps)]
+    check(got == want, "falling: steps down at %s mV" % ", ".join("<%d" % t for t in steps), got)
+
+    _, up = run(modes, range(1, MAX_MV + 1), start=3)
+    got = [(mv, new) for _, mv, _, new in up]
+    want = [(t + hyst, i) for i, t in reversed(list(enumerate(steps)))]
+    check(got == want, "rising: steps up at %s mV" % ", ".join(">=%d" % (t + hyst) for t in reversed(steps)), got)
+
+    for t in steps:
+        for start in range(4):
+            noise = [t + (hyst - 1 if k % 2 else -1) for k in range(40)]
+            _, changes = run(modes, noise, start)
+            check(len(changes) <= 1, "noise of %d mV around %d mV from mode %d changes the mode at most once" % (hyst, t, start), changes)
+
+    rising = [(c, mv) for c in range(4) for mv in range(1, MAX_MV) if modes[c][mv + 1] > modes[c][mv]]
+    check(not rising, "mode never deepens as the voltage rises", rising[:5])
+    check(all(modes[c][0] == 0 for c in range(4)), "0 mV (unknown) is full mode", [modes[c][0] for c in range(4)])
+
+
+def check_percent(percent, check):
+    body = sk.function("batteryPercent")
+    curve_mv = [int(v) for v in re.search(r"curveMv\[\] = \{([^}]*)\}", body).group(1).split(",")]
+    curve_pct = [int(v) for v in re.search(r"curvePct\[\] = \{([^}]*)\}", body).group(1).split(",")]
+    check(percent[0] == 0 and percent[curve_mv[0]] == 0, "0%% at or below %d mV" % curve_mv[0], percent[curve_mv[0]])
+    check(percent[MAX_MV] == 100 and percent[curve_mv[-1]] == 100, "100%% from %d mV" % curve_mv[-1], percent[curve_mv[-1]])
+    drops = [mv for mv in range(MAX_MV) if percent[mv + 1] < percent[mv]]
+    check(not drops, "percentage never falls as the voltage rises", drops[:5])
+    misses = [(mv, pct, percent[mv]) for mv, pct in zip(curve_mv, curve_pct) if percent[mv] != pct]
+    check(not misses, "hits every point of the %d-point discharge curve" % len(curve_mv), misses)
+
+
+def read_trace(path):
+    readings = []
+    for line in open(path):
+        field = line.strip().split(",")[-1].strip()
+        if field.isdigit():
+            readings.append(int(field))
+    return readings
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Check the firmware's battery degradation policy")
+    ap.add_argument("--trace", help="mV readings, one per line, to feed through the policy")
+    args = ap.parse_args()
+
+    modes, percent, defines = build_tables()
+    names = ["full", "reduced", "audio", "count"]
+
+    if args.trace:
+        readings = read_trace(args.trace)
+        if not readings:
+            sys.exit("no mV readings in %s" % args.trace)
+        mode, changes = run(modes, readings)
+        for i, mv, old, new in changes:
+            print("reading %d: %d mV (%d%%) - %s -> %s" % (i + 1, mv, percent[min(mv, MAX_MV)], names[old], names[new]))
+        print("%d readings, %d mode changes, ends in %s" % (len(readings), len(changes), names[mode]))
+        return
+
+    failures = []
+
+    def check(ok, what, detail):
+        print("%-4s %s" % ("ok" if ok else "FAIL", what))
+        if not ok:
+            print("     got %s" % (detail,))
+            failures.append(what)
+
+    check_policy(modes, defines, check)
+    check_percent(percent, check)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""
+SmartTrap moth classifier benchmark.
+
+Runs a moth_model.tflite over a folder of JPEG frames with the same
+preprocessing as the firmware's classifyJpeg() and reports accuracy and
+per-frame latency, so a model can be checked before it is flashed.
+
+Frames are labelled by their sub-folder name: anything under a folder named
+"moth" is a moth, every other folder is not. Frames pulled out of trap AVIs
+work directly (the firmware scores the same JPEGs):
+
+    python3 tools/classifier_bench.py moth_model.tflite frames/
+    python3 tools/classifier_bench.py moth_model.tflite frames/ --keep-score 0.5 --show-errors
+
+Host latency is only a relative figure - the on-device time per frame is in
+the DIAG CLASSIFIER: line.
+
+Needs Pillow and either tflite-runtime or tensorflow.
+"""
+
+import argparse
+import os
+import sys
+import time
+
+import numpy as np
+from PIL import Image
+
+try:
+    from tflite_runtime.interpreter import Interpreter
+except ImportError:
+    from tensorflow.lite.python.interpreter import Interpreter
+
+# Must match CLASSIFIER_INPUT_SIZE / CLASSIFIER_KEEP_SCORE in SmartTrap.ino
+INPUT_SIZE = 96
+KEEP_SCORE = 0.30
+
+
+def parse_args():
+    ap = argparse.ArgumentParser(description="Benchmark a SmartTrap moth classifier on JPEG frames")
+    ap.add_argument("model", help="int8 .tflite model (1x96x96x1 input, [other, moth] output)")
+    ap.add_argument("frames", help="folder of JPEGs, one sub-folder per label (moth/, other/, ...)")
+    ap.add_argument("--keep-score", type=float, default=KEEP_SCORE,
+                    help="moth score at or above which a clip is kept (default %.2f)" % KEEP_SCORE)
+    ap.add_argument("--show-errors", action="store_true", help="list misclassified frames")
+    return ap.parse_args()
+
+
+def find_frames(root):
+    frames = []
+    for dirpath, _, files in os.walk(root):
+        label = os.path.basename(dirpath).lower() == "moth"
+        for name in sorted(files):
+            if name.lower().endswith((".jpg", ".jpeg")):
+                frames.append((os.path.join(dirpath, name), label))
+    return frames
+
+
+# Mirrors classifyJpeg(): full-size decode, integer luma, nearest-neighbour
+# resize with the same index arithmetic, quantize with the input params
+def preprocess(path, scale, zero_point):
+    img = Image.open(path).convert("RGB")
+    width, height = img.size
+    px = img.load()
+    data = bytearray(INPUT_SIZE * INPUT_SIZE)
+    for y in range(INPUT_SIZE):
+        sy = y * height // INPUT_SIZE
+        for x in range(INPUT_SIZE):
+            r, g, b = px[x * width // INPUT_SIZE, sy]
+            gray = (r * 77 + g * 150 + b * 29) >> 8
+            q = int(round(gray / 255.0 / scale)) + zero_point
+            data[y * INPUT_SIZE + x] = max(-128, min(127, q)) & 0xFF
+    return data
+
+
+def main():
+    args = parse_args()
+
+    interp = Interpreter(model_path=args.model)
+    interp.allocate_tensors()
+    inp = interp.get_input_details()[0]
+    out = interp.get_output_details()[0]
+    if list(inp["shape"]) != [1, INPUT_SIZE, INPUT_SIZE, 1] or inp["dtype"] != np.int8:
+        sys.exit("model must take a 1x%dx%dx1 int8 input (got %s %s)"
+                 % (INPUT_SIZE, INPUT_SIZE, list(inp["shape"]), inp["dtype"].__name__))
+    in_scale, in_zero = inp["quantization"]
+    out_scale, out_zero = out["quantization"]
+
+    frames = find_frames(args.frames)
+    if not frames:
+        sys.exit("no JPEGs under %s" % args.frames)
+
+    tp = fp = tn = fn = 0
+    infer_s = 0.0
+    errors = []
+    for path, is_moth in frames:
+        data = np.frombuffer(preprocess(path, in_scale, in_zero), dtype=np.int8)
+        interp.set_tensor(inp["index"], data.reshape(1, INPUT_SIZE, INPUT_SIZE, 1))
+        start = time.perf_counter()
+        interp.invoke()
+        infer_s += time.perf_counter() - start
+        score = (int(interp.get_tensor(out["index"])[0][1]) - out_zero) * out_scale
+
+        kept = score >= args.keep_score
+        if kept and is_moth:
+            tp += 1
+        elif kept:
+            fp += 1
+            errors.append((path, score, "kept non-moth"))
+        elif is_moth:
+            fn += 1
+            errors.append((path, score, "dropped moth"))
+        else:
+            tn += 1
+
+    total = len(frames)
+    print("Frames:            %d (%d moth, %d other)" % (total, tp + fn, tn + fp))
+    print("Accuracy:          %.1f%%" % (100.0 * (tp + tn) / total))
+    print("Moths kept:        %d / %d" % (tp, tp + fn))
+    print("Non-moths dropped: %d / %d" % (tn, tn + fp))
+    print("Latency:           %.2f ms/frame (host, inference only)" % (1000.0 * infer_s / total))
+
+    if args.show_errors:
+        for path, score, what in errors:
+            print("  %-14s %.2f  %s" % (what, score, path))
+
+
+if __name__ == "__main__":
+    main()
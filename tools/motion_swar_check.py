@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""
+SmartTrap motion kernel check.
+
+Builds the firmware's motionDiffSwar() and its scalar reference
+motionDiffScalar() on the host with g++ (taken straight out of
+SmartTrap.ino) and checks that they agree on the sum of absolute
+differences and the changed-pixel count:
+
+    python3 tools/motion_swar_check.py
+    python3 tools/motion_swar_check.py --random 20000 --seed 7
+
+Covers every supported threshold (0-126) on edge-case buffers (equal,
+0 vs 255 both ways, single-byte steps around the threshold, every byte
+pair for lanes 0-3), lengths that are not a multiple of four, a full
+80x60 motion frame, and random frames. The exit status is non-zero on
+the first mismatch, which is printed.
+
+Needs g++ and the Python standard library.
+"""
+
+import argparse
+import subprocess
+import sys
+
+import sketch_harness as sk
+
+HARNESS = r"""
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+%s
+%s
+
+static uint32_t rng = SEED;
+static uint8_t next() { rng = rng * 1664525u + 1013904223u; return rng >> 24; }
+
+static long cases = 0;
+static bool check(const uint8_t* a, const uint8_t* b, int n, uint8_t t) {
+    uint32_t c1, c2;
+    uint32_t s1 = motionDiffScalar(a, b, n, t, &c1);
+    uint32_t s2 = motionDiffSwar(a, b, n, t, &c2);
+    cases++;
+    if (s1 == s2 && c1 == c2) return true;
+    printf("MISMATCH n=%%d threshold=%%d scalar=%%u/%%u swar=%%u/%%u\n", n, t, s1, c1, s2, c2);
+    for (int i = 0; i < n && i < 16; i++) printf("  [%%d] %%d %%d\n", i, a[i], b[i]);
+    return false;
+}
+
+int main() {
+    static uint8_t a[4800 + 3], b[4800 + 3];
+
+    // Every byte pair in every lane of one word, at a spread of thresholds
+    for (int t = 0; t < 127; t += 7) {
+        for (int lane = 0; lane < 4; lane++) {
+            for (int x = 0; x < 256; x++) {
+                for (int y = 0; y < 256; y++) {
+                    uint8_t wa[4] = { 0x55, 0xAA, 0x00, 0xFF }, wb[4] = { 0x55, 0xAA, 0x00, 0xFF };
+                    wa[lane] = x;
+                    wb[lane] = y;
+                    if (!check(wa, wb, 4, t)) return 1;
+                }
+            }
+        }
+    }
+
+    // Edge-case buffers at every threshold and awkward lengths
+    const int lens[] = { 0, 1, 2, 3, 4, 5, 7, 8, 511, 512, 513, 1023, 4800 };
+    for (int t = 0; t < 127; t++) {
+        for (int n : lens) {
+            for (int pattern = 0; pattern < 6; pattern++) {
+                for (int i = 0; i < n; i++) {
+                    switch (pattern) {
+                        case 0: a[i] = b[i] = next(); break;                      // Equal
+                        case 1: a[i] = 0; b[i] = 255; break;                      // Max, b bigger
+                        case 2: a[i] = 255; b[i] = 0; break;                      // Max, a bigger
+                        case 3: a[i] = 128; b[i] = 128 + (i %% 3 - 1) * (t + (i & 1)); break;  // Around t
+                        case 4: a[i] = i; b[i] = 255 - i; break;
+                        default: a[i] = next(); b[i] = next(); break;
+                    }
+                }
+                if (!check(a, b, n, t)) return 1;
+            }
+        }
+    }
+
+    // Random frames, including misaligned starts
+    for (int r = 0; r < RANDOM; r++) {
+        int n = next() %% 2 ? 4800 : next() * 19 %% 4800;
+        int off = next() & 3;
+        for (int i = 0; i < n + off; i++) { a[i] = next(); b[i] = (next() & 1) ? a[i] + (int8_t)next() / 4 : next(); }
+        if (!check(a + off, b + off, n, next() %% 127)) return 1;
+    }
+    printf("OK: %%ld cases, scalar and SWAR agree\n", cases);
+}
+"""
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Check the SWAR motion kernel against the scalar one")
+    ap.add_argument("--random", type=int, default=5000, help="random frame pairs (default 5000)")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    code = HARNESS % (sk.function("motionDiffScalar", "uint32_t"), sk.function("motionDiffSwar", "uint32_t"))
+    with sk.workdir() as work:
+        exe = sk.build(work, "motion", code, ["-DSEED=%du" % args.seed, "-DRANDOM=%d" % args.random], opt="-O2")
+        sys.exit(subprocess.call([exe]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,89 @@
+"""
+Shared setup for the host checks that build code out of SmartTrap.ino.
+
+The checks copy functions, structs and defines straight from the sketch
+into a small C++ harness and build it with g++, so they always test the
+code that ships:
+
+    import sketch_harness as sk
+    code = HARNESS % sk.function("sunTimes")
+    with sk.workdir() as work:
+        exe = sk.build(work, "sun", code)
+
+Needs g++ and the Python standard library.
+"""
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+SKETCH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "SmartTrap.ino")
+
+_source = None
+
+
+def source():
+    """The sketch, read once."""
+    global _source
+    if _source is None:
+        with open(SKETCH) as f:
+            _source = f.read()
+    return _source
+
+
+def find(pattern, what):
+    """First multiline match of pattern in the sketch, or exit naming what."""
+    m = re.search(pattern, source(), re.M)
+    if not m:
+        sys.exit("%s not found in %s" % (what, SKETCH))
+    return m
+
+
+def block(start, src=None):
+    """Text from start through the brace that closes the first one after it."""
+    src = source() if src is None else src
+    depth = 0
+    for i in range(src.index("{", start), len(src)):
+        if src[i] == "{":
+            depth += 1
+        elif src[i] == "}":
+            depth -= 1
+            if depth == 0:
+                return src[start:i + 1]
+    sys.exit("unbalanced braces in %s" % SKETCH)
+
+
+def function(name, returns=r"\w+"):
+    """Source of a top-level function definition."""
+    return block(find(r"^%s %s\(" % (returns, name), name + "()").start())
+
+
+def declaration(pattern, what):
+    """A struct or array definition starting at pattern, with its ';'."""
+    return block(find(pattern, what).start()) + ";"
+
+
+def define(name):
+    """The whole #define line."""
+    return find(r"^#define %s\b.*$" % name, name).group(0)
+
+
+def define_int(name):
+    """Value of a numeric #define."""
+    return int(find(r"^#define %s\s+(\d+)" % name, name).group(1))
+
+
+def workdir():
+    """Temporary directory for the harness source, binary and outputs."""
+    return tempfile.TemporaryDirectory()
+
+
+def build(work, name, code, flags=(), opt="-O1"):
+    """Compile code as work/name.cpp and return the executable's path."""
+    cpp, exe = os.path.join(work, name + ".cpp"), os.path.join(work, name)
+    with open(cpp, "w") as f:
+        f.write(code)
+    subprocess.check_call(["g++", opt, "-o", exe, cpp] + list(flags))
+    return exe
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""
+SmartTrap sunrise/sunset check.
+
+Builds the firmware's sunTimes() on the host with g++ (taken straight out
+of SmartTrap.ino) and compares a full year of sunrise and sunset times at
+several latitudes against the NOAA Solar Calculator equations, the same
+ones behind NOAA's published sunrise/sunset tables:
+
+    python3 tools/sun_times_check.py
+    python3 tools/sun_times_check.py --year 2025 --tolerance 3
+    python3 tools/sun_times_check.py --noaa-csv greenwich_2025.csv --lat 51.48 --lon -0.01
+
+--noaa-csv compares one site against a table saved from the NOAA Solar
+Calculator instead (columns: date as YYYY-MM-DD, sunrise and sunset as
+HH:MM in UTC, blank for no rise or set).
+
+The firmware's almanac formula is within about 2 min of NOAA at
+mid-latitudes and 4 min at 65 degrees; the default tolerance is 5 min.
+
+Days when either side has no sunrise or sunset (polar day or night) are
+counted separately, not compared. The exit status is non-zero if any
+compared time is off by more than --tolerance minutes.
+
+Needs g++ and the Python standard library.
+"""
+
+import argparse
+import csv
+import datetime
+import math
+import subprocess
+import sys
+
+import sketch_harness as sk
+
+# (name, latitude, longitude) - the default site plus a spread of latitudes
+SITES = [
+    ("equator", 0.0, 32.58),
+    ("tropic", -23.4, -46.63),
+    ("mid", 35.0, 139.7),
+    ("default", 51.48, -0.01),
+    ("north", 60.0, 10.75),
+    ("subarctic", 64.8, -147.7),
+]
+
+HARNESS = r"""
+#include <cmath>
+#include <cstdio>
+#define PI M_PI
+#define SITE_UTC_OFFSET_MIN 0
+%s
+static bool leap(int y) { return y %% 4 == 0 && (y %% 100 != 0 || y %% 400 == 0); }
+int main() {
+    static const int len[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    for (int m = 1; m <= 12; m++) {
+        for (int d = 1; d <= len[m - 1] + (m == 2 && leap(YEAR)); d++) {
+            int rise, set;
+            if (!sunTimes(YEAR, m, d, &rise, &set)) printf("%%d %%d up\n", m, d);
+            else if (rise == 1440) printf("%%d %%d down\n", m, d);
+            else printf("%%d %%d %%d %%d\n", m, d, rise, set);
+        }
+    }
+}
+"""
+
+
+def build(work, year, lat, lon):
+    return sk.build(work, "sun", HARNESS % sk.function("sunTimes", "bool"),
+                    ["-DYEAR=%d" % year, "-DSITE_LATITUDE=%r" % lat, "-DSITE_LONGITUDE=%r" % lon])
+
+
+def firmware_times(exe):
+    """{(month, day): (rise, set) in UTC minutes, or 'up' / 'down'}"""
+    out = {}
+    for line in subprocess.check_output([exe], text=True).splitlines():
+        parts = line.split()
+        key = (int(parts[0]), int(parts[1]))
+        out[key] = parts[2] if len(parts) == 3 else (int(parts[2]), int(parts[3]))
+    return out
+
+
+def noaa_times(date, lat, lon):
+    """NOAA Solar Calculator sunrise/sunset (UTC minutes) for date, or 'up' / 'down'."""
+    jd = date.toordinal() + 1721424.5 + 0.5 - lon / 360.0   # Local solar noon
+    jc = (jd - 2451545.0) / 36525.0
+    l0 = (280.46646 + jc * (36000.76983 + jc * 0.0003032)) % 360.0
+    m = 357.52911 + jc * (35999.05029 - 0.0001537 * jc)
+    e = 0.016708634 - jc * (0.000042037 + 0.0000001267 * jc)
+    rm = math.radians(m)
+    c = (math.sin(rm) * (1.914602 - jc * (0.004817 + 0.000014 * jc))
+         + math.sin(2 * rm) * (0.019993 - 0.000101 * jc) + math.sin(3 * rm) * 0.000289)
+    omega = math.radians(125.04 - 1934.136 * jc)
+    app_long = l0 + c - 0.00569 - 0.00478 * math.sin(omega)
+    obliq = 23 + (26 + (21.448 - jc * (46.815 + jc * (0.00059 - jc * 0.001813))) / 60) / 60
+    obliq += 0.00256 * math.cos(omega)
+    decl = math.asin(math.sin(math.radians(obliq)) * math.sin(math.radians(app_long)))
+    y = math.tan(math.radians(obliq) / 2) ** 2
+    rl0 = math.radians(l0)
+    eq_time = 4 * math.degrees(y * math.sin(2 * rl0) - 2 * e * math.sin(rm)
+                               + 4 * e * y * math.sin(rm) * math.cos(2 * rl0)
+                               - 0.5 * y * y * math.sin(4 * rl0) - 1.25 * e * e * math.sin(2 * rm))
+    rlat = math.radians(lat)
+    cos_ha = (math.cos(math.radians(90.833)) / (math.cos(rlat) * math.cos(decl))
+              - math.tan(rlat) * math.tan(decl))
+    if cos_ha < -1:
+        return "up"
+    if cos_ha > 1:
+        return "down"
+    ha = math.degrees(math.acos(cos_ha))
+    noon = 720 - 4 * lon - eq_time
+    return (round(noon - 4 * ha) % 1440, round(noon + 4 * ha) % 1440)
+
+
+def csv_times(path):
+    def minutes(s):
+        return None if not s.strip() else int(s[:2]) * 60 + int(s[3:5])
+    out = {}
+    with open(path, newline="") as f:
+        for row in csv.reader(f):
+            try:
+                date = datetime.date.fromisoformat(row[0].strip())
+            except ValueError:
+                continue  # Header
+            rise, set_ = minutes(row[1]), minutes(row[2])
+            out[date] = (rise, set_) if rise is not None and set_ is not None else "polar"
+    return out
+
+
+def diff(a, b):
+    d = abs(a - b) % 1440
+    return min(d, 1440 - d)
+
+
+def compare(name, fw, ref, year, tolerance):
+    errors = []
+    skipped = bad = 0
+    worst = (0, None)
+    for (month, day), got in sorted(fw.items()):
+        date = datetime.date(year, month, day)
+        want = ref(date)
+        if want is None:
+            continue
+        if isinstance(got, str) or isinstance(want, str):
+            skipped += 1
+            continue
+        for what, g, w in (("rise", got[0], want[0]), ("set", got[1], want[1])):
+            d = diff(g, w)
+            errors.append(d)
+            if d > worst[0]:
+                worst = (d, "%s %s" % (date, what))
+            if d > tolerance:
+                bad += 1
+    if not errors:
+        print("%-10s no comparable days" % name)
+        return 0
+    print("%-10s %3d days, mean %.2f min, max %d min (%s), %d over %d min, %d polar skipped"
+          % (name, len(errors) // 2, sum(errors) / len(errors), worst[0], worst[1] or "-",
+             bad, tolerance, skipped))
+    return bad
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Check the firmware's sunTimes() against NOAA")
+    ap.add_argument("--year", type=int, default=2025)
+    ap.add_argument("--tolerance", type=int, default=5, help="max allowed error in minutes (default 5)")
+    ap.add_argument("--noaa-csv", help="NOAA table for one site (date,sunrise,sunset in UTC)")
+    ap.add_argument("--lat", type=float, help="site latitude for --noaa-csv")
+    ap.add_argument("--lon", type=float, help="site longitude for --noaa-csv")
+    args = ap.parse_args()
+
+    if args.noaa_csv and (args.lat is None or args.lon is None):
+        sys.exit("--noaa-csv needs --lat and --lon")
+
+    bad = 0
+    with sk.workdir() as work:
+        if args.noaa_csv:
+            table = csv_times(args.noaa_csv)
+            fw = firmware_times(build(work, args.year, args.lat, args.lon))
+            bad += compare("table", fw, table.get, args.year, args.tolerance)
+        else:
+            for name, lat, lon in SITES:
+                fw = firmware_times(build(work, args.year, lat, lon))
+                bad += compare(name, fw, lambda d: noaa_times(d, lat, lon), args.year, args.tolerance)
+    sys.exit(1 if bad else 0)
+
+
+if __name__ == "__main__":
+    main()